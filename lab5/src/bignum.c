@@ -0,0 +1,476 @@
+#include "bignum.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEC_BASE 1000000000u
+
+// Начиная с этого размера (в limb'ах) подумножения Карацубы
+// раздаются отдельным потокам — на меньших числах потоки дороже умножения.
+#define BIG_PAR_THRESHOLD 2048
+
+// Сколько последовательных чисел перемножается "в лоб" в листе дерева.
+#define BIG_LEAF_RANGE 64
+
+static void *BigAlloc(size_t bytes) {
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void BigReserve(struct BigNum *a, size_t cap) {
+    if (a->cap >= cap)
+        return;
+    uint32_t *d = realloc(a->d, cap * sizeof(uint32_t));
+    if (!d) {
+        perror("realloc");
+        exit(1);
+    }
+    a->d = d;
+    a->cap = cap;
+}
+
+static size_t Trim(const uint32_t *d, size_t n) {
+    while (n > 0 && d[n - 1] == 0)
+        n--;
+    return n;
+}
+
+void BigInit(struct BigNum *a, enum BigRadix radix) {
+    a->d = NULL;
+    a->len = 0;
+    a->cap = 0;
+    a->radix = radix;
+}
+
+void BigFree(struct BigNum *a) {
+    free(a->d);
+    a->d = NULL;
+    a->len = a->cap = 0;
+}
+
+void BigSetU32(struct BigNum *a, uint32_t v) {
+    BigReserve(a, 2);
+    a->len = 0;
+    if (a->radix == BIG_HEX) {
+        a->d[0] = v;
+        a->len = v ? 1 : 0;
+        return;
+    }
+    while (v) {
+        a->d[a->len++] = v % DEC_BASE;
+        v /= DEC_BASE;
+    }
+}
+
+// ---------------------------------------------------------------
+// Операции над "сырыми" массивами limb'ов
+// ---------------------------------------------------------------
+
+// r[0..rn) += x[0..xn), xn <= rn; возвращает перенос за r[rn - 1]
+static uint32_t AddInto(uint32_t *r, size_t rn, const uint32_t *x, size_t xn,
+                        enum BigRadix radix) {
+    uint32_t carry = 0;
+    size_t i = 0;
+    if (radix == BIG_HEX) {
+        for (; i < xn; i++) {
+            uint64_t s = (uint64_t)r[i] + x[i] + carry;
+            r[i] = (uint32_t)s;
+            carry = (uint32_t)(s >> 32);
+        }
+        for (; carry && i < rn; i++) {
+            r[i]++;
+            carry = r[i] == 0;
+        }
+    } else {
+        for (; i < xn; i++) {
+            uint32_t s = r[i] + x[i] + carry;
+            carry = s >= DEC_BASE;
+            r[i] = carry ? s - DEC_BASE : s;
+        }
+        for (; carry && i < rn; i++) {
+            r[i]++;
+            carry = r[i] == DEC_BASE;
+            if (carry)
+                r[i] = 0;
+        }
+    }
+    return carry;
+}
+
+// r[0..rn) -= x[0..xn), при этом r >= x
+static void SubInto(uint32_t *r, size_t rn, const uint32_t *x, size_t xn,
+                    enum BigRadix radix) {
+    uint32_t borrow = 0;
+    size_t i = 0;
+    uint32_t base_minus_1 = radix == BIG_HEX ? UINT32_MAX : DEC_BASE - 1;
+    // Без ветвлений: заём предсказывается плохо, а цикл горячий
+    if (radix == BIG_HEX) {
+        for (; i < xn; i++) {
+            uint64_t d = (uint64_t)r[i] - x[i] - borrow;
+            r[i] = (uint32_t)d;
+            borrow = (uint32_t)(d >> 63);
+        }
+    } else {
+        for (; i < xn; i++) {
+            int64_t d = (int64_t)r[i] - x[i] - borrow;
+            borrow = d < 0;
+            r[i] = (uint32_t)(d + (int64_t)(DEC_BASE & -borrow));
+        }
+    }
+    for (; borrow && i < rn; i++) {
+        if (r[i]) {
+            r[i]--;
+            borrow = 0;
+        } else {
+            r[i] = base_minus_1;
+        }
+    }
+}
+
+// r[0..n+m) = a * b, умножение "столбиком" по основанию 2^32
+static void MulSchool(uint32_t *r, const uint32_t *a, size_t n,
+                      const uint32_t *b, size_t m) {
+    memset(r, 0, (n + m) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        uint64_t ai = a[i];
+        if (!ai)
+            continue;
+        uint64_t carry = 0;
+        uint32_t *ri = r + i;
+        for (size_t j = 0; j < m; j++) {
+            uint64_t t = ri[j] + ai * b[j] + carry;
+            ri[j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        ri[m] = (uint32_t)carry;
+    }
+}
+
+// То же для основания 10^9, но по столбцам: до 16 произведений < 10^18
+// копятся в uint64_t без деления, и на столбец приходится одно деление
+// вместо одного на каждое произведение
+static void MulSchoolDec(uint32_t *r, const uint32_t *a, size_t n,
+                         const uint32_t *b, size_t m) {
+    uint64_t carry = 0;
+    for (size_t k = 0; k + 1 < n + m; k++) {
+        size_t i_lo = k >= m ? k - (m - 1) : 0;
+        size_t i_hi = k < n ? k : n - 1;
+        uint64_t acc = carry % DEC_BASE;
+        carry /= DEC_BASE;
+        int cnt = 0;
+        for (size_t i = i_lo; i <= i_hi; i++) {
+            acc += (uint64_t)a[i] * b[k - i];
+            if (++cnt == 16) {
+                carry += acc / DEC_BASE;
+                acc %= DEC_BASE;
+                cnt = 0;
+            }
+        }
+        carry += acc / DEC_BASE;
+        r[k] = (uint32_t)(acc % DEC_BASE);
+    }
+    r[n + m - 1] = (uint32_t)carry;
+}
+
+static void MulRaw(uint32_t *r, const uint32_t *a, size_t n, const uint32_t *b,
+                   size_t m, enum BigRadix radix, int threads);
+
+struct MulTask {
+    uint32_t *r;
+    const uint32_t *a;
+    size_t n;
+    const uint32_t *b;
+    size_t m;
+    enum BigRadix radix;
+    int threads;
+};
+
+static void *MulTaskRun(void *arg) {
+    struct MulTask *t = arg;
+    MulRaw(t->r, t->a, t->n, t->b, t->m, t->radix, t->threads);
+    return NULL;
+}
+
+// r[0..n+m) = a * b: Карацуба выше порога, "столбик" ниже
+static void MulRaw(uint32_t *r, const uint32_t *a, size_t n, const uint32_t *b,
+                   size_t m, enum BigRadix radix, int threads) {
+    if (n < m) {
+        const uint32_t *tp = a;
+        a = b;
+        b = tp;
+        size_t tn = n;
+        n = m;
+        m = tn;
+    }
+    if (m < BIG_KARATSUBA_THRESHOLD) {
+        if (radix == BIG_HEX)
+            MulSchool(r, a, n, b, m);
+        else
+            MulSchoolDec(r, a, n, b, m);
+        return;
+    }
+
+    if (n >= 2 * m) {
+        // Сильно разные длины: режем длинный множитель на куски по m
+        memset(r, 0, (n + m) * sizeof(uint32_t));
+        uint32_t *tmp = BigAlloc(2 * m * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i += m) {
+            size_t cn = n - i < m ? n - i : m;
+            MulRaw(tmp, a + i, cn, b, m, radix, threads);
+            AddInto(r + i, n + m - i, tmp, cn + m, radix);
+        }
+        free(tmp);
+        return;
+    }
+
+    // a = a1*B^h + a0, b = b1*B^h + b0; m > h, поэтому b1 не пуст
+    size_t h = n / 2;
+    size_t an1 = n - h, bn1 = m - h;
+
+    // z0 = a0*b0 -> r[0..2h), z2 = a1*b1 -> r[2h..n+m)
+    struct MulTask z0 = {r, a, h, b, h, radix, 1};
+    struct MulTask z2 = {r + 2 * h, a + h, an1, b + h, bn1, radix, 1};
+
+    size_t sa_n = an1 + 1;
+    size_t sb_n = (bn1 > h ? bn1 : h) + 1;
+    uint32_t *sa = BigAlloc((sa_n + sb_n) * sizeof(uint32_t));
+    uint32_t *sb = sa + sa_n;
+
+    memcpy(sa, a + h, an1 * sizeof(uint32_t));
+    sa[an1] = 0;
+    AddInto(sa, sa_n, a, h, radix);
+    if (bn1 >= h) {
+        memcpy(sb, b + h, bn1 * sizeof(uint32_t));
+        memset(sb + bn1, 0, (sb_n - bn1) * sizeof(uint32_t));
+        AddInto(sb, sb_n, b, h, radix);
+    } else {
+        memcpy(sb, b, h * sizeof(uint32_t));
+        memset(sb + h, 0, (sb_n - h) * sizeof(uint32_t));
+        AddInto(sb, sb_n, b + h, bn1, radix);
+    }
+
+    size_t z1_n = sa_n + sb_n;
+    uint32_t *z1 = BigAlloc(z1_n * sizeof(uint32_t));
+
+    if (threads >= 2 && m >= BIG_PAR_THRESHOLD) {
+        // Три подумножения независимы: z0 и z2 уходят в потоки,
+        // z1 считается в текущем
+        int share = threads / 3 > 0 ? threads / 3 : 1;
+        z0.threads = share;
+        z2.threads = share;
+        int rest = threads - 2 * share > 0 ? threads - 2 * share : 1;
+        pthread_t t0, t2;
+        int ok0 = pthread_create(&t0, NULL, MulTaskRun, &z0) == 0;
+        int ok2 = pthread_create(&t2, NULL, MulTaskRun, &z2) == 0;
+        MulRaw(z1, sa, sa_n, sb, sb_n, radix, rest);
+        if (ok0)
+            pthread_join(t0, NULL);
+        else
+            MulTaskRun(&z0);
+        if (ok2)
+            pthread_join(t2, NULL);
+        else
+            MulTaskRun(&z2);
+    } else {
+        MulTaskRun(&z0);
+        MulTaskRun(&z2);
+        MulRaw(z1, sa, sa_n, sb, sb_n, radix, 1);
+    }
+
+    // z1 = (a0+a1)(b0+b1) - z0 - z2
+    SubInto(z1, z1_n, r, 2 * h, radix);
+    SubInto(z1, z1_n, r + 2 * h, an1 + bn1, radix);
+    AddInto(r + h, n + m - h, z1, Trim(z1, z1_n), radix);
+
+    free(z1);
+    free(sa);
+}
+
+// ---------------------------------------------------------------
+// Публичный интерфейс
+// ---------------------------------------------------------------
+
+void BigMulSmall(struct BigNum *a, uint32_t m) {
+    if (a->len == 0)
+        return;
+    if (m == 0) {
+        a->len = 0;
+        return;
+    }
+    uint64_t carry = 0;
+    if (a->radix == BIG_HEX) {
+        for (size_t i = 0; i < a->len; i++) {
+            uint64_t t = (uint64_t)a->d[i] * m + carry;
+            a->d[i] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        if (carry) {
+            BigReserve(a, a->len + 1);
+            a->d[a->len++] = (uint32_t)carry;
+        }
+        return;
+    }
+    for (size_t i = 0; i < a->len; i++) {
+        uint64_t t = (uint64_t)a->d[i] * m + carry;
+        a->d[i] = (uint32_t)(t % DEC_BASE);
+        carry = t / DEC_BASE;
+    }
+    while (carry) {
+        BigReserve(a, a->len + 1);
+        a->d[a->len++] = (uint32_t)(carry % DEC_BASE);
+        carry /= DEC_BASE;
+    }
+}
+
+void BigMul(struct BigNum *r, const struct BigNum *a, const struct BigNum *b,
+            int threads) {
+    if (a->len == 0 || b->len == 0) {
+        r->len = 0;
+        return;
+    }
+    BigReserve(r, a->len + b->len);
+    MulRaw(r->d, a->d, a->len, b->d, b->len, a->radix, threads);
+    r->len = Trim(r->d, a->len + b->len);
+}
+
+struct RangeTask {
+    struct BigNum *r;
+    uint64_t lo, hi;
+    int threads;
+};
+
+static void *RangeTaskRun(void *arg) {
+    struct RangeTask *t = arg;
+    BigRangeProduct(t->r, t->lo, t->hi, t->threads);
+    return NULL;
+}
+
+void BigRangeProduct(struct BigNum *r, uint64_t lo, uint64_t hi, int threads) {
+    BigSetU32(r, 1);
+    if (lo > hi)
+        return;
+
+    if (hi - lo < BIG_LEAF_RANGE) {
+        // Лист: пакуем несколько соседних чисел в один множитель < 2^32,
+        // чтобы проходов по длинному числу было меньше
+        uint64_t acc = 1;
+        for (uint64_t x = lo; x <= hi; x++) {
+            if (acc * x > UINT32_MAX) {
+                BigMulSmall(r, (uint32_t)acc);
+                acc = 1;
+            }
+            acc *= x;
+        }
+        BigMulSmall(r, (uint32_t)acc);
+        return;
+    }
+
+    uint64_t mid = lo + (hi - lo) / 2;
+    struct BigNum left, right;
+    BigInit(&left, r->radix);
+    BigInit(&right, r->radix);
+
+    struct RangeTask lt = {&left, lo, mid, threads / 2};
+    if (threads > 1) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, RangeTaskRun, &lt) == 0) {
+            BigRangeProduct(&right, mid + 1, hi, threads - threads / 2);
+            pthread_join(tid, NULL);
+        } else {
+            RangeTaskRun(&lt);
+            BigRangeProduct(&right, mid + 1, hi, threads);
+        }
+    } else {
+        lt.threads = 1;
+        RangeTaskRun(&lt);
+        BigRangeProduct(&right, mid + 1, hi, 1);
+    }
+
+    BigMul(r, &left, &right, threads);
+    BigFree(&left);
+    BigFree(&right);
+}
+
+struct ListTask {
+    struct BigNum *r;
+    const uint32_t *xs;
+    size_t n;
+    int threads;
+};
+
+static void *ListTaskRun(void *arg) {
+    struct ListTask *t = arg;
+    BigListProduct(t->r, t->xs, t->n, t->threads);
+    return NULL;
+}
+
+void BigListProduct(struct BigNum *r, const uint32_t *xs, size_t n,
+                    int threads) {
+    BigSetU32(r, 1);
+
+    if (n <= BIG_LEAF_RANGE) {
+        uint64_t acc = 1;
+        for (size_t i = 0; i < n; i++) {
+            if (acc * xs[i] > UINT32_MAX) {
+                BigMulSmall(r, (uint32_t)acc);
+                acc = 1;
+            }
+            acc *= xs[i];
+        }
+        BigMulSmall(r, (uint32_t)acc);
+        return;
+    }
+
+    size_t half = n / 2;
+    struct BigNum left, right;
+    BigInit(&left, r->radix);
+    BigInit(&right, r->radix);
+
+    struct ListTask lt = {&left, xs, half, threads / 2};
+    pthread_t tid;
+    if (threads > 1 && pthread_create(&tid, NULL, ListTaskRun, &lt) == 0) {
+        BigListProduct(&right, xs + half, n - half, threads - threads / 2);
+        pthread_join(tid, NULL);
+    } else {
+        lt.threads = 1;
+        ListTaskRun(&lt);
+        BigListProduct(&right, xs + half, n - half, 1);
+    }
+
+    BigMul(r, &left, &right, threads);
+    BigFree(&left);
+    BigFree(&right);
+}
+
+long long BigPrint(FILE *out, const struct BigNum *a) {
+    if (a->len == 0)
+        return fputs("0", out) < 0 ? -1 : 1;
+
+    const char *first_fmt = a->radix == BIG_HEX ? "%x" : "%u";
+    const char *limb_fmt = a->radix == BIG_HEX ? "%08x" : "%09u";
+
+    // Небольшой буфер вместо одной огромной строки на всё число
+    char buf[1 << 16];
+    size_t used = 0;
+    long long digits = 0;
+
+    for (size_t i = a->len; i-- > 0;) {
+        if (sizeof(buf) - used < 16) {
+            if (fwrite(buf, 1, used, out) != used)
+                return -1;
+            used = 0;
+        }
+        int w = snprintf(buf + used, sizeof(buf) - used,
+                         i == a->len - 1 ? first_fmt : limb_fmt, a->d[i]);
+        used += (size_t)w;
+        digits += w;
+    }
+    if (used && fwrite(buf, 1, used, out) != used)
+        return -1;
+    return digits;
+}
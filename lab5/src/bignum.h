@@ -0,0 +1,56 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Длинная арифметика без сторонних библиотек (без GMP).
+ *
+ * Число хранится массивом 32-битных "цифр" (limb'ов), младшие первыми.
+ * Основание выбирается при создании числа:
+ *   BIG_DEC — 10^9, тогда десятичная печать идёт limb за limb'ом;
+ *   BIG_HEX — 2^32, тогда так же линейно печатается шестнадцатеричная запись.
+ * Перевода между основаниями нет: нужное основание задаётся сразу,
+ * поэтому вывод никогда не стоит квадратичного деления.
+ */
+
+enum BigRadix { BIG_DEC, BIG_HEX };
+
+struct BigNum {
+    uint32_t *d;        // limb'ы, младшие первыми
+    size_t len;         // число значащих limb'ов (0 означает число 0)
+    size_t cap;         // выделено limb'ов
+    enum BigRadix radix;
+};
+
+// Порог (в limb'ах), начиная с которого умножение идёт по Карацубе.
+#define BIG_KARATSUBA_THRESHOLD 48
+
+void BigInit(struct BigNum *a, enum BigRadix radix);   // a = 0
+void BigFree(struct BigNum *a);
+void BigSetU32(struct BigNum *a, uint32_t v);
+
+// a *= m, где m < 2^32
+void BigMulSmall(struct BigNum *a, uint32_t m);
+
+// r = a * b; threads > 1 разрешает раздать подумножения Карацубы потокам.
+// r не должен совпадать с a или b.
+void BigMul(struct BigNum *r, const struct BigNum *a, const struct BigNum *b,
+            int threads);
+
+// r = lo * (lo + 1) * ... * hi (пустой диапазон даёт 1).
+// Дерево произведений: половины диапазона считаются параллельно,
+// пока хватает threads, затем перемножаются через BigMul.
+void BigRangeProduct(struct BigNum *r, uint64_t lo, uint64_t hi, int threads);
+
+// r = xs[0] * xs[1] * ... * xs[n - 1] тем же сбалансированным деревом.
+void BigListProduct(struct BigNum *r, const uint32_t *xs, size_t n,
+                    int threads);
+
+// Потоковая печать через небольшой буфер, без сборки всей строки в памяти.
+// Возвращает количество выведенных цифр или -1 при ошибке записи.
+long long BigPrint(FILE *out, const struct BigNum *a);
+
+#endif // BIGNUM_H
@@ -0,0 +1,404 @@
+/*
+ * counter_bench.c
+ *
+ * Та же нагрузка, что в mutex.c (потоки увеличивают общий счётчик common),
+ * но с замером цены синхронизации. Для каждой стратегии:
+ *   - пропускная способность (инкрементов в секунду);
+ *   - справедливость: индекс Джейна и min/max инкрементов на поток;
+ *   - p50/p99 времени захвата (по выборке каждой --sample операции);
+ *   - проверка, что итоговый счётчик равен сумме инкрементов потоков.
+ *
+ * Пример: ./counter_bench --threads 4 --duration 500 --strategy all
+ */
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+#define MAX_SAMPLES (1 << 16)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------
+// Общее состояние: счётчик и примитивы, каждый на своей кэш-линии
+// ---------------------------------------------------------------
+
+struct PaddedCounter {
+    _Alignas(CACHE_LINE) _Atomic uint64_t value;
+};
+
+// Запрос потока к комбайнеру: pending != 0 — "увеличь счётчик за меня"
+struct CombineSlot {
+    _Alignas(CACHE_LINE) atomic_int pending;
+};
+
+static uint64_t common;  // как в mutex.c, защищается выбранной стратегией
+static _Alignas(CACHE_LINE) _Atomic uint64_t atomic_common;
+
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static _Alignas(CACHE_LINE) atomic_bool spin;
+static _Alignas(CACHE_LINE) atomic_uint ticket_next;
+static _Alignas(CACHE_LINE) atomic_uint ticket_serving;
+static _Alignas(CACHE_LINE) atomic_bool combiner;
+
+static struct PaddedCounter *shards;
+static struct CombineSlot *slots;
+static int nthreads;
+
+static atomic_bool stop;
+
+// ---------------------------------------------------------------
+// Стратегии. acquire() — то, чьё время замеряется;
+// для безблокировочных вариантов это сама операция инкремента
+// ---------------------------------------------------------------
+
+struct Strategy {
+    const char *name;
+    void (*acquire)(int self);
+    void (*release)(int self);  // NULL — инкремент уже сделан в acquire
+    uint64_t (*total)(void);
+};
+
+static uint64_t CommonTotal(void) { return common; }
+
+static void MutexAcquire(int self) { pthread_mutex_lock(&mut); }
+static void MutexRelease(int self) {
+    common++;
+    pthread_mutex_unlock(&mut);
+}
+
+// test-and-test-and-set: крутимся на чтении, пишем только когда свободно
+static void SpinAcquire(int self) {
+    for (;;) {
+        if (!atomic_exchange_explicit(&spin, true, memory_order_acquire))
+            return;
+        while (atomic_load_explicit(&spin, memory_order_relaxed))
+            CPU_RELAX();
+    }
+}
+static void SpinRelease(int self) {
+    common++;
+    atomic_store_explicit(&spin, false, memory_order_release);
+}
+
+// Тикетный замок: строгий FIFO, поэтому справедлив по построению
+static void TicketAcquire(int self) {
+    unsigned my = atomic_fetch_add_explicit(&ticket_next, 1,
+                                            memory_order_relaxed);
+    while (atomic_load_explicit(&ticket_serving, memory_order_acquire) != my)
+        CPU_RELAX();
+}
+static void TicketRelease(int self) {
+    common++;
+    atomic_store_explicit(&ticket_serving,
+                          atomic_load_explicit(&ticket_serving,
+                                               memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+static void AtomicAcquire(int self) {
+    atomic_fetch_add_explicit(&atomic_common, 1, memory_order_relaxed);
+}
+static uint64_t AtomicTotal(void) { return atomic_common; }
+
+// Шардированный счётчик: каждый поток пишет только свою кэш-линию,
+// сумма собирается при чтении
+static void ShardAcquire(int self) {
+    struct PaddedCounter *c = &shards[self];
+    atomic_store_explicit(&c->value,
+                          atomic_load_explicit(&c->value,
+                                               memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+static uint64_t ShardTotal(void) {
+    uint64_t sum = 0;
+    for (int i = 0; i < nthreads; i++)
+        sum += atomic_load_explicit(&shards[i].value, memory_order_relaxed);
+    return sum;
+}
+
+// Flat combining: поток публикует запрос в своём слоте; тот, кто взял
+// замок комбайнера, проходит по всем слотам и выполняет запросы пачкой,
+// так что общий счётчик трогает один поток за раз
+static void CombineAcquire(int self) {
+    struct CombineSlot *me = &slots[self];
+    atomic_store_explicit(&me->pending, 1, memory_order_release);
+    for (;;) {
+        if (!atomic_load_explicit(&combiner, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&combiner, true, memory_order_acquire)) {
+            uint64_t batch = 0;
+            for (int i = 0; i < nthreads; i++) {
+                if (atomic_load_explicit(&slots[i].pending,
+                                         memory_order_acquire)) {
+                    batch++;
+                    atomic_store_explicit(&slots[i].pending, 0,
+                                          memory_order_release);
+                }
+            }
+            common += batch;
+            atomic_store_explicit(&combiner, false, memory_order_release);
+        }
+        if (!atomic_load_explicit(&me->pending, memory_order_acquire))
+            return;
+        CPU_RELAX();
+    }
+}
+
+static const struct Strategy kStrategies[] = {
+    {"mutex", MutexAcquire, MutexRelease, CommonTotal},
+    {"spinlock", SpinAcquire, SpinRelease, CommonTotal},
+    {"ticket", TicketAcquire, TicketRelease, CommonTotal},
+    {"atomic", AtomicAcquire, NULL, AtomicTotal},
+    {"sharded", ShardAcquire, NULL, ShardTotal},
+    {"combining", CombineAcquire, NULL, CommonTotal},
+};
+#define NSTRATEGIES (sizeof(kStrategies) / sizeof(kStrategies[0]))
+
+// ---------------------------------------------------------------
+// Прогон одной стратегии
+// ---------------------------------------------------------------
+
+struct WorkerArgs {
+    int id;
+    const struct Strategy *s;
+    int sample_every;
+    pthread_barrier_t *start;
+    uint64_t ops;
+    uint32_t *samples;  // время захвата в нс, каждая sample_every-я операция
+    size_t nsamples;
+};
+
+static void *Worker(void *arg) {
+    struct WorkerArgs *w = arg;
+    const struct Strategy *s = w->s;
+    uint64_t ops = 0;
+    int countdown = w->sample_every;
+
+    pthread_barrier_wait(w->start);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (--countdown == 0) {
+            countdown = w->sample_every;
+            uint64_t t0 = NowNs();
+            s->acquire(w->id);
+            uint64_t dt = NowNs() - t0;
+            if (w->nsamples < MAX_SAMPLES)
+                w->samples[w->nsamples++] = dt > UINT32_MAX ? UINT32_MAX
+                                                            : (uint32_t)dt;
+        } else {
+            s->acquire(w->id);
+        }
+        if (s->release)
+            s->release(w->id);
+        ops++;
+    }
+    w->ops = ops;
+    return NULL;
+}
+
+static int CmpU32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void ResetState(void) {
+    common = 0;
+    atomic_store(&atomic_common, 0);
+    atomic_store(&spin, false);
+    atomic_store(&ticket_next, 0);
+    atomic_store(&ticket_serving, 0);
+    atomic_store(&combiner, false);
+    for (int i = 0; i < nthreads; i++) {
+        atomic_store(&shards[i].value, 0);
+        atomic_store(&slots[i].pending, 0);
+    }
+    atomic_store(&stop, false);
+}
+
+// Возвращает false, если итоговый счётчик не сошёлся
+static bool RunStrategy(const struct Strategy *s, int duration_ms,
+                        int sample_every) {
+    ResetState();
+
+    pthread_t tids[nthreads];
+    struct WorkerArgs args[nthreads];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned)nthreads + 1);
+
+    for (int i = 0; i < nthreads; i++) {
+        args[i] = (struct WorkerArgs){.id = i, .s = s,
+                                      .sample_every = sample_every,
+                                      .start = &start};
+        args[i].samples = malloc(sizeof(uint32_t) * MAX_SAMPLES);
+        if (!args[i].samples) {
+            perror("malloc");
+            exit(1);
+        }
+        if (pthread_create(&tids[i], NULL, Worker, &args[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    uint64_t t0 = NowNs();
+    usleep((useconds_t)duration_ms * 1000);
+    atomic_store(&stop, true);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    double secs = (double)(NowNs() - t0) / 1e9;
+    pthread_barrier_destroy(&start);
+
+    uint64_t sum = 0, min_ops = UINT64_MAX, max_ops = 0;
+    double sum_sq = 0;
+    size_t nsamples = 0;
+    for (int i = 0; i < nthreads; i++) {
+        sum += args[i].ops;
+        sum_sq += (double)args[i].ops * (double)args[i].ops;
+        if (args[i].ops < min_ops)
+            min_ops = args[i].ops;
+        if (args[i].ops > max_ops)
+            max_ops = args[i].ops;
+        nsamples += args[i].nsamples;
+    }
+
+    uint32_t *all = malloc(sizeof(uint32_t) * (nsamples ? nsamples : 1));
+    if (!all) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t at = 0;
+    for (int i = 0; i < nthreads; i++) {
+        memcpy(all + at, args[i].samples, args[i].nsamples * sizeof(uint32_t));
+        at += args[i].nsamples;
+        free(args[i].samples);
+    }
+    qsort(all, nsamples, sizeof(uint32_t), CmpU32);
+    uint32_t p50 = nsamples ? all[nsamples / 2] : 0;
+    uint32_t p99 = nsamples ? all[(size_t)(nsamples * 0.99)] : 0;
+    free(all);
+
+    // Индекс Джейна: 1 — все потоки сделали поровну, 1/N — всё сделал один
+    double jain = sum_sq > 0 ? (double)sum * sum / (nthreads * sum_sq) : 1.0;
+    uint64_t counter = s->total();
+    bool ok = counter == sum;
+
+    printf("%-10s %10.2f %8.3f %10llu %10llu %8u %8u %12llu %s\n", s->name,
+           (double)sum / secs / 1e6, jain, (unsigned long long)min_ops,
+           (unsigned long long)max_ops, p50, p99, (unsigned long long)counter,
+           ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+// Сколько стоит сам замер: из p50/p99 эту величину стоит мысленно вычесть
+static uint64_t TimerOverheadNs(void) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t0 = NowNs();
+        uint64_t dt = NowNs() - t0;
+        if (dt < best)
+            best = dt;
+    }
+    return best;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s --threads N [--duration ms] [--sample N]"
+           " [--strategy all|mutex|spinlock|ticket|atomic|sharded|combining]\n",
+           prog);
+}
+
+int main(int argc, char **argv) {
+    int threads = -1;
+    int duration_ms = 1000;
+    int sample_every = 64;
+    const char *strategy = "all";
+
+    while (1) {
+        static struct option long_options[] = {
+            {"threads", required_argument, 0, 't'},
+            {"duration", required_argument, 0, 'd'},
+            {"sample", required_argument, 0, 's'},
+            {"strategy", required_argument, 0, 'S'},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "t:d:s:S:", long_options,
+                            &option_index);
+        if (c == -1) break;
+
+        switch (c) {
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'd':
+                duration_ms = atoi(optarg);
+                break;
+            case 's':
+                sample_every = atoi(optarg);
+                break;
+            case 'S':
+                strategy = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (threads <= 0 || duration_ms <= 0 || sample_every <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    nthreads = threads;
+    shards = aligned_alloc(CACHE_LINE, sizeof(*shards) * (size_t)threads);
+    slots = aligned_alloc(CACHE_LINE, sizeof(*slots) * (size_t)threads);
+    if (!shards || !slots) {
+        perror("aligned_alloc");
+        return 1;
+    }
+
+    printf("threads=%d duration=%dms sample=1/%d timer_overhead=%lluns\n",
+           threads, duration_ms, sample_every,
+           (unsigned long long)TimerOverheadNs());
+    printf("%-10s %10s %8s %10s %10s %8s %8s %12s %s\n", "strategy", "Mops/s",
+           "jain", "min_ops", "max_ops", "p50_ns", "p99_ns", "counter",
+           "check");
+
+    bool all_ok = true;
+    bool found = false;
+    for (size_t i = 0; i < NSTRATEGIES; i++) {
+        if (strcmp(strategy, "all") != 0 &&
+            strcmp(strategy, kStrategies[i].name) != 0)
+            continue;
+        found = true;
+        all_ok &= RunStrategy(&kStrategies[i], duration_ms, sample_every);
+    }
+
+    free(shards);
+    free(slots);
+
+    if (!found) {
+        usage(argv[0]);
+        return 1;
+    }
+    return all_ok ? 0 : 1;
+}
@@ -3,61 +3,66 @@
 #include <pthread.h>
 #include <unistd.h>
 
-pthread_mutex_t mutex1 = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex2 = PTHREAD_MUTEX_INITIALIZER;
+#include "lockstat.h"
 
-void *thread_func1(void *arg)
-{
-    printf("[T1] trying to lock mutex1...\n");
-    pthread_mutex_lock(&mutex1);
-    printf("[T1] locked mutex1\n");
-
-    // небольшая пауза, чтобы T2 успел захватить mutex2
-    sleep(1);
-
-    printf("[T1] trying to lock mutex2...\n");
-    pthread_mutex_lock(&mutex2);   // ← здесь можно застрять навсегда
-    printf("[T1] locked mutex2 (this line will likely never print)\n");
+// Кольцо из N потоков: поток i держит mutex[i] и ждёт mutex[i+1],
+// последний ждёт mutex1. При N = 2 это обычная инверсия mutex1/mutex2.
+// С -DLOCKSTAT цикл будет найден и напечатан целиком в момент
+// последнего захвата (см. цель check в makefile)
+#define MAX_RING 3
 
-    pthread_mutex_unlock(&mutex2);
-    pthread_mutex_unlock(&mutex1);
-    return NULL;
-}
+struct LsMutex mutexes[MAX_RING] = {
+    LS_MUTEX_INIT("mutex1"),
+    LS_MUTEX_INIT("mutex2"),
+    LS_MUTEX_INIT("mutex3"),
+};
+static int ring = 2;
 
-void *thread_func2(void *arg)
+void *thread_func(void *arg)
 {
-    printf("[T2] trying to lock mutex2...\n");
-    pthread_mutex_lock(&mutex2);
-    printf("[T2] locked mutex2\n");
+    int i = (int)(long)arg;
+    int next = (i + 1) % ring;
 
-    // небольшая пауза, чтобы T1 успел захватить mutex1
+    printf("[T%d] trying to lock mutex%d...\n", i + 1, i + 1);
+    LsLock(&mutexes[i]);
+    printf("[T%d] locked mutex%d\n", i + 1, i + 1);
+
+    // небольшая пауза, чтобы остальные потоки успели захватить свои
     sleep(1);
 
-    printf("[T2] trying to lock mutex1...\n");
-    pthread_mutex_lock(&mutex1);   // ← а тут застрянет второй поток
-    printf("[T2] locked mutex1 (this line will likely never print)\n");
+    printf("[T%d] trying to lock mutex%d...\n", i + 1, next + 1);
+    LsLock(&mutexes[next]);   // ← здесь можно застрять навсегда
+    printf("[T%d] locked mutex%d (this line will likely never print)\n",
+           i + 1, next + 1);
 
-    pthread_mutex_unlock(&mutex1);
-    pthread_mutex_unlock(&mutex2);
+    LsUnlock(&mutexes[next]);
+    LsUnlock(&mutexes[i]);
     return NULL;
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-    pthread_t t1, t2;
+    pthread_t threads[MAX_RING];
 
-    if (pthread_create(&t1, NULL, thread_func1, NULL) != 0) {
-        perror("pthread_create t1");
-        return 1;
+    if (argc > 1) {
+        ring = atoi(argv[1]);
+        if (ring < 2 || ring > MAX_RING) {
+            fprintf(stderr, "ring size must be in 2..%d\n", MAX_RING);
+            return 1;
+        }
     }
-    if (pthread_create(&t2, NULL, thread_func2, NULL) != 0) {
-        perror("pthread_create t2");
-        return 1;
+
+    for (int i = 0; i < ring; i++) {
+        if (pthread_create(&threads[i], NULL, thread_func,
+                           (void *)(long)i) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
     }
 
-    // будем пытаться подождать оба потока
-    pthread_join(t1, NULL);
-    pthread_join(t2, NULL);
+    // будем пытаться подождать все потоки
+    for (int i = 0; i < ring; i++)
+        pthread_join(threads[i], NULL);
 
     printf("This line will almost never be reached because of deadlock\n");
 
@@ -0,0 +1,321 @@
+#include "lockstat.h"
+
+#ifdef LOCKSTAT
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LS_MAX_HELD 16
+#define LS_MAX_CYCLES 16
+
+struct LsStat {
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_ns, wait_max_ns;
+    uint64_t hold_ns, hold_max_ns;
+};
+
+struct LsHeld {
+    int id;
+    uint64_t since_ns;
+};
+
+// Буфер потока: пишет только владелец, читает только отчёт
+struct LsThread {
+    struct LsStat stats[LS_MAX_LOCKS];
+    struct LsHeld held[LS_MAX_HELD];
+    int nheld;
+    struct LsThread *next;
+};
+
+static __thread struct LsThread *self;
+
+// Реестр буферов и имён замков; трогается только при первом
+// захвате в потоке/первом захвате замка и в отчёте
+static pthread_mutex_t registry = PTHREAD_MUTEX_INITIALIZER;
+static struct LsThread *threads;
+static const char *names[LS_MAX_LOCKS];
+static atomic_int next_id = 1;
+
+// Граф порядка: edges[a][b] — "b захватывали, удерживая a"
+static _Atomic uint8_t edges[LS_MAX_LOCKS][LS_MAX_LOCKS];
+static _Atomic uint8_t reported[LS_MAX_LOCKS][LS_MAX_LOCKS];
+static char cycles[LS_MAX_CYCLES][512];
+static int ncycles;
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void ReportAtExit(void) { LsReport(stderr); }
+
+static struct LsThread *Self(void) {
+    if (self)
+        return self;
+    self = calloc(1, sizeof(*self));
+    if (!self) {
+        perror("calloc");
+        exit(1);
+    }
+    pthread_mutex_lock(&registry);
+    if (!threads)
+        atexit(ReportAtExit);
+    self->next = threads;
+    threads = self;
+    pthread_mutex_unlock(&registry);
+    return self;
+}
+
+static int LockId(struct LsMutex *m) {
+    int id = __atomic_load_n(&m->id, __ATOMIC_ACQUIRE);
+    if (id)
+        return id;
+    pthread_mutex_lock(&registry);
+    id = m->id;
+    if (!id) {
+        id = atomic_fetch_add(&next_id, 1);
+        if (id >= LS_MAX_LOCKS) {
+            id = -1;  // замков больше, чем помещается в граф — не следим
+        } else {
+            names[id] = m->name ? m->name : "?";
+        }
+        __atomic_store_n(&m->id, id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry);
+    return id;
+}
+
+// Путь from -> ... -> to по графу порядка: замки пути по порядку
+// пишутся в path, возвращается их число (0 — пути нет)
+static int Reachable(int from, int to, int path[LS_MAX_LOCKS]) {
+    bool seen[LS_MAX_LOCKS] = {false};
+    int parent[LS_MAX_LOCKS];
+    int stack[LS_MAX_LOCKS];
+    int top = 0;
+    stack[top++] = from;
+    seen[from] = true;
+    parent[from] = 0;
+    while (top) {
+        int v = stack[--top];
+        if (v == to) {
+            int len = 0;
+            for (int u = to; u; u = parent[u])
+                path[len++] = u;
+            // собран от to к from — развернуть
+            for (int i = 0; i < len / 2; i++) {
+                int tmp = path[i];
+                path[i] = path[len - 1 - i];
+                path[len - 1 - i] = tmp;
+            }
+            return len;
+        }
+        for (int u = 1; u < LS_MAX_LOCKS; u++) {
+            if (!seen[u] && atomic_load_explicit(&edges[v][u],
+                                                 memory_order_relaxed)) {
+                seen[u] = true;
+                parent[u] = v;
+                stack[top++] = u;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool AbortOnCycle(void) {
+    const char *v = getenv("LOCKSTAT_ABORT");
+    return v && *v && strcmp(v, "0") != 0;
+}
+
+// Вызывается до блокировки на замке id: ребро held -> id для каждого
+// удерживаемого; новое ребро, замыкающее цикл, сообщается один раз
+static void CheckOrder(struct LsThread *t, int id) {
+    for (int i = 0; i < t->nheld; i++) {
+        int h = t->held[i].id;
+        if (h <= 0 || h == id)
+            continue;
+        if (atomic_exchange_explicit(&edges[h][id], 1, memory_order_relaxed))
+            continue;
+        int path[LS_MAX_LOCKS];
+        int len = Reachable(id, h, path);
+        if (!len)
+            continue;
+        if (atomic_exchange(&reported[h][id], 1))
+            continue;
+
+        // Цикл — новое ребро h -> id и уже известный путь id -> ... -> h;
+        // каждое ребро пути где-то захватывалось в таком порядке
+        char line[512];
+        size_t used = (size_t)snprintf(
+            line, sizeof(line),
+            "lock order cycle: '%s' taken while holding '%s', but elsewhere",
+            names[id], names[h]);
+        for (int k = 0; k + 1 < len && used < sizeof(line); k++) {
+            used += (size_t)snprintf(
+                line + used, sizeof(line) - used, "%s '%s'%s while holding '%s'",
+                k ? "," : "", names[path[k + 1]], k ? "" : " is taken",
+                names[path[k]]);
+        }
+        fprintf(stderr, "[lockstat] %s\n", line);
+        pthread_mutex_lock(&registry);
+        if (ncycles < LS_MAX_CYCLES)
+            strcpy(cycles[ncycles++], line);
+        pthread_mutex_unlock(&registry);
+
+        if (AbortOnCycle())
+            exit(LS_EXIT_CYCLE);
+    }
+}
+
+static void ReportStall(struct LsThread *t, int id, uint64_t waited_ns) {
+    char held[192] = "";
+    size_t used = 0;
+    for (int i = 0; i < t->nheld && used < sizeof(held); i++) {
+        int h = t->held[i].id;
+        used += (size_t)snprintf(held + used, sizeof(held) - used, "%s'%s'",
+                                 i ? ", " : "", h > 0 ? names[h] : "?");
+    }
+    fprintf(stderr,
+            "[lockstat] thread %lu waits for '%s' for %.1fs holding: %s\n",
+            (unsigned long)pthread_self(), id > 0 ? names[id] : "?",
+            waited_ns / 1e9, t->nheld ? held : "nothing");
+}
+
+int LsMutexInit(struct LsMutex *m, const char *name) {
+    m->name = name;
+    m->id = 0;
+    return pthread_mutex_init(&m->m, NULL);
+}
+
+int LsMutexDestroy(struct LsMutex *m) { return pthread_mutex_destroy(&m->m); }
+
+int LsLock(struct LsMutex *m) {
+    struct LsThread *t = Self();
+    int id = LockId(m);
+    if (id > 0)
+        CheckOrder(t, id);
+
+    uint64_t start = NowNs();
+    uint64_t got = start;
+    bool contended = false;
+    int err = pthread_mutex_trylock(&m->m);
+    if (err == EBUSY) {
+        // Ждём порциями, чтобы заметить зависание и сказать, где оно
+        contended = true;
+        bool stalled = false;
+        for (;;) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += 1;
+            err = pthread_mutex_timedlock(&m->m, &until);
+            got = NowNs();
+            if (err != ETIMEDOUT)
+                break;
+            if (!stalled && got - start >= LS_STALL_MS * 1000000ull) {
+                stalled = true;
+                ReportStall(t, id, got - start);
+            }
+        }
+    }
+    if (err)
+        return err;
+
+    if (id > 0) {
+        struct LsStat *s = &t->stats[id];
+        s->acquired++;
+        if (contended) {
+            uint64_t w = got - start;
+            s->contended++;
+            s->wait_ns += w;
+            if (w > s->wait_max_ns)
+                s->wait_max_ns = w;
+        }
+    }
+    if (t->nheld < LS_MAX_HELD) {
+        t->held[t->nheld].id = id;
+        t->held[t->nheld].since_ns = got;
+        t->nheld++;
+    }
+    return 0;
+}
+
+int LsUnlock(struct LsMutex *m) {
+    struct LsThread *t = Self();
+    int id = m->id;
+    // Отпускать можно не в порядке LIFO — ищем с вершины
+    for (int i = t->nheld - 1; i >= 0; i--) {
+        if (t->held[i].id != id)
+            continue;
+        if (id > 0) {
+            uint64_t h = NowNs() - t->held[i].since_ns;
+            struct LsStat *s = &t->stats[id];
+            s->hold_ns += h;
+            if (h > s->hold_max_ns)
+                s->hold_max_ns = h;
+        }
+        memmove(&t->held[i], &t->held[i + 1],
+                (size_t)(t->nheld - i - 1) * sizeof(t->held[0]));
+        t->nheld--;
+        break;
+    }
+    return pthread_mutex_unlock(&m->m);
+}
+
+void LsReport(FILE *out) {
+    struct LsStat sum[LS_MAX_LOCKS];
+    memset(sum, 0, sizeof(sum));
+
+    pthread_mutex_lock(&registry);
+    int nlocks = atomic_load(&next_id);
+    if (nlocks > LS_MAX_LOCKS)
+        nlocks = LS_MAX_LOCKS;
+    for (struct LsThread *t = threads; t; t = t->next) {
+        for (int id = 1; id < nlocks; id++) {
+            const struct LsStat *s = &t->stats[id];
+            sum[id].acquired += s->acquired;
+            sum[id].contended += s->contended;
+            sum[id].wait_ns += s->wait_ns;
+            sum[id].hold_ns += s->hold_ns;
+            if (s->wait_max_ns > sum[id].wait_max_ns)
+                sum[id].wait_max_ns = s->wait_max_ns;
+            if (s->hold_max_ns > sum[id].hold_max_ns)
+                sum[id].hold_max_ns = s->hold_max_ns;
+        }
+    }
+
+    // Самые "горячие" (по суммарному ожиданию) — первыми
+    int order[LS_MAX_LOCKS];
+    int n = 0;
+    for (int id = 1; id < nlocks; id++)
+        order[n++] = id;
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && sum[order[j]].wait_ns > sum[order[j - 1]].wait_ns;
+             j--) {
+            int tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+
+    fprintf(out, "[lockstat] contention report\n");
+    fprintf(out, "%-20s %10s %7s %12s %12s %12s %12s\n", "lock", "acquired",
+            "cont%", "wait_ms", "wait_max_us", "hold_ms", "hold_max_us");
+    for (int i = 0; i < n; i++) {
+        const struct LsStat *s = &sum[order[i]];
+        fprintf(out, "%-20s %10llu %6.1f%% %12.3f %12.1f %12.3f %12.1f\n",
+                names[order[i]], (unsigned long long)s->acquired,
+                s->acquired ? 100.0 * s->contended / s->acquired : 0.0,
+                s->wait_ns / 1e6, s->wait_max_ns / 1e3, s->hold_ns / 1e6,
+                s->hold_max_ns / 1e3);
+    }
+    for (int i = 0; i < ncycles; i++)
+        fprintf(out, "[lockstat] %s\n", cycles[i]);
+    pthread_mutex_unlock(&registry);
+}
+
+#endif  // LOCKSTAT
@@ -0,0 +1,73 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+/*
+ * Лёгкая инструментовка мьютексов.
+ *
+ * При сборке с -DLOCKSTAT каждый захват LsMutex пишет в буфер своего
+ * потока время ожидания и удержания, а глобальный граф порядка захватов
+ * проверяется на циклы в момент захвата: инверсия вида
+ * "mutex1 -> mutex2, затем mutex2 -> mutex1" сообщается ещё до того,
+ * как потоки на ней застрянут. Ожидание дольше LS_STALL_MS тоже
+ * сообщается — с перечнем удерживаемых потоком замков.
+ * При выходе печатается отчёт о конкуренции (или по LsReport()).
+ *
+ * Переменная окружения LOCKSTAT_ABORT=1 завершает процесс с кодом
+ * LS_EXIT_CYCLE при первом найденном цикле — так deadlock_demo
+ * работает как регрессионный тест.
+ *
+ * Без -DLOCKSTAT всё сводится к обычному pthread_mutex_t.
+ */
+
+#define LS_EXIT_CYCLE 3
+
+#ifdef LOCKSTAT
+
+#define LS_MAX_LOCKS 64
+#define LS_STALL_MS 2000
+
+struct LsMutex {
+    pthread_mutex_t m;
+    const char *name;
+    int id;  // выдаётся при первом захвате; 0 — ещё не выдан
+};
+
+#define LS_MUTEX_INIT(lock_name) {PTHREAD_MUTEX_INITIALIZER, lock_name, 0}
+
+int LsMutexInit(struct LsMutex *m, const char *name);
+int LsMutexDestroy(struct LsMutex *m);
+int LsLock(struct LsMutex *m);
+int LsUnlock(struct LsMutex *m);
+
+// Сводка по всем потокам: захваты, доля конкурентных, ожидание, удержание
+void LsReport(FILE *out);
+
+#else  // !LOCKSTAT
+
+struct LsMutex {
+    pthread_mutex_t m;
+};
+
+#define LS_MUTEX_INIT(lock_name) {PTHREAD_MUTEX_INITIALIZER}
+
+static inline int LsMutexInit(struct LsMutex *m, const char *name) {
+    (void)name;
+    return pthread_mutex_init(&m->m, NULL);
+}
+static inline int LsMutexDestroy(struct LsMutex *m) {
+    return pthread_mutex_destroy(&m->m);
+}
+static inline int LsLock(struct LsMutex *m) {
+    return pthread_mutex_lock(&m->m);
+}
+static inline int LsUnlock(struct LsMutex *m) {
+    return pthread_mutex_unlock(&m->m);
+}
+static inline void LsReport(FILE *out) { (void)out; }
+
+#endif  // LOCKSTAT
+
+#endif  // LOCKSTAT_H
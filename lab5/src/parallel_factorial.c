@@ -1,7 +1,13 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <getopt.h>
+#include <string.h>
+
+#include "bignum.h"
+#include "prime_factorial.h"
 
 pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 
@@ -31,10 +37,46 @@ void *ThreadFactorial(void *args) {
     return NULL;
 }
 
+// Способ вычисления: прямое произведение 1*2*...*k или разложение на простые
+enum Engine { ENGINE_PRODUCT, ENGINE_PRIME };
+
+static void usage(const char *prog) {
+    printf("Usage: %s -k num --pnum num --mod num [--engine product|prime]\n"
+           "       %s -k num --pnum num --exact [--format dec|hex]"
+           " [--engine product|prime]\n",
+           prog, prog);
+}
+
+// Точный k! без модуля: параллельное дерево произведений над длинными числами
+static int ExactFactorial(int k, int pnum, enum BigRadix radix,
+                          enum Engine engine) {
+    struct BigNum result;
+    BigInit(&result, radix);
+    if (engine == ENGINE_PRIME)
+        PrimeFactorialExact(&result, (uint32_t)k, pnum);
+    else
+        BigRangeProduct(&result, 1, (uint64_t)k, pnum);
+
+    printf("Result: %s", radix == BIG_HEX ? "0x" : "");
+    long long digits = BigPrint(stdout, &result);
+    printf("\n");
+    BigFree(&result);
+
+    if (digits < 0) {
+        perror("write");
+        return 1;
+    }
+    fprintf(stderr, "Digits: %lld\n", digits);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     int k = -1;
     int pnum = -1;
     int mod = -1;
+    bool exact = false;
+    enum BigRadix radix = BIG_DEC;
+    enum Engine engine = ENGINE_PRODUCT;
 
     // Аргументы командной строки
     while (1) {
@@ -42,11 +84,14 @@ int main(int argc, char **argv) {
             {"k", required_argument, 0, 'k'},
             {"pnum", required_argument, 0, 'p'},
             {"mod", required_argument, 0, 'm'},
+            {"exact", no_argument, 0, 'e'},
+            {"format", required_argument, 0, 'f'},
+            {"engine", required_argument, 0, 'g'},
             {0, 0, 0, 0}
         };
 
         int option_index = 0;
-        int c = getopt_long(argc, argv, "k:p:m:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "k:p:m:ef:g:", long_options, &option_index);
         if (c == -1) break;
 
         switch (c) {
@@ -59,17 +104,51 @@ int main(int argc, char **argv) {
             case 'm':
                 mod = atoi(optarg);
                 break;
+            case 'e':
+                exact = true;
+                break;
+            case 'f':
+                if (strcmp(optarg, "dec") == 0) {
+                    radix = BIG_DEC;
+                } else if (strcmp(optarg, "hex") == 0) {
+                    radix = BIG_HEX;
+                } else {
+                    printf("--format must be dec or hex\n");
+                    return 1;
+                }
+                break;
+            case 'g':
+                if (strcmp(optarg, "product") == 0) {
+                    engine = ENGINE_PRODUCT;
+                } else if (strcmp(optarg, "prime") == 0) {
+                    engine = ENGINE_PRIME;
+                } else {
+                    printf("--engine must be product or prime\n");
+                    return 1;
+                }
+                break;
             default:
-                printf("Usage: %s -k num --pnum num --mod num\n", argv[0]);
+                usage(argv[0]);
                 return 1;
         }
     }
 
-    if (k <= 0 || pnum <= 0 || mod <= 0) {
+    if (k <= 0 || pnum <= 0 || (!exact && mod <= 0)) {
         printf("Arguments must be positive\n");
         return 1;
     }
 
+    if (exact)
+        return ExactFactorial(k, pnum, radix, engine);
+
+    if (engine == ENGINE_PRIME) {
+        // Решето делится между pnum потоками, каждый копит своё
+        // произведение p^e(p), а потом они сводятся в одно
+        printf("Result: %llu\n", (unsigned long long)PrimeRangeProductMod(
+                                      1, (uint64_t)k, (uint64_t)mod, pnum));
+        return 0;
+    }
+
     mod_global = mod;
 
     pthread_t threads[pnum];
@@ -0,0 +1,320 @@
+#include "prime_factorial.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t ISqrt(uint64_t n) {
+    uint64_t r = 0;
+    for (uint64_t bit = 1ULL << 62; bit; bit >>= 2) {
+        if (n >= r + bit) {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+    }
+    return r;
+}
+
+uint32_t *SmallPrimes(uint32_t limit, size_t *count) {
+    *count = 0;
+    uint8_t *composite = calloc((size_t)limit + 1, 1);
+    uint32_t *primes = malloc(sizeof(uint32_t) * ((size_t)limit / 2 + 2));
+    if (!composite || !primes) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint64_t i = 2; i <= limit; i++) {
+        if (composite[i])
+            continue;
+        primes[(*count)++] = (uint32_t)i;
+        for (uint64_t j = i * i; j <= limit; j += i)
+            composite[j] = 1;
+    }
+    free(composite);
+    return primes;
+}
+
+uint32_t *BasePrimes(uint64_t hi, size_t *count) {
+    return SmallPrimes((uint32_t)ISqrt(hi), count);
+}
+
+void SieveSegmented(uint64_t lo, uint64_t hi, const uint32_t *base,
+                    size_t nbase, PrimeVisitor visit, void *ctx) {
+    if (lo <= 2 && hi >= 2)
+        visit(2, ctx);
+    if (lo < 3)
+        lo = 3;
+    if (!(lo & 1))
+        lo++;
+    if (lo > hi)
+        return;
+
+    // Только нечётные: байт i сегмента соответствует числу seg_lo + 2i
+    uint8_t seg[PRIME_SEGMENT_BYTES];
+    const uint64_t span = 2 * (uint64_t)PRIME_SEGMENT_BYTES;
+
+    for (uint64_t seg_lo = lo; seg_lo <= hi;) {
+        uint64_t seg_hi = hi - seg_lo < span - 1 ? hi : seg_lo + span - 1;
+        size_t n = (size_t)((seg_hi - seg_lo) / 2 + 1);
+        memset(seg, 1, n);
+
+        for (size_t i = 0; i < nbase; i++) {
+            uint64_t p = base[i];
+            if (p == 2)
+                continue;
+            if (p * p > seg_hi)
+                break;
+            uint64_t start = p * p;
+            if (start < seg_lo) {
+                start = (seg_lo + p - 1) / p * p;
+                if (!(start & 1))
+                    start += p;
+            }
+            for (uint64_t j = (start - seg_lo) / 2; j < n; j += p)
+                seg[j] = 0;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            if (seg[i])
+                visit(seg_lo + 2 * i, ctx);
+
+        if (seg_hi == hi)
+            break;
+        seg_lo = seg_hi + 1;
+    }
+}
+
+uint64_t LegendreExponent(uint64_t n, uint64_t p) {
+    uint64_t e = 0;
+    while (n >= p) {
+        n /= p;
+        e += n;
+    }
+    return e;
+}
+
+uint64_t MulMod(uint64_t a, uint64_t b, uint64_t mod) {
+    return (uint64_t)((unsigned __int128)a * b % mod);
+}
+
+uint64_t PowMod(uint64_t base, uint64_t exp, uint64_t mod) {
+    uint64_t result = 1 % mod;
+    base %= mod;
+    while (exp) {
+        if (exp & 1)
+            result = MulMod(result, base, mod);
+        base = MulMod(base, base, mod);
+        exp >>= 1;
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------
+// Параллельный проход решетом: [2, hi] режется на threads кусков,
+// каждый поток просеивает свой кусок со своим ctx
+// ---------------------------------------------------------------
+
+struct SieveJob {
+    uint64_t lo, hi;
+    const uint32_t *base;
+    size_t nbase;
+    PrimeVisitor visit;
+    void *ctx;
+};
+
+static void *SieveJobRun(void *arg) {
+    struct SieveJob *j = arg;
+    SieveSegmented(j->lo, j->hi, j->base, j->nbase, j->visit, j->ctx);
+    return NULL;
+}
+
+static void ParallelSieve(uint64_t hi, int threads, PrimeVisitor visit,
+                          void *ctxs, size_t ctx_size) {
+    size_t nbase = 0;
+    uint32_t *base = BasePrimes(hi, &nbase);
+
+    if (threads < 1)
+        threads = 1;
+    pthread_t tids[threads];
+    struct SieveJob jobs[threads];
+    bool started[threads];
+
+    uint64_t total = hi - 1;  // числа 2..hi
+    for (int t = 0; t < threads; t++) {
+        jobs[t].lo = 2 + total / threads * t;
+        jobs[t].hi = t == threads - 1 ? hi : 1 + total / threads * (t + 1);
+        jobs[t].base = base;
+        jobs[t].nbase = nbase;
+        jobs[t].visit = visit;
+        jobs[t].ctx = (char *)ctxs + ctx_size * t;
+        started[t] = t > 0 &&
+                     pthread_create(&tids[t], NULL, SieveJobRun, &jobs[t]) == 0;
+    }
+    // Нулевой кусок (и те, что не удалось отдать потоку) — в текущем потоке
+    for (int t = 0; t < threads; t++)
+        if (!started[t])
+            SieveJobRun(&jobs[t]);
+    for (int t = 0; t < threads; t++)
+        if (started[t])
+            pthread_join(tids[t], NULL);
+
+    free(base);
+}
+
+// ---------------------------------------------------------------
+// k! mod m и произведение диапазона по модулю
+// ---------------------------------------------------------------
+
+struct ModFold {
+    uint64_t below;  // begin - 1
+    uint64_t end;
+    uint64_t mod;
+    uint64_t acc;
+};
+
+static void ModFoldVisit(uint64_t p, void *ctx) {
+    struct ModFold *f = ctx;
+    uint64_t e = LegendreExponent(f->end, p) - LegendreExponent(f->below, p);
+    if (e == 1)
+        f->acc = MulMod(f->acc, p, f->mod);
+    else if (e > 1)
+        f->acc = MulMod(f->acc, PowMod(p, e, f->mod), f->mod);
+}
+
+uint64_t PrimeFoldMod(uint64_t begin, uint64_t end, uint64_t mod,
+                      uint64_t p_lo, uint64_t p_hi, const uint32_t *base,
+                      size_t nbase) {
+    if (mod == 1 || begin == 0)
+        return 0;
+    struct ModFold f = {begin - 1, end, mod, 1 % mod};
+    if (p_hi > end)
+        p_hi = end;
+    if (p_lo <= p_hi)
+        SieveSegmented(p_lo, p_hi, base, nbase, ModFoldVisit, &f);
+    return f.acc;
+}
+
+uint64_t PrimeRangeProductMod(uint64_t begin, uint64_t end, uint64_t mod,
+                              int threads) {
+    if (mod == 1 || begin == 0)
+        return 0;
+    if (begin > end)
+        return 1;
+    // Среди mod подряд идущих чисел обязательно есть кратное mod
+    if (end - begin >= mod - 1)
+        return 0;
+
+    if (threads < 1)
+        threads = 1;
+    struct ModFold folds[threads];
+    for (int t = 0; t < threads; t++) {
+        folds[t].below = begin - 1;
+        folds[t].end = end;
+        folds[t].mod = mod;
+        folds[t].acc = 1 % mod;
+    }
+    if (end >= 2)
+        ParallelSieve(end, threads, ModFoldVisit, folds, sizeof(folds[0]));
+
+    uint64_t result = 1 % mod;
+    for (int t = 0; t < threads; t++)
+        result = MulMod(result, folds[t].acc, mod);
+    return result;
+}
+
+// ---------------------------------------------------------------
+// Точный k!
+// ---------------------------------------------------------------
+
+struct PrimeList {
+    uint32_t *p;
+    size_t len;
+    size_t cap;
+};
+
+static void PrimeListVisit(uint64_t p, void *ctx) {
+    struct PrimeList *l = ctx;
+    if (l->len == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->p = realloc(l->p, l->cap * sizeof(uint32_t));
+        if (!l->p) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->p[l->len++] = (uint32_t)p;
+}
+
+void PrimeFactorialExact(struct BigNum *r, uint32_t k, int threads) {
+    BigSetU32(r, 1);
+    if (k < 2)
+        return;
+    if (threads < 1)
+        threads = 1;
+
+    struct PrimeList lists[threads];
+    memset(lists, 0, sizeof(lists));
+    ParallelSieve(k, threads, PrimeListVisit, lists, sizeof(lists[0]));
+
+    // Куски решета идут по возрастанию — склеиваем по порядку
+    size_t nprimes = 0;
+    for (int t = 0; t < threads; t++)
+        nprimes += lists[t].len;
+    uint32_t *primes = malloc(nprimes * sizeof(uint32_t));
+    uint32_t *exps = malloc(nprimes * sizeof(uint32_t));
+    uint32_t *group = malloc(nprimes * sizeof(uint32_t));
+    if (!primes || !exps || !group) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t at = 0;
+    for (int t = 0; t < threads; t++) {
+        memcpy(primes + at, lists[t].p, lists[t].len * sizeof(uint32_t));
+        at += lists[t].len;
+        free(lists[t].p);
+    }
+    for (size_t i = 0; i < nprimes; i++)
+        exps[i] = (uint32_t)LegendreExponent(k, primes[i]);
+
+    // Наибольший показатель у двойки
+    int top_bit = 31;
+    while (!(exps[0] >> top_bit))
+        top_bit--;
+
+    struct BigNum part, tmp;
+    BigInit(&part, r->radix);
+    BigInit(&tmp, r->radix);
+
+    for (int bit = top_bit; bit >= 0; bit--) {
+        // r = r^2 * P_bit
+        if (bit != top_bit) {
+            BigMul(&tmp, r, r, threads);
+            struct BigNum swap = *r;
+            *r = tmp;
+            tmp = swap;
+        }
+        // Показатели убывают вместе с p, поэтому после первого p,
+        // у которого e(p) < 2^bit, подходящих уже не будет
+        size_t ng = 0;
+        for (size_t i = 0; i < nprimes && exps[i] >> bit; i++)
+            if ((exps[i] >> bit) & 1)
+                group[ng++] = primes[i];
+        if (ng == 0)
+            continue;
+        BigListProduct(&part, group, ng, threads);
+        BigMul(&tmp, r, &part, threads);
+        struct BigNum swap = *r;
+        *r = tmp;
+        tmp = swap;
+    }
+
+    BigFree(&part);
+    BigFree(&tmp);
+    free(primes);
+    free(exps);
+    free(group);
+}
@@ -0,0 +1,60 @@
+#ifndef PRIME_FACTORIAL_H
+#define PRIME_FACTORIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bignum.h"
+
+/*
+ * Факториал через разложение на простые.
+ *
+ * k! = prod p^e(p), где e(p) = k/p + k/p^2 + ... (формула Лежандра).
+ * Простые до k ищутся сегментированным решетом: каждый поток просеивает
+ * свой непрерывный кусок [2, k] сегментами, помещающимися в L1, и сразу
+ * отдаёт найденные простые дальше, не храня их все.
+ * Вместо k умножений получается ~pi(k) * log k операций.
+ */
+
+// Размер сегмента решета в байтах (байт на нечётное число).
+#define PRIME_SEGMENT_BYTES (32 * 1024)
+
+// Вызывается для каждого найденного простого p.
+typedef void (*PrimeVisitor)(uint64_t p, void *ctx);
+
+// Все простые из [lo, hi] по возрастанию; base — простые до sqrt(hi).
+void SieveSegmented(uint64_t lo, uint64_t hi, const uint32_t *base,
+                    size_t nbase, PrimeVisitor visit, void *ctx);
+
+// Простые до limit обычным решетом Эратосфена (для базы сегментного).
+// Возвращает malloc'нутый массив, его длина пишется в *count.
+uint32_t *SmallPrimes(uint32_t limit, size_t *count);
+
+// Простые до sqrt(hi) — база для SieveSegmented по отрезкам до hi.
+uint32_t *BasePrimes(uint64_t hi, size_t *count);
+
+// Показатель степени p в n! по формуле Лежандра.
+uint64_t LegendreExponent(uint64_t n, uint64_t p);
+
+uint64_t MulMod(uint64_t a, uint64_t b, uint64_t mod);
+uint64_t PowMod(uint64_t base, uint64_t exp, uint64_t mod);
+
+// begin * (begin + 1) * ... * end mod m.
+// Показатель p в произведении равен e_end(p) - e_{begin-1}(p),
+// поэтому обратные элементы по модулю не нужны и m может быть составным.
+uint64_t PrimeRangeProductMod(uint64_t begin, uint64_t end, uint64_t mod,
+                              int threads);
+
+// Вклад в PrimeRangeProductMod только простых из [p_lo, p_hi]. Перемножив
+// такие вклады по отрезкам, покрывающим [2, end], получим весь результат —
+// так отрезки можно раздать любым потокам (например, пулу сервера).
+uint64_t PrimeFoldMod(uint64_t begin, uint64_t end, uint64_t mod,
+                      uint64_t p_lo, uint64_t p_hi, const uint32_t *base,
+                      size_t nbase);
+
+// Точный k!: r = prod_j (P_j)^(2^j), где P_j — произведение простых,
+// у которых в e(p) выставлен бит j. P_j собираются сбалансированным
+// деревом, степени — возведением в квадрат старших частей.
+void PrimeFactorialExact(struct BigNum *r, uint32_t k, int threads);
+
+#endif // PRIME_FACTORIAL_H
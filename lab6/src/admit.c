@@ -0,0 +1,61 @@
+#include "admit.h"
+
+#include <string.h>
+
+static uint64_t Cost(uint64_t numbers) { return numbers + ADMIT_REQUEST_COST; }
+
+void AdmissionInit(struct Admission *a, size_t limit) {
+  memset(a, 0, sizeof(*a));
+  a->limit = limit;
+  LsMutexInit(&a->lock, "admission");
+}
+
+bool Admit(struct Admission *a, uint64_t numbers, uint64_t now,
+           uint64_t deadline, uint64_t *retry_ns) {
+  uint64_t cost = Cost(numbers);
+  LsLock(&a->lock);
+  double wait = (double)a->backlog * a->ns_per_number;
+  bool full = a->limit && a->pending >= a->limit;
+  bool late = deadline && (deadline <= now ||
+                           (a->ns_per_number > 0 &&
+                            wait + (double)cost * a->ns_per_number >
+                                (double)(deadline - now) * ADMIT_HEADROOM));
+  if (full || late) {
+    LsUnlock(&a->lock);
+    *retry_ns =
+        wait > ADMIT_MIN_RETRY_NS ? (uint64_t)wait : ADMIT_MIN_RETRY_NS;
+    return false;
+  }
+  // Время до первого ответа меряем от начала занятости, а не от
+  // прошлого ответа: простой в цену числа не входит
+  if (a->pending++ == 0)
+    a->last_done = now;
+  a->backlog += cost;
+  LsUnlock(&a->lock);
+  return true;
+}
+
+void AdmissionDone(struct Admission *a, uint64_t numbers, uint64_t now,
+                   bool measured) {
+  uint64_t cost = Cost(numbers);
+  LsLock(&a->lock);
+  if (measured) {
+    double sample = (double)(now - a->last_done) / (double)cost;
+    a->ns_per_number =
+        a->ns_per_number > 0
+            ? a->ns_per_number + (sample - a->ns_per_number) * ADMIT_EWMA_WEIGHT
+            : sample;
+    a->last_done = now;
+  }
+  a->pending--;
+  a->backlog -= cost;
+  LsUnlock(&a->lock);
+}
+
+void AdmissionStats(struct Admission *a, size_t *pending,
+                    double *ns_per_number) {
+  LsLock(&a->lock);
+  *pending = a->pending;
+  *ns_per_number = a->ns_per_number;
+  LsUnlock(&a->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef ADMIT_H
+#define ADMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lockstat.h"
+
+/*
+ * Допуск запросов в очередь пула (общий для всех сетевых циклов).
+ *
+ * В очереди и в работе одновременно не больше limit запросов. Сколько
+ * ещё ждать, оценивается по скорости разгребания очереди: после каждого
+ * ответа время с предыдущего делится на числа ответившего запроса, и
+ * это скользящее среднее наносекунд на число умножается на всё, что
+ * стоит впереди. Запрос со сроком, который по этой оценке не успеет,
+ * не берётся вовсе: лучше сразу отказать с подсказкой, когда повторить,
+ * чем посчитать ответ, который уже никому не нужен.
+ */
+
+#define ADMIT_DEFAULT_LIMIT 1024
+// Доля нового замера в скользящем среднем
+#define ADMIT_EWMA_WEIGHT 0.0625
+// Накладные расходы на запрос, в числах: иначе поток коротких запросов
+// дал бы завышенную цену числа
+#define ADMIT_REQUEST_COST 1024
+// Меньше этого повторять не предлагаем: пока цена числа не измерена,
+// оценка очереди — ноль
+#define ADMIT_MIN_RETRY_NS 1000000ull
+// Оценка очереди грубая, а ответу ещё ехать по сети: запрос берём, только
+// если по оценке он успевает за эту долю своего срока
+#define ADMIT_HEADROOM 0.75
+
+struct Admission {
+  struct LsMutex lock;
+  size_t limit;      // 0 — без ограничения
+  size_t pending;    // запросов в очереди и в работе
+  uint64_t backlog;  // их цена в числах
+  double ns_per_number;  // 0 — пока неизвестно
+  uint64_t last_done;    // последний ответ или начало занятости
+};
+
+void AdmissionInit(struct Admission *a, size_t limit);
+// Взять запрос на numbers чисел. deadline — момент NowNs(), к которому
+// нужен ответ, 0 — без срока. false — отказ, *retry_ns — через сколько
+// наносекунд очередь по оценке разгребётся
+bool Admit(struct Admission *a, uint64_t numbers, uint64_t now,
+           uint64_t deadline, uint64_t *retry_ns);
+// Запрос, взятый Admit, закончен. measured — он правда считался: по
+// отменённым и просроченным скорость не меряем
+void AdmissionDone(struct Admission *a, uint64_t numbers, uint64_t now,
+                   bool measured);
+// Сколько сейчас запросов в очереди и оценка наносекунд на число
+void AdmissionStats(struct Admission *a, size_t *pending, double *ns_per_number);
+
+#endif  // ADMIT_H
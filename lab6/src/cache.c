@@ -0,0 +1,116 @@
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct CacheEntry {
+  uint64_t mod;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t value;
+  int32_t next;  // следующая запись цепочки, -1 — конец
+  bool referenced;
+};
+
+static size_t Hash(const struct RangeCache *c, uint64_t mod, uint64_t begin,
+                   uint64_t end) {
+  uint64_t h = mod * 0x9E3779B97F4A7C15ull;
+  h ^= begin + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+  h ^= end + 0x85EBCA77C2B2AE63ull + (h << 6) + (h >> 2);
+  return (size_t)(h ^ (h >> 29)) & (c->nbuckets - 1);
+}
+
+int RangeCacheInit(struct RangeCache *c, size_t bytes) {
+  memset(c, 0, sizeof(*c));
+  size_t per_entry = sizeof(struct CacheEntry) + sizeof(int32_t);
+  size_t capacity = bytes / per_entry;
+  if (capacity > INT32_MAX)
+    capacity = INT32_MAX;
+  if (capacity == 0)
+    return 0;
+  // Таблица — степень двойки не больше числа записей, чтобы уложиться
+  // в лимит; цепочки в среднем длиной 1-2
+  size_t nbuckets = 1;
+  while (nbuckets * 2 <= capacity)
+    nbuckets *= 2;
+
+  c->entries = malloc(capacity * sizeof(*c->entries));
+  c->buckets = malloc(nbuckets * sizeof(*c->buckets));
+  if (!c->entries || !c->buckets) {
+    RangeCacheFree(c);
+    return -1;
+  }
+  memset(c->buckets, 0xff, nbuckets * sizeof(*c->buckets));
+  c->capacity = capacity;
+  c->nbuckets = nbuckets;
+  return 0;
+}
+
+void RangeCacheFree(struct RangeCache *c) {
+  free(c->entries);
+  free(c->buckets);
+  c->entries = NULL;
+  c->buckets = NULL;
+  c->capacity = c->used = 0;
+}
+
+bool RangeCacheGet(struct RangeCache *c, uint64_t mod, uint64_t begin,
+                   uint64_t end, uint64_t *value) {
+  if (!c->capacity)
+    return false;
+  for (int32_t i = c->buckets[Hash(c, mod, begin, end)]; i >= 0;
+       i = c->entries[i].next) {
+    struct CacheEntry *e = &c->entries[i];
+    if (e->mod == mod && e->begin == begin && e->end == end) {
+      e->referenced = true;
+      *value = e->value;
+      c->hits++;
+      return true;
+    }
+  }
+  c->misses++;
+  return false;
+}
+
+// Освободить запись по CLOCK и вернуть её номер
+static int32_t Evict(struct RangeCache *c) {
+  while (true) {
+    struct CacheEntry *e = &c->entries[c->hand];
+    int32_t i = (int32_t)c->hand;
+    c->hand = (c->hand + 1) % c->capacity;
+    if (e->referenced) {
+      e->referenced = false;
+      continue;
+    }
+    int32_t *pp = &c->buckets[Hash(c, e->mod, e->begin, e->end)];
+    while (*pp != i)
+      pp = &c->entries[*pp].next;
+    *pp = e->next;
+    c->evictions++;
+    return i;
+  }
+}
+
+void RangeCachePut(struct RangeCache *c, uint64_t mod, uint64_t begin,
+                   uint64_t end, uint64_t value) {
+  if (!c->capacity)
+    return;
+  size_t b = Hash(c, mod, begin, end);
+  for (int32_t i = c->buckets[b]; i >= 0; i = c->entries[i].next) {
+    struct CacheEntry *e = &c->entries[i];
+    if (e->mod == mod && e->begin == begin && e->end == end) {
+      e->value = value;
+      return;
+    }
+  }
+  int32_t i = c->used < c->capacity ? (int32_t)c->used++ : Evict(c);
+  struct CacheEntry *e = &c->entries[i];
+  e->mod = mod;
+  e->begin = begin;
+  e->end = end;
+  e->value = value;
+  // Новая запись переживёт один оборот стрелки
+  e->referenced = true;
+  e->next = c->buckets[b];
+  c->buckets[b] = i;
+}
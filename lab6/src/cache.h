@@ -0,0 +1,47 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Кэш посчитанных произведений диапазонов: (mod, begin, end) -> значение.
+ *
+ * Хранятся выровненные блоки coalescer'а и целые диапазоны, которые
+ * на блоки не режутся, поэтому повторный или пересекающийся запрос
+ * собирается из готовых блоков и досчитывает только края.
+ *
+ * Записи лежат в массиве фиксированного размера, который определяется
+ * лимитом памяти; вытеснение — CLOCK: стрелка обходит записи, снимая
+ * бит обращения, и освобождает первую запись без него.
+ *
+ * Своей блокировки нет: кэш принадлежит coalescer'у и вызывается под
+ * его мьютексом.
+ */
+
+struct CacheEntry;
+
+struct RangeCache {
+  struct CacheEntry *entries;
+  int32_t *buckets;  // голова цепочки, -1 — пусто
+  size_t nbuckets;   // степень двойки
+  size_t capacity;
+  size_t used;
+  size_t hand;  // стрелка CLOCK
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+// bytes — лимит памяти на записи и таблицу; 0 — кэш выключен.
+// Возвращает 0 или -1, если память не выделилась.
+int RangeCacheInit(struct RangeCache *c, size_t bytes);
+void RangeCacheFree(struct RangeCache *c);
+
+bool RangeCacheGet(struct RangeCache *c, uint64_t mod, uint64_t begin,
+                   uint64_t end, uint64_t *value);
+void RangeCachePut(struct RangeCache *c, uint64_t mod, uint64_t begin,
+                   uint64_t end, uint64_t value);
+
+#endif  // CACHE_H
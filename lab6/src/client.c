@@ -9,53 +9,439 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "journal.h"
+#include "protocol.h"
+#include "sched.h"
+#include "shm_ring.h"
+
+// Кусков в полёте на сервер по умолчанию: пока сервер считает одни,
+// следующие уже лежат у него во входном буфере
+#define DEFAULT_PIPELINE 4
+#define MAX_PIPELINE 64
+#define LINK_IN_BUF 4096
+#define MAX_IOV 64
+// Пока shm-сервер считает, раз в столько проверяем сокеты и жив ли он
+#define SHM_POLL_MS 1
+
+_Static_assert(MAX_PIPELINE <= SHM_SLOTS, "shm ring must fit the pipeline");
+
+enum Transport {
+  TRANSPORT_TCP,   // ip:port
+  TRANSPORT_UNIX,  // unix:/path
+  TRANSPORT_SHM,   // shm:/name
+};
 
 struct Server {
-  char ip[255];
+  enum Transport transport;
+  char addr[255];  // хост (в DNS не больше 253 символов), путь или имя
   int port;
+  char name[272];  // как в файле: для сообщений
+};
+
+enum LinkState { LINK_CONNECTING, LINK_OPEN };
+
+// Кусок в полёте на сервере
+struct Slot {
+  uint32_t id;
+  bool hedge;      // копия куска, который уже считает другой сервер
+  bool cancelled;  // кусок засчитан у другого, отмена отправлена
+};
+
+// Соединение с одним сервером
+struct Link {
+  const struct Server *server;
+  int fd;                   // -1 у shm
+  struct ShmChannel *shm;  // NULL у сокетов
+  enum LinkState state;
+  struct LinkRate rate;
+  struct Slot slots[MAX_PIPELINE];  // в порядке отправки
+  size_t nslots;
+  size_t nsent;     // первые nsent кадров ушли целиком
+  size_t sent_off;  // байт следующего кадра уже отправлено
+  unsigned char in[LINK_IN_BUF];
+  size_t in_len;
+  unsigned char ctl[MAX_PIPELINE * FRAME_HEADER_SIZE];  // кадры отмены
+  size_t ctl_len;
+  size_t ctl_off;  // сколько из ctl уже отправлено
+  uint64_t retry_at;  // сервер отверг кусок: новых не шлём до этого момента
+  bool failed;        // сервер отвалился, его куски отданы остальным
 };
 
-uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
-  uint64_t result = 0;
-  a = a % mod;
-  while (b > 0) {
-    if (b % 2 == 1)
-      result = (result + a) % mod;
-    a = (a * 2) % mod;
-    b /= 2;
+static struct Sched sched;
+static struct Link *links;
+static size_t nlinks;
+static size_t nfailed;
+static struct Journal journal;
+static bool journaling;
+
+// Разобрать строку файла серверов в *srv. false — строка неверна
+static bool ParseServer(char *s, struct Server *srv) {
+  if (strncmp(s, "unix:", 5) == 0 || strncmp(s, "shm:", 4) == 0) {
+    bool unix_sock = s[0] == 'u';
+    const char *path = strchr(s, ':') + 1;
+    struct sockaddr_un addr;
+    // Имя shm — "/имя"; путь сокета должен влезть в sun_path
+    size_t max = unix_sock ? sizeof(addr.sun_path) : sizeof(srv->addr);
+    if (!path[0] || strlen(path) >= max || (!unix_sock && path[0] != '/'))
+      return false;
+    srv->transport = unix_sock ? TRANSPORT_UNIX : TRANSPORT_SHM;
+    strcpy(srv->addr, path);
+    srv->port = 0;
+    snprintf(srv->name, sizeof(srv->name), "%s", s);
+    return true;
   }
+  char *colon = strrchr(s, ':');
+  uint64_t port = 0;
+  if (colon)
+    *colon = '\0';
+  if (!colon || colon == s || strlen(s) >= sizeof(srv->addr) ||
+      !ConvertStringToUI64(colon + 1, &port) || port == 0 || port > 65535)
+    return false;
+  srv->transport = TRANSPORT_TCP;
+  strcpy(srv->addr, s);
+  srv->port = (int)port;
+  snprintf(srv->name, sizeof(srv->name), "%s:%d", s, srv->port);
+  return true;
+}
 
-  return result % mod;
+// Файл со строками ip:port, unix:/path или shm:/name; пустые строки и
+// строки с # пропускаются
+static struct Server *ReadServers(const char *path, size_t *count) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  size_t n = 0, cap = 4;
+  struct Server *servers = malloc(cap * sizeof(*servers));
+  char line[512];
+  int lineno = 0;
+  while (servers && fgets(line, sizeof(line), f)) {
+    lineno++;
+    line[strcspn(line, "\r\n#")] = '\0';
+    char *s = line + strspn(line, " \t");
+    if (!*s)
+      continue;
+    s[strcspn(s, " \t")] = '\0';
+    if (n == cap) {
+      cap *= 2;
+      struct Server *grown = realloc(servers, cap * sizeof(*servers));
+      if (!grown) {
+        free(servers);
+        servers = NULL;
+        break;
+      }
+      servers = grown;
+    }
+    if (!ParseServer(s, &servers[n])) {
+      fprintf(stderr, "%s:%d: expected ip:port, unix:/path or shm:/name\n",
+              path, lineno);
+      free(servers);
+      servers = NULL;
+      break;
+    }
+    n++;
+  }
+  fclose(f);
+  if (servers && n == 0) {
+    fprintf(stderr, "%s: no servers\n", path);
+    free(servers);
+    servers = NULL;
+  }
+  *count = n;
+  return servers;
 }
 
-bool ConvertStringToUI64(const char *str, uint64_t *val) {
-  char *end = NULL;
-  unsigned long long i = strtoull(str, &end, 10);
-  if (errno == ERANGE) {
-    fprintf(stderr, "Out of uint64_t range: %s\n", str);
+// Неблокирующее подключение; false — сервер недоступен сразу
+static bool StartConnect(struct Link *ln) {
+  ln->fd = -1;
+  ln->state = LINK_OPEN;
+  if (ln->server->transport == TRANSPORT_SHM) {
+    ln->shm = ShmAttach(ln->server->addr);
+    return ln->shm != NULL;
+  }
+  if (ln->server->transport == TRANSPORT_UNIX) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, ln->server->addr);
+    ln->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (ln->fd < 0) {
+      fprintf(stderr, "Socket creation failed!\n");
+      return false;
+    }
+    // Локальный сокет подключается сразу или не подключается вовсе
+    if (connect(ln->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      fprintf(stderr, "Connection to %s failed: %s\n", ln->server->name,
+              strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  char port[16];
+  snprintf(port, sizeof(port), "%d", ln->server->port);
+  struct addrinfo hints = {0}, *res = NULL;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(ln->server->addr, port, &hints, &res);
+  if (err) {
+    fprintf(stderr, "getaddrinfo failed with %s: %s\n", ln->server->addr,
+            gai_strerror(err));
     return false;
   }
 
-  if (errno != 0)
+  ln->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (ln->fd < 0) {
+    fprintf(stderr, "Socket creation failed!\n");
+    freeaddrinfo(res);
+    return false;
+  }
+  int rc = connect(ln->fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc < 0 && errno != EINPROGRESS) {
+    fprintf(stderr, "Connection to %s failed\n", ln->server->name);
     return false;
+  }
+  ln->state = rc == 0 ? LINK_OPEN : LINK_CONNECTING;
+  return true;
+}
 
-  *val = i;
+// Сервер недоступен: его куски, в том числе ещё не отправленные,
+// возвращаются планировщику и уходят оставшимся серверам
+static void DropLink(struct Link *ln) {
+  uint64_t now = NowNs();
+  for (size_t i = 0; i < ln->nslots; i++)
+    SchedAbandon(&sched, ln->slots[i].id, &ln->rate, now);
+  fprintf(stderr, "Server %s failed, %zu chunks reassigned\n",
+          ln->server->name, ln->nslots);
+  ln->nslots = ln->nsent = ln->sent_off = 0;
+  ln->ctl_len = ln->ctl_off = 0;
+  if (ln->shm)
+    ShmDetach(ln->shm);
+  else if (ln->fd >= 0)
+    close(ln->fd);
+  ln->shm = NULL;
+  ln->fd = -1;
+  ln->failed = true;
+  if (++nfailed == nlinks) {
+    fprintf(stderr, "All servers failed%s\n",
+            journaling ? ", finished chunks are in the journal" : "");
+    exit(1);
+  }
+}
+
+// Догрузить сервер кусками до pipeline штук в полёте
+static void Fill(struct Link *ln, size_t pipeline, uint64_t now) {
+  if (ln->failed || now < ln->retry_at)
+    return;
+  while (ln->nslots < pipeline) {
+    long id = SchedNext(&sched, &ln->rate, now);
+    if (id < 0)
+      return;
+    ln->slots[ln->nslots].id = (uint32_t)id;
+    ln->slots[ln->nslots].hedge = sched.chunks[id].copies > 1;
+    ln->slots[ln->nslots].cancelled = false;
+    ln->nslots++;
+  }
+}
+
+// Отправить все ещё не ушедшие кадры, по MAX_IOV за один writev
+static bool SendFrames(struct Link *ln) {
+  if (ln->shm) {
+    // Конвейер не длиннее кольца, так что место есть всегда
+    while (ln->nsent < ln->nslots &&
+           ShmPush(&ln->shm->req, sched.chunks[ln->slots[ln->nsent].id].frame,
+                   REQUEST_FRAME_SIZE))
+      ln->nsent++;
+    return true;
+  }
+  while (ln->nsent < ln->nslots || ln->ctl_off < ln->ctl_len) {
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    // Кадры отмены идут первыми, но не посреди недоотправленного запроса
+    size_t ctl = ln->sent_off ? 0 : ln->ctl_len - ln->ctl_off;
+    if (ctl) {
+      iov[cnt].iov_base = ln->ctl + ln->ctl_off;
+      iov[cnt++].iov_len = ctl;
+    }
+    for (size_t i = ln->nsent; i < ln->nslots && cnt < MAX_IOV; i++, cnt++) {
+      size_t skip = i == ln->nsent ? ln->sent_off : 0;
+      iov[cnt].iov_base = sched.chunks[ln->slots[i].id].frame + skip;
+      iov[cnt].iov_len = REQUEST_FRAME_SIZE - skip;
+    }
+    ssize_t n = writev(ln->fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return true;
+      fprintf(stderr, "Send to %s failed\n", ln->server->name);
+      return false;
+    }
+    size_t sent = (size_t)n < ctl ? (size_t)n : ctl;
+    ln->ctl_off += sent;
+    if (ln->ctl_off == ln->ctl_len)
+      ln->ctl_off = ln->ctl_len = 0;
+    size_t done = ln->sent_off + (size_t)n - sent;
+    ln->nsent += done / REQUEST_FRAME_SIZE;
+    ln->sent_off = done % REQUEST_FRAME_SIZE;
+  }
   return true;
 }
 
+static void RemoveSlot(struct Link *ln, size_t i) {
+  memmove(&ln->slots[i], &ln->slots[i + 1],
+          (ln->nslots - i - 1) * sizeof(ln->slots[0]));
+  ln->nslots--;
+}
+
+// Кусок id засчитан: снять его копии с остальных серверов. Ещё не
+// отправленную копию просто забываем, отправленной — шлём FRAME_CANCEL.
+// Счёт в кольце shm сервер не прерывает, ему отмену не шлём
+static void CancelCopies(const struct Link *winner, uint32_t id) {
+  for (size_t j = 0; j < nlinks; j++) {
+    struct Link *ln = &links[j];
+    if (ln == winner || !ln->server || ln->failed)
+      continue;
+    for (size_t i = 0; i < ln->nslots; i++) {
+      struct Slot *sl = &ln->slots[i];
+      if (sl->id != id || sl->cancelled)
+        continue;
+      if (i > ln->nsent || (i == ln->nsent && !ln->sent_off)) {
+        RemoveSlot(ln, i);
+        SchedAbandon(&sched, id, &ln->rate, NowNs());
+      } else if (!ln->shm && ln->ctl_len < sizeof(ln->ctl)) {
+        EncodeCancel(ln->ctl + ln->ctl_len, id);
+        ln->ctl_len += FRAME_HEADER_SIZE;
+        sl->cancelled = true;
+      }
+      break;
+    }
+  }
+}
+
+// Ответ на кусок id: убрать его из полёта и отдать планировщику
+static bool Complete(struct Link *ln, uint32_t id, uint64_t value,
+                     uint16_t flags) {
+  size_t i = 0;
+  while (i < ln->nsent && ln->slots[i].id != id)
+    i++;
+  if (i == ln->nsent)
+    return false;
+  bool hedge = ln->slots[i].hedge;
+  RemoveSlot(ln, i);
+  ln->nsent--;
+  uint64_t now = NowNs();
+  if (flags) {
+    // Отвергнутый кусок уйдёт другому серверу или этому же, но не раньше,
+    // чем он просил
+    SchedAbandon(&sched, id, &ln->rate, now);
+    if (flags & FRAME_FLAG_REJECTED)
+      ln->retry_at = now + value * 1000;
+    return true;
+  }
+  if (SchedComplete(&sched, id, value, &ln->rate, now)) {
+    const struct Chunk *c = &sched.chunks[id];
+    if (journaling && !JournalAppend(&journal, c->begin, c->end, value, now))
+      exit(1);
+    if (hedge)
+      ln->rate.wins++;
+    if (sched.chunks[id].copies)
+      CancelCopies(ln, id);
+  }
+  return true;
+}
+
+// Разобрать целый кадр ответа. Ответы идут в любом порядке; кусок
+// узнаём по id
+static bool OnReply(struct Link *ln, const unsigned char *frame) {
+  struct FrameHeader h;
+  if (!DecodeHeader(frame, &h) || h.type != FRAME_REPLY ||
+      h.length != REPLY_PAYLOAD ||
+      !Complete(ln, h.id, GetU64(frame + FRAME_HEADER_SIZE),
+                h.flags)) {
+    fprintf(stderr, "Bad reply from %s\n", ln->server->name);
+    return false;
+  }
+  return true;
+}
+
+// Забрать все ответы, уже лежащие в кольце shm
+static bool ReadShmReplies(struct Link *ln) {
+  const unsigned char *frame;
+  while ((frame = ShmPeek(&ln->shm->rep))) {
+    if (!OnReply(ln, frame))
+      return false;
+    ShmRelease(&ln->shm->rep);
+  }
+  return true;
+}
+
+// Прочитать, что пришло, и разобрать все целые кадры ответа
+static bool ReadReplies(struct Link *ln) {
+  while (true) {
+    ssize_t n = recv(ln->fd, ln->in + ln->in_len, LINK_IN_BUF - ln->in_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return true;
+    if (n <= 0) {
+      fprintf(stderr, "Recieve from %s failed\n", ln->server->name);
+      return false;
+    }
+    ln->in_len += (size_t)n;
+
+    size_t off = 0;
+    while (ln->in_len - off >= REPLY_FRAME_SIZE) {
+      if (!OnReply(ln, ln->in + off))
+        return false;
+      off += REPLY_FRAME_SIZE;
+    }
+    ln->in_len -= off;
+    memmove(ln->in, ln->in + off, ln->in_len);
+  }
+}
+
+// Продвинуть обмен с сервером по событиям poll. false — ошибка
+static bool Step(struct Link *ln, short revents) {
+  if (ln->state == LINK_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(ln->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+      fprintf(stderr, "Connection to %s failed: %s\n", ln->server->name,
+              strerror(err));
+      return false;
+    }
+    ln->state = LINK_OPEN;
+  }
+  if (!SendFrames(ln))
+    return false;
+  if (revents & (POLLIN | POLLHUP | POLLERR))
+    return ReadReplies(ln);
+  return true;
+}
+
+static bool Restore(uint64_t begin, uint64_t end, uint64_t value, void *ctx) {
+  (void)ctx;
+  return SchedRestore(&sched, begin, end, value);
+}
+
 int main(int argc, char **argv) {
   uint64_t k = -1;
   uint64_t mod = -1;
-  char servers[255] = {'\0'}; // TODO: explain why 255
+  const char *servers = NULL;
+  uint64_t pipeline = DEFAULT_PIPELINE;
+  const char *journal_path = NULL;
 
   while (true) {
-    int current_optind = optind ? optind : 1;
-
     static struct option options[] = {{"k", required_argument, 0, 0},
                                       {"mod", required_argument, 0, 0},
                                       {"servers", required_argument, 0, 0},
+                                      {"pipeline", required_argument, 0, 0},
+                                      {"journal", required_argument, 0, 0},
                                       {0, 0, 0, 0}};
 
     int option_index = 0;
@@ -68,16 +454,29 @@ int main(int argc, char **argv) {
     case 0: {
       switch (option_index) {
       case 0:
-        ConvertStringToUI64(optarg, &k);
-        // TODO: your code here
+        if (!ConvertStringToUI64(optarg, &k)) {
+          fprintf(stderr, "k must be a non-negative integer\n");
+          return 1;
+        }
         break;
       case 1:
-        ConvertStringToUI64(optarg, &mod);
-        // TODO: your code here
+        if (!ConvertStringToUI64(optarg, &mod) || mod == 0) {
+          fprintf(stderr, "mod must be a positive integer\n");
+          return 1;
+        }
         break;
       case 2:
-        // TODO: your code here
-        memcpy(servers, optarg, strlen(optarg));
+        servers = optarg;
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &pipeline) || pipeline == 0 ||
+            pipeline > MAX_PIPELINE) {
+          fprintf(stderr, "pipeline must be in [1, %d]\n", MAX_PIPELINE);
+          return 1;
+        }
+        break;
+      case 4:
+        journal_path = optarg;
         break;
       default:
         printf("Index %d is out of options\n", option_index);
@@ -92,72 +491,129 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (k == -1 || mod == -1 || !strlen(servers)) {
-    fprintf(stderr, "Using: %s --k 1000 --mod 5 --servers /path/to/file\n",
+  if (k == (uint64_t)-1 || mod == (uint64_t)-1 || !servers) {
+    fprintf(stderr,
+            "Using: %s --k 1000 --mod 5 --servers /path/to/file "
+            "[--pipeline 4] [--journal /path/to/file]\n"
+            "  --journal  record finished chunks; rerun with the same file "
+            "to resume\n",
             argv[0]);
     return 1;
   }
 
-  // TODO: for one server here, rewrite with servers from file
-  unsigned int servers_num = 1;
-  struct Server *to = malloc(sizeof(struct Server) * servers_num);
-  // TODO: delete this and parallel work between servers
-  to[0].port = 20001;
-  memcpy(to[0].ip, "127.0.0.1", sizeof("127.0.0.1"));
-
-  // TODO: work continiously, rewrite to make parallel
-  for (int i = 0; i < servers_num; i++) {
-    struct hostent *hostname = gethostbyname(to[i].ip);
-    if (hostname == NULL) {
-      fprintf(stderr, "gethostbyname failed with %s\n", to[i].ip);
-      exit(1);
-    }
+  size_t servers_num = 0;
+  struct Server *to = ReadServers(servers, &servers_num);
+  if (!to)
+    return 1;
 
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_port = htons(to[i].port);
-    server.sin_addr.s_addr = *((unsigned long *)hostname->h_addr);
+  links = calloc(servers_num, sizeof(*links));
+  nlinks = servers_num;
+  struct pollfd *fds = calloc(servers_num, sizeof(*fds));
+  if (!links || !fds) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  SchedInit(&sched, k, mod, servers_num);
+  if (journal_path) {
+    if (!JournalOpen(&journal, journal_path, k, mod, Restore, NULL))
+      return 1;
+    journaling = true;
+    if (sched.nrestored)
+      fprintf(stderr, "resumed: %zu chunks, %llu numbers from %s\n",
+              sched.nrestored, (unsigned long long)sched.restored_numbers,
+              journal_path);
+  }
+  for (size_t i = 0; i < servers_num && !SchedFinished(&sched); i++) {
+    links[i].server = &to[i];
+    if (!StartConnect(&links[i]))
+      DropLink(&links[i]);
+  }
 
-    int sck = socket(AF_INET, SOCK_STREAM, 0);
-    if (sck < 0) {
-      fprintf(stderr, "Socket creation failed!\n");
-      exit(1);
+  // Все серверы считают одновременно и берут новые куски по мере
+  // ответов: быстрый сервер получает больше работы, чем медленный
+  while (!SchedFinished(&sched)) {
+    uint64_t now = NowNs();
+    size_t sockets = 0;
+    struct Link *shm_busy = NULL;  // shm-сервер, от которого ждём ответа
+    bool shm_ready = false;
+    for (size_t i = 0; i < servers_num; i++) {
+      struct Link *ln = &links[i];
+      Fill(ln, (size_t)pipeline, now);
+      fds[i].fd = ln->fd;  // -1 poll пропускает
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+      if (ln->failed)
+        continue;
+      if (ln->shm) {
+        SendFrames(ln);
+        if (ShmPeek(&ln->shm->rep))
+          shm_ready = true;
+        else if (ln->nslots && !shm_busy)
+          shm_busy = ln;
+        continue;
+      }
+      sockets++;
+      if (ln->state == LINK_CONNECTING || ln->nsent < ln->nslots ||
+          ln->ctl_off < ln->ctl_len)
+        fds[i].events |= POLLOUT;
     }
 
-    if (connect(sck, (struct sockaddr *)&server, sizeof(server)) < 0) {
-      fprintf(stderr, "Connection failed\n");
-      exit(1);
+    // Готовый ответ в кольце забираем сразу. Иначе при одних shm-серверах
+    // спим на futex кольца, а вперемешку с сокетами poll просыпается
+    // раз в SHM_POLL_MS проверить кольца
+    int timeout = shm_ready ? 0 : shm_busy ? SHM_POLL_MS : -1;
+    // Сервер, попросивший подождать, будим к назначенному сроку
+    for (size_t i = 0; i < servers_num; i++) {
+      if (links[i].retry_at <= now)
+        continue;
+      int wait = (int)((links[i].retry_at - now + 999999) / 1000000);
+      if (timeout < 0 || wait < timeout)
+        timeout = wait;
     }
-
-    // TODO: for one server
-    // parallel between servers
-    uint64_t begin = 1;
-    uint64_t end = k;
-
-    char task[sizeof(uint64_t) * 3];
-    memcpy(task, &begin, sizeof(uint64_t));
-    memcpy(task + sizeof(uint64_t), &end, sizeof(uint64_t));
-    memcpy(task + 2 * sizeof(uint64_t), &mod, sizeof(uint64_t));
-
-    if (send(sck, task, sizeof(task), 0) < 0) {
-      fprintf(stderr, "Send failed\n");
+    if (sockets == 0 && !shm_ready && shm_busy) {
+      ShmWait(&shm_busy->shm->rep, SHM_POLL_MS);
+      if (!ShmPeek(&shm_busy->shm->rep) && !ShmServerAlive(shm_busy->shm))
+        DropLink(shm_busy);
+    } else if (poll(fds, servers_num, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
       exit(1);
     }
-
-    char response[sizeof(uint64_t)];
-    if (recv(sck, response, sizeof(response), 0) < 0) {
-      fprintf(stderr, "Recieve failed\n");
-      exit(1);
+    // Упавший сервер не роняет задачу: его куски достанутся остальным
+    for (size_t i = 0; i < servers_num; i++) {
+      struct Link *ln = &links[i];
+      if (ln->failed)
+        continue;
+      if (ln->shm ? !ReadShmReplies(ln)
+                  : fds[i].revents && !Step(ln, fds[i].revents))
+        DropLink(ln);
     }
+  }
 
-    // TODO: from one server
-    // unite results
-    uint64_t answer = 0;
-    memcpy(&answer, response, sizeof(uint64_t));
-    printf("answer: %llu\n", answer);
-
-    close(sck);
+  for (size_t i = 0; i < servers_num; i++) {
+    struct Link *ln = &links[i];
+    if (!ln->server)
+      continue;
+    if (ln->shm)
+      ShmDetach(ln->shm);
+    else if (ln->fd >= 0)
+      close(ln->fd);
+    fprintf(stderr,
+            "%s: %zu chunks, %llu numbers, %zu hedged (%zu won), "
+            "%.1f M/s%s\n",
+            ln->server->name, ln->rate.chunks,
+            (unsigned long long)ln->rate.numbers, ln->rate.hedges,
+            ln->rate.wins, LinkSpeed(&ln->rate, NowNs()) * 1e3,
+            ln->failed ? ", failed" : "");
   }
+  if (journaling)
+    JournalClose(&journal);
+  uint64_t answer = sched.answer;
+  printf("answer: %llu\n", (unsigned long long)answer);
+  SchedFree(&sched);
+  free(fds);
+  free(links);
   free(to);
 
   return 0;
@@ -0,0 +1,260 @@
+#include "coalesce.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+struct CoalesceEntry {
+  uint64_t mod;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t value;
+  bool ready;
+  bool failed;  // хозяин отменён, блок ждёт нового хозяина
+  int refs;
+  struct CoalesceEntry *next;
+};
+
+struct Piece {
+  struct Range range;
+  struct CoalesceEntry *entry;  // NULL — кусок не разделяется
+  bool owned;                   // считаем сами
+  uint64_t value;
+};
+
+static size_t Bucket(uint64_t mod, uint64_t begin, uint64_t end) {
+  uint64_t h = mod * 0x9E3779B97F4A7C15ull;
+  h ^= begin + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+  h ^= end + 0x85EBCA77C2B2AE63ull + (h << 6) + (h >> 2);
+  // Младшие 16 бит у границ блоков одинаковые: перемешиваем старшие вниз,
+  // иначе все блоки одного модуля попадают в одну корзину
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  return (size_t)(h % COALESCE_BUCKETS);
+}
+
+static void *Alloc(size_t bytes) {
+  void *p = malloc(bytes ? bytes : 1);
+  if (!p) {
+    perror("malloc");
+    exit(1);
+  }
+  return p;
+}
+
+void CoalescerInit(struct Coalescer *c, struct RangeCache *cache) {
+  memset(c, 0, sizeof(*c));
+  c->cache = cache;
+  LsMutexInit(&c->lock, "coalescer");
+  pthread_cond_init(&c->ready, NULL);
+}
+
+void CoalescerDestroy(struct Coalescer *c) {
+  for (size_t i = 0; i < COALESCE_BUCKETS; i++) {
+    while (c->buckets[i]) {
+      struct CoalesceEntry *e = c->buckets[i];
+      c->buckets[i] = e->next;
+      free(e);
+    }
+  }
+  pthread_cond_destroy(&c->ready);
+  LsMutexDestroy(&c->lock);
+}
+
+// Найти запись или завести новую; вызывается под c->lock
+static struct CoalesceEntry *Claim(struct Coalescer *c, uint64_t mod,
+                                   const struct Range *r, bool *owned) {
+  size_t b = Bucket(mod, r->begin, r->end);
+  for (struct CoalesceEntry *e = c->buckets[b]; e; e = e->next) {
+    if (e->mod == mod && e->begin == r->begin && e->end == r->end) {
+      e->refs++;
+      *owned = false;
+      return e;
+    }
+  }
+  struct CoalesceEntry *e = Alloc(sizeof(*e));
+  e->mod = mod;
+  e->begin = r->begin;
+  e->end = r->end;
+  e->value = 0;
+  e->ready = false;
+  e->failed = false;
+  e->refs = 1;
+  e->next = c->buckets[b];
+  c->buckets[b] = e;
+  *owned = true;
+  return e;
+}
+
+// Отпустить запись; последняя ссылка удаляет её. Под c->lock
+static void Release(struct Coalescer *c, struct CoalesceEntry *e) {
+  if (--e->refs > 0)
+    return;
+  struct CoalesceEntry **pp = &c->buckets[Bucket(e->mod, e->begin, e->end)];
+  while (*pp != e)
+    pp = &(*pp)->next;
+  *pp = e->next;
+  free(e);
+}
+
+// Разрезать [begin, end] на хвосты и выровненные блоки
+static size_t Split(uint64_t begin, uint64_t end, bool whole_range,
+                    struct Piece **out) {
+  const uint64_t B = COALESCE_BLOCK;
+  bool has_blocks = !whole_range && end - begin + 1 >= B && end >= B - 1;
+  uint64_t first = 0, last = 0;
+  if (has_blocks) {
+    first = begin / B + (begin % B != 0);
+    last = (end - (B - 1)) / B;
+    has_blocks = first <= last;
+  }
+
+  size_t cap = has_blocks ? (size_t)(last - first + 1) + 2 : 1;
+  struct Piece *p = Alloc(cap * sizeof(*p));
+  size_t n = 0;
+
+  if (!has_blocks) {
+    p[n++] = (struct Piece){{begin, end}, NULL, false, 0};
+    // Целый диапазон, который не режется, — тоже кандидат на объединение
+    p[0].owned = !whole_range;
+    *out = p;
+    return n;
+  }
+  if (begin < first * B)
+    p[n++] = (struct Piece){{begin, first * B - 1}, NULL, true, 0};
+  for (uint64_t i = first; i <= last; i++)
+    p[n++] = (struct Piece){{i * B, i * B + B - 1}, NULL, false, 0};
+  if (last * B + B - 1 < end)
+    p[n++] = (struct Piece){{last * B + B, end}, NULL, true, 0};
+  *out = p;
+  return n;
+}
+
+// Блок посчитан: отдать ждущим и в кэш. Под c->lock
+static void Publish(struct Coalescer *c, struct CoalesceEntry *e,
+                    uint64_t value) {
+  e->value = value;
+  e->ready = true;
+  c->computed++;
+  if (c->cache)
+    RangeCachePut(c->cache, e->mod, e->begin, e->end, value);
+}
+
+// Дождаться чужого блока; брошенный блок досчитать самим. Под c->lock.
+// false — отменили нас самих
+static bool Await(struct Coalescer *c, struct CoalesceEntry *e,
+                  const bool *cancel, RangeBatchFn compute, void *ctx) {
+  while (!e->ready) {
+    if (Cancelled(cancel))
+      return false;
+    if (e->failed) {
+      e->failed = false;
+      struct Range r = {e->begin, e->end};
+      uint64_t value;
+      LsUnlock(&c->lock);
+      bool done = compute(&r, 1, e->mod, &value, cancel, ctx);
+      LsLock(&c->lock);
+      if (done) {
+        Publish(c, e, value);
+      } else {
+        e->failed = true;
+        c->abandoned++;
+      }
+      pthread_cond_broadcast(&c->ready);
+      return done;
+    }
+    if (!cancel) {
+      pthread_cond_wait(&c->ready, &c->lock.m);
+      continue;
+    }
+    // Отмену сигнал не разбудит: просыпаемся проверить её сами
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += COALESCE_CANCEL_POLL_NS;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&c->ready, &c->lock.m, &until);
+  }
+  c->shared++;
+  return true;
+}
+
+uint64_t CoalescedProduct(struct Coalescer *c, uint64_t begin, uint64_t end,
+                          uint64_t mod, bool whole_range, const bool *cancel,
+                          RangeBatchFn compute, void *ctx) {
+  if (mod == 0)
+    return 0;
+  if (begin > end)
+    return 1 % mod;
+  // Среди mod подряд идущих чисел есть кратное mod — считать нечего
+  if (end - begin >= mod - 1)
+    return 0;
+
+  struct Piece *pieces = NULL;
+  size_t n = Split(begin, end, whole_range, &pieces);
+
+  // Куски без флага owned — разделяемые: берём готовые из кэша, иначе
+  // ищем их среди уже идущих
+  LsLock(&c->lock);
+  for (size_t i = 0; i < n; i++) {
+    if (pieces[i].owned)
+      continue;
+    const struct Range *r = &pieces[i].range;
+    if (c->cache &&
+        RangeCacheGet(c->cache, mod, r->begin, r->end, &pieces[i].value))
+      continue;
+    pieces[i].entry = Claim(c, mod, r, &pieces[i].owned);
+  }
+  LsUnlock(&c->lock);
+
+  // Всё, что досталось нам, считаем одной пачкой
+  struct Range *batch = Alloc(n * sizeof(*batch));
+  uint64_t *results = Alloc(n * sizeof(*results));
+  size_t nbatch = 0;
+  for (size_t i = 0; i < n; i++)
+    if (pieces[i].owned)
+      batch[nbatch++] = pieces[i].range;
+  bool done = nbatch == 0 || compute(batch, nbatch, mod, results, cancel, ctx);
+
+  uint64_t total = 1 % mod;
+  LsLock(&c->lock);
+  size_t at = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!pieces[i].owned)
+      continue;
+    pieces[i].value = results[at++];
+    struct CoalesceEntry *e = pieces[i].entry;
+    if (e && done) {
+      Publish(c, e, pieces[i].value);
+    } else if (e) {
+      e->failed = true;
+      c->abandoned++;
+    }
+  }
+  pthread_cond_broadcast(&c->ready);
+
+  for (size_t i = 0; i < n; i++) {
+    struct CoalesceEntry *e = pieces[i].entry;
+    if (e && !pieces[i].owned && done) {
+      done = Await(c, e, cancel, compute, ctx);
+      pieces[i].value = e->value;
+    }
+    if (e)
+      Release(c, e);
+    total = MultModulo(total, pieces[i].value, mod);
+  }
+  LsUnlock(&c->lock);
+  if (!done)
+    total = 0;
+
+  free(results);
+  free(batch);
+  free(pieces);
+  return total;
+}
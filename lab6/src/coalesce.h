@@ -0,0 +1,80 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "lockstat.h"
+
+/*
+ * Объединение одновременных запросов с одинаковым модулем.
+ *
+ * Диапазон запроса режется на блоки, выровненные по COALESCE_BLOCK,
+ * и два "хвоста" по краям. Для каждого блока (mod, начало) в таблице
+ * находящихся в работе произведений ищется запись: если блок уже
+ * считает другой запрос — ждём его результата, иначе забираем блок
+ * себе. Хвосты считаются без разделения. Так пересекающиеся запросы
+ * считают общую часть один раз, а нагрузка растёт с объёмом уникальной
+ * работы, а не с числом запросов.
+ *
+ * Запрос сначала считает все свои блоки и только потом ждёт чужие,
+ * поэтому циклического ожидания между запросами не бывает.
+ *
+ * Посчитанные блоки остаются в кэше (cache.h), если он подключён:
+ * блок из кэша не считается и не ждётся вовсе.
+ *
+ * Запрос можно отменить флагом cancel. Отменённый запрос бросает счёт и
+ * чужих блоков не ждёт, а свои недосчитанные блоки помечает брошенными:
+ * первый из ждущих их запросов забирает такой блок и считает сам.
+ */
+
+#define COALESCE_BLOCK (1ull << 16)
+#define COALESCE_BUCKETS 4096
+// Как часто отменяемый запрос, ждущий чужой блок, проверяет отмену
+#define COALESCE_CANCEL_POLL_NS 10000000
+
+struct Range {
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Посчитать произведения n диапазонов по модулю mod в results[i].
+// false — счёт прерван по *cancel, results не годятся.
+typedef bool (*RangeBatchFn)(const struct Range *ranges, size_t n,
+                             uint64_t mod, uint64_t *results,
+                             const bool *cancel, void *ctx);
+
+// Взведён ли флаг отмены; NULL — запрос неотменяемый. Флаг пишет другой
+// поток, поэтому читаем атомарно
+static inline bool Cancelled(const bool *cancel) {
+  return cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED);
+}
+
+struct CoalesceEntry;
+
+struct Coalescer {
+  struct LsMutex lock;
+  pthread_cond_t ready;
+  struct CoalesceEntry *buckets[COALESCE_BUCKETS];
+  struct RangeCache *cache;  // NULL — без кэша; под lock
+  uint64_t computed;  // блоков посчитано самими
+  uint64_t shared;    // блоков получено от параллельных запросов
+  uint64_t abandoned;  // блоков брошено отменёнными запросами
+};
+
+// cache может быть NULL
+void CoalescerInit(struct Coalescer *c, struct RangeCache *cache);
+void CoalescerDestroy(struct Coalescer *c);
+
+// begin * ... * end mod mod. whole_range — не резать диапазон на блоки
+// (например, если его выгоднее считать через простые целиком);
+// одинаковые такие запросы всё равно объединяются.
+// Отменённый по *cancel запрос возвращает 0; cancel может быть NULL.
+uint64_t CoalescedProduct(struct Coalescer *c, uint64_t begin, uint64_t end,
+                          uint64_t mod, bool whole_range, const bool *cancel,
+                          RangeBatchFn compute, void *ctx);
+
+#endif  // COALESCE_H
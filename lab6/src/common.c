@@ -0,0 +1,153 @@
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
+  return (uint64_t)((unsigned __int128)a * b % mod);
+}
+
+bool ConvertStringToUI64(const char *str, uint64_t *val) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long long i = strtoull(str, &end, 10);
+  if (errno == ERANGE) {
+    fprintf(stderr, "Out of uint64_t range: %s\n", str);
+    return false;
+  }
+
+  if (errno != 0 || end == str || *end != '\0')
+    return false;
+
+  *val = i;
+  return true;
+}
+
+uint64_t NowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+double Us(uint64_t ns) { return (double)ns / 1e3; }
+
+void *Realloc(void *p, size_t bytes) {
+  p = realloc(p, bytes);
+  if (!p) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+int Connect(const char *addr, bool nonblock) {
+  char host[256];
+  const char *colon = strrchr(addr, ':');
+  if (!colon || colon == addr || (size_t)(colon - addr) >= sizeof(host)) {
+    fprintf(stderr, "Server must be ip:port, got %s\n", addr);
+    exit(1);
+  }
+  memcpy(host, addr, (size_t)(colon - addr));
+  host[colon - addr] = '\0';
+
+  struct addrinfo hints = {0}, *res = NULL;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(host, colon + 1, &hints, &res);
+  if (err) {
+    fprintf(stderr, "getaddrinfo failed with %s: %s\n", host,
+            gai_strerror(err));
+    exit(1);
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+    fprintf(stderr, "Connection to %s failed: %s\n", addr, strerror(errno));
+    exit(1);
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (!nonblock)
+    return fd;
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    perror("fcntl");
+    exit(1);
+  }
+  return fd;
+}
+
+unsigned char *StreamReserve(struct Stream *s, size_t len) {
+  while (s->out_len + len > s->out_cap) {
+    s->out_cap = s->out_cap ? s->out_cap * 2 : 1024;
+    s->out = Realloc(s->out, s->out_cap);
+  }
+  return s->out + s->out_len;
+}
+
+void StreamFlush(struct Stream *s) {
+  while (s->out_off < s->out_len) {
+    ssize_t n = send(s->fd, s->out + s->out_off, s->out_len - s->out_off,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+      perror("send");
+      exit(1);
+    }
+    s->out_off += (size_t)n;
+  }
+  s->out_off = s->out_len = 0;
+}
+
+size_t StreamReceive(struct Stream *s, ReplyFn fn, void *ctx) {
+  size_t replies = 0;
+  while (true) {
+    ssize_t n = recv(s->fd, s->in + s->in_len, STREAM_IN_BUF - s->in_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return replies;
+    if (n <= 0) {
+      fprintf(stderr, "Server closed connection\n");
+      exit(1);
+    }
+    s->in_len += (size_t)n;
+
+    uint64_t now = NowNs();
+    size_t off = 0;
+    while (s->in_len - off >= REPLY_FRAME_SIZE) {
+      struct FrameHeader h;
+      if (!DecodeHeader(s->in + off, &h) || h.type != FRAME_REPLY ||
+          !fn(&h, now, ctx)) {
+        fprintf(stderr, "Bad reply from server\n");
+        exit(1);
+      }
+      replies++;
+      off += REPLY_FRAME_SIZE;
+    }
+    s->in_len -= off;
+    memmove(s->in, s->in + off, s->in_len);
+  }
+}
+
+void StreamWatch(int epfd, struct Stream *s, void *ptr) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = ptr};
+  if (s->out_off < s->out_len)
+    ev.events |= EPOLLOUT;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+void ArmTimer(int tfd, uint64_t when) {
+  struct itimerspec its = {{0, 0}, {(time_t)(when / 1000000000ull),
+                                    (long)(when % 1000000000ull)}};
+  timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
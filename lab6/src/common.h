@@ -0,0 +1,63 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/*
+ * Код, общий для клиента и сервера (задание 3 ЛР6).
+ */
+
+// a * b mod mod через 128-битное произведение — одно деление вместо
+// цикла удвоений
+uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod);
+
+bool ConvertStringToUI64(const char *str, uint64_t *val);
+
+// Монотонное время в наносекундах
+uint64_t NowNs(void);
+
+double Us(uint64_t ns);
+
+// realloc, который при нехватке памяти завершает процесс
+void *Realloc(void *p, size_t bytes);
+
+// Соединиться с "ip:port" по TCP с TCP_NODELAY; при ошибке — exit(1)
+int Connect(const char *addr, bool nonblock);
+
+/*
+ * Неблокирующее соединение генератора запросов (loadgen, replay) с
+ * сервером v2: кадры, ждущие отправки, и недочитанный хвост ответов.
+ */
+
+#define STREAM_IN_BUF 4096
+
+struct Stream {
+  int fd;
+  unsigned char *out;
+  size_t out_len;
+  size_t out_off;  // сколько из out уже отправлено
+  size_t out_cap;
+  unsigned char in[STREAM_IN_BUF];
+  size_t in_len;
+};
+
+// Место под len байт в конце out; потом out_len += len
+unsigned char *StreamReserve(struct Stream *s, size_t len);
+// Отправить из out сколько примет сокет
+void StreamFlush(struct Stream *s);
+// Ответ сервера; false — ответ не на наш запрос
+typedef bool (*ReplyFn)(const struct FrameHeader *h, uint64_t now, void *ctx);
+// Прочитать всё, что пришло, и отдать каждый FRAME_REPLY в fn.
+// Возвращает число ответов. Закрытое соединение или чужой кадр — exit(1)
+size_t StreamReceive(struct Stream *s, ReplyFn fn, void *ctx);
+// Ждать в epfd чтения, а записи — пока в out есть неотправленное
+void StreamWatch(int epfd, struct Stream *s, void *ptr);
+
+// Взвести timerfd на абсолютный момент when (CLOCK_MONOTONIC, нс)
+void ArmTimer(int tfd, uint64_t when);
+
+#endif  // COMMON_H
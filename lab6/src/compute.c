@@ -0,0 +1,176 @@
+#include "compute.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "prime_factorial.h"
+
+bool UsePrimeEngine(uint64_t begin, uint64_t end) {
+  return end - begin >= PRIME_ENGINE_MIN_LEN &&
+         begin <= end / PRIME_ENGINE_RATIO;
+}
+
+static uint64_t PlainProduct(uint64_t begin, uint64_t end, uint64_t mod) {
+  uint64_t ans = 1 % mod;
+  for (uint64_t i = begin; i <= end && ans; i++) {
+    ans = MultModulo(ans, i, mod);
+    if (i == UINT64_MAX)
+      break;
+  }
+  return ans;
+}
+
+uint64_t Factorial(const struct FactorialArgs *args) {
+  uint64_t begin = args->begin;
+  uint64_t end = args->end;
+  uint64_t mod = args->mod;
+
+  if (mod == 0)
+    return 0;
+  if (begin > end)
+    return 1 % mod;
+
+  if (UsePrimeEngine(begin, end))
+    return PrimeRangeProductMod(begin, end, mod, 1);
+  return PlainProduct(begin, end, mod);
+}
+
+// Одна задача пула: отрезок чисел [lo, hi] диапазона range
+// или отрезок простых [lo, hi] для движка Лежандра
+struct RangeTask {
+  size_t range;
+  uint64_t lo;
+  uint64_t hi;
+  bool primes;
+  bool aborted;  // брошена по отмене, result не годится
+  uint64_t result;
+};
+
+struct RangePlan {
+  const struct Range *ranges;
+  uint64_t mod;
+  const bool *cancel;
+  struct RangeTask *tasks;
+  size_t ntasks;
+  uint32_t **base;  // база решета для диапазонов движка через простые
+  size_t *nbase;
+};
+
+// Отмену задача проверяет перед началом и после каждых CANCEL_STRIDE
+// чисел: брошенная задача сразу возвращает поток пулу
+static void RunRangeTask(size_t index, void *arg) {
+  struct RangePlan *plan = arg;
+  struct RangeTask *t = &plan->tasks[index];
+  const struct Range *r = &plan->ranges[t->range];
+  if (Cancelled(plan->cancel)) {
+    t->aborted = true;
+    return;
+  }
+  if (t->primes) {
+    t->result = PrimeFoldMod(r->begin, r->end, plan->mod, t->lo, t->hi,
+                             plan->base[t->range], plan->nbase[t->range]);
+    return;
+  }
+  uint64_t ans = 1 % plan->mod;
+  for (uint64_t lo = t->lo;; lo += CANCEL_STRIDE) {
+    uint64_t hi = t->hi - lo < CANCEL_STRIDE ? t->hi : lo + CANCEL_STRIDE - 1;
+    ans = MultModulo(ans, PlainProduct(lo, hi, plan->mod), plan->mod);
+    if (hi == t->hi || !ans)
+      break;
+    if (Cancelled(plan->cancel)) {
+      t->aborted = true;
+      return;
+    }
+  }
+  t->result = ans;
+}
+
+static void *Alloc(size_t bytes) {
+  void *p = calloc(1, bytes ? bytes : 1);
+  if (!p) {
+    perror("calloc");
+    exit(1);
+  }
+  return p;
+}
+
+bool ComputeRanges(const struct Range *ranges, size_t n, uint64_t mod,
+                   uint64_t *results, const bool *cancel, void *ctx) {
+  struct Pool *pool = ctx;
+  uint64_t parts = (uint64_t)pool->nthreads + 1;  // +1 — вызывающий поток
+  // Отрезки простых мельче: задача движка тоже должна скоро замечать отмену
+  uint64_t prime_parts = parts * PRIME_TASKS_PER_THREAD;
+
+  // Размер куска — общий объём обычных диапазонов поровну на всех
+  uint64_t plain_total = 0;
+  size_t max_tasks = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!UsePrimeEngine(ranges[i].begin, ranges[i].end) &&
+        ranges[i].begin <= ranges[i].end)
+      plain_total += ranges[i].end - ranges[i].begin + 1;
+  }
+  uint64_t chunk = plain_total / parts + 1;
+  if (chunk < MIN_CHUNK)
+    chunk = MIN_CHUNK;
+  for (size_t i = 0; i < n; i++) {
+    if (ranges[i].begin > ranges[i].end)
+      continue;
+    if (UsePrimeEngine(ranges[i].begin, ranges[i].end))
+      max_tasks += prime_parts;
+    else
+      max_tasks += (ranges[i].end - ranges[i].begin) / chunk + 1;
+  }
+
+  struct RangePlan plan = {ranges,
+                           mod,
+                           cancel,
+                           Alloc(max_tasks * sizeof(struct RangeTask)),
+                           0,
+                           Alloc(n * sizeof(uint32_t *)),
+                           Alloc(n * sizeof(size_t))};
+
+  for (size_t i = 0; i < n; i++) {
+    uint64_t b = ranges[i].begin, e = ranges[i].end;
+    if (b > e)
+      continue;
+    if (UsePrimeEngine(b, e)) {
+      plan.base[i] = BasePrimes(e, &plan.nbase[i]);
+      uint64_t span = (e - 1) / prime_parts + 1;  // простые из [2, e]
+      for (uint64_t lo = 2; lo <= e; lo += span) {
+        uint64_t hi = e - lo < span ? e : lo + span - 1;
+        plan.tasks[plan.ntasks++] =
+            (struct RangeTask){i, lo, hi, true, false, 0};
+        if (hi == e)
+          break;
+      }
+      continue;
+    }
+    for (uint64_t lo = b;; lo += chunk) {
+      uint64_t hi = e - lo < chunk ? e : lo + chunk - 1;
+      plan.tasks[plan.ntasks++] =
+          (struct RangeTask){i, lo, hi, false, false, 0};
+      if (hi == e)
+        break;
+    }
+  }
+
+  PoolRun(pool, RunRangeTask, &plan, plan.ntasks);
+
+  // mod != 0: нулевой модуль coalescer отсекает раньше
+  bool done = true;
+  for (size_t i = 0; i < n; i++)
+    results[i] = 1 % mod;
+  for (size_t t = 0; t < plan.ntasks; t++) {
+    size_t r = plan.tasks[t].range;
+    results[r] = MultModulo(results[r], plan.tasks[t].result, mod);
+    done = done && !plan.tasks[t].aborted;
+  }
+
+  for (size_t i = 0; i < n; i++)
+    free(plan.base[i]);
+  free(plan.base);
+  free(plan.nbase);
+  free(plan.tasks);
+  return done;
+}
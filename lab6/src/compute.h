@@ -0,0 +1,42 @@
+#ifndef COMPUTE_H
+#define COMPUTE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coalesce.h"
+#include "pool.h"
+
+// Диапазоны, начинающиеся не дальше end / PRIME_ENGINE_RATIO от единицы,
+// считаются через простые: решето до end дешевле end - begin умножений
+#define PRIME_ENGINE_RATIO 4
+#define PRIME_ENGINE_MIN_LEN 4096
+
+// Меньше этого задача не режется: накладные расходы пула дороже
+#define MIN_CHUNK 4096
+
+// Задача обычного диапазона проверяет отмену через столько чисел,
+// диапазон движка через простые режется на столько задач на поток
+#define CANCEL_STRIDE (1ull << 16)
+#define PRIME_TASKS_PER_THREAD 4
+
+struct FactorialArgs {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+};
+
+bool UsePrimeEngine(uint64_t begin, uint64_t end);
+
+// begin * ... * end mod mod в одном потоке
+uint64_t Factorial(const struct FactorialArgs *args);
+
+// RangeBatchFn для coalescer'а, ctx — struct Pool *.
+// Все диапазоны пачки режутся на непрерывные куски примерно поровну
+// на каждый поток пула; диапазоны для движка через простые делятся
+// по отрезкам простых.
+bool ComputeRanges(const struct Range *ranges, size_t n, uint64_t mod,
+                   uint64_t *results, const bool *cancel, void *ctx);
+
+#endif  // COMPUTE_H
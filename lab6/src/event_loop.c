@@ -0,0 +1,739 @@
+#define _GNU_SOURCE  // accept4
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "protocol.h"
+
+enum ConnProto {
+  CONN_UNKNOWN,  // ещё не пришли первые PROTO_MAGIC_SIZE байт
+  CONN_V1,
+  CONN_V2,
+};
+
+struct Conn {
+  int fd;
+  uint32_t trace_id;  // номер соединения в трассе
+  enum ConnProto proto;
+  char in[CONN_IN_BUF];
+  size_t in_len;
+  char *out;
+  size_t out_len;
+  size_t out_off;  // сколько из out уже отправлено
+  size_t out_cap;
+  uint32_t events;   // маска, с которой сокет стоит в epoll
+  int inflight;      // запросов соединения сейчас в пуле
+  struct Job *jobs;  // они же списком: для отмены
+  bool dead;         // сокет закрыт, ждём возврата задач
+  bool dirty;        // в out есть ответы, ещё не отданные в send
+  bool blocked;      // в списке l->blocked
+  bool throttled;    // запрос v1 ждёт места в очереди
+  int refs;          // сам цикл + задачи в пуле
+  struct Conn *dirty_next;
+  struct Conn *blocked_next;
+  struct Conn *dead_next;  // в l->graveyard
+};
+
+struct Job {
+  struct Loop *loop;
+  struct Conn *conn;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+  uint64_t result;
+  struct ReduceResult reduced;  // для FRAME_REDUCE вместо result
+  uint8_t kind;  // FRAME_REQUEST или FRAME_REDUCE
+  uint32_t id;  // для v2: с ним уходит ответ
+  uint64_t received_ns;
+  uint64_t deadline;  // 0 — без срока
+  bool logged;  // попал в выборку журнала
+  bool cancel;  // пишет сетевой поток, читают рабочие
+  bool expired;  // срок истёк в очереди, не считался
+  struct Job *next;
+  struct Job *conn_prev;  // список задач соединения; только сетевой поток
+  struct Job *conn_next;
+};
+
+// Метки в epoll_data для не-клиентских дескрипторов
+static char listen_tag, event_tag, stats_tag, signal_tag;
+
+static int SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+  return 0;
+}
+
+// Последняя ссылка не освобождает соединение сразу: на него ещё могут
+// указывать события из текущей пачки epoll_wait. Освобождает Bury
+static void Unref(struct Loop *l, struct Conn *c) {
+  if (--c->refs > 0)
+    return;
+  c->dead_next = l->graveyard;
+  l->graveyard = c;
+}
+
+// Вызывать только между пачками событий
+static void Bury(struct Loop *l) {
+  while (l->graveyard) {
+    struct Conn *c = l->graveyard;
+    l->graveyard = c->dead_next;
+    free(c->out);
+    free(c);
+    l->nconns--;
+  }
+}
+
+static void Cancel(struct Job *job) {
+  if (job->cancel)
+    return;
+  __atomic_store_n(&job->cancel, true, __ATOMIC_RELAXED);
+  MetricAdd(M_CANCELLED, 1);
+}
+
+// Ответы закрытому соединению не нужны — его задачи отменяются
+static void CloseConn(struct Loop *l, struct Conn *c) {
+  if (c->dead)
+    return;
+  for (struct Job *job = c->jobs; job; job = job->conn_next)
+    Cancel(job);
+  epoll_ctl(l->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  c->dead = true;
+  MetricAdd(M_CLOSED, 1);
+  Unref(l, c);
+}
+
+// Привести маску epoll к тому, что соединению сейчас нужно
+static void UpdateEvents(struct Loop *l, struct Conn *c) {
+  uint32_t want = EPOLLRDHUP;
+  if (c->in_len < CONN_IN_BUF)
+    want |= EPOLLIN;
+  if (c->out_off < c->out_len)
+    want |= EPOLLOUT;
+  if (want == c->events)
+    return;
+  struct epoll_event ev = {.events = want, .data.ptr = c};
+  if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+    perror("epoll_ctl");
+    CloseConn(l, c);
+    return;
+  }
+  c->events = want;
+}
+
+// Отправить, сколько примет сокет. false — соединение закрыто
+static bool Flush(struct Loop *l, struct Conn *c) {
+  while (c->out_off < c->out_len) {
+    ssize_t sent = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+                        MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      fprintf(stderr, "Can't send data to client\n");
+      CloseConn(l, c);
+      return false;
+    }
+    c->out_off += (size_t)sent;
+    MetricAdd(M_BYTES_OUT, (uint64_t)sent);
+  }
+  c->out_off = c->out_len = 0;
+  return true;
+}
+
+static bool Append(struct Conn *c, const void *data, size_t len) {
+  if (c->out_len + len > c->out_cap) {
+    size_t cap = c->out_cap ? c->out_cap * 2 : 64;
+    while (cap < c->out_len + len)
+      cap *= 2;
+    char *out = realloc(c->out, cap);
+    if (!out)
+      return false;
+    c->out = out;
+    c->out_cap = cap;
+  }
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+  return true;
+}
+
+static uint64_t Numbers(uint64_t begin, uint64_t end) {
+  return end >= begin ? end - begin + 1 : 0;
+}
+
+// Выполняется в рабочем потоке пула
+static void RunJob(size_t index, void *arg) {
+  (void)index;
+  struct Job *job = arg;
+  struct Loop *l = job->loop;
+  uint64_t start = NowNs();
+  MetricRecord(H_QUEUE_WAIT, start - job->received_ns);
+  // Отменённую или просроченную в очереди задачу не начинаем
+  bool run = !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED);
+  if (run && job->deadline && start > job->deadline) {
+    job->expired = true;
+    run = false;
+  }
+  bool reduce = job->kind == FRAME_REDUCE;
+  if (run && reduce)
+    l->reduce(job->begin, job->end, &job->cancel, &job->reduced,
+              l->reduce_ctx);
+  else if (run)
+    job->result =
+        l->handle(job->begin, job->end, job->mod, &job->cancel, l->ctx);
+  if (run)
+    MetricRecord(H_COMPUTE, NowNs() - start);
+  // Цена элемента свёртки несравнима с ценой числа факториала: в оценку
+  // очереди свёртки идут только своим числом
+  if (l->admit)
+    AdmissionDone(l->admit, reduce ? 0 : Numbers(job->begin, job->end),
+                  NowNs(), run && !reduce);
+
+  LsLock(&l->done_lock);
+  job->next = NULL;
+  if (l->done_tail)
+    l->done_tail->next = job;
+  else
+    l->done_head = job;
+  l->done_tail = job;
+  LsUnlock(&l->done_lock);
+
+  uint64_t one = 1;
+  if (write(l->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    perror("eventfd write");
+}
+
+static void Submit(struct Loop *l, struct Conn *c, uint8_t kind, uint32_t id,
+                   uint64_t begin, uint64_t end, uint64_t mod,
+                   uint64_t received, uint64_t deadline) {
+  struct Job *job = malloc(sizeof(*job));
+  if (!job) {
+    fprintf(stderr, "Out of memory for request\n");
+    CloseConn(l, c);
+    return;
+  }
+  job->loop = l;
+  job->conn = c;
+  job->kind = kind;
+  job->id = id;
+  job->begin = begin;
+  job->end = end;
+  job->mod = mod;
+  job->received_ns = received;
+  job->deadline = deadline;
+  job->logged = kind == FRAME_REQUEST && MetricsSampleLog();
+  job->cancel = false;
+  job->expired = false;
+  MetricAdd(M_REQUESTS, 1);
+
+  if (job->logged)
+    printf("Receive: %llu %llu %llu\n", (unsigned long long)begin,
+           (unsigned long long)end, (unsigned long long)mod);
+
+  c->inflight++;
+  c->refs++;
+  job->conn_prev = NULL;
+  job->conn_next = c->jobs;
+  if (c->jobs)
+    c->jobs->conn_prev = job;
+  c->jobs = job;
+  uint64_t order = deadline ? deadline : received + LOOP_DEFAULT_BUDGET_NS;
+  if (PoolSubmit(l->pool, RunJob, job, order) != 0) {
+    fprintf(stderr, "Out of memory for request\n");
+    c->inflight--;
+    c->refs--;
+    c->jobs = job->conn_next;
+    if (c->jobs)
+      c->jobs->conn_prev = NULL;
+    if (l->admit)
+      AdmissionDone(l->admit, kind == FRAME_REDUCE ? 0 : Numbers(begin, end),
+                    NowNs(), false);
+    free(job);
+    CloseConn(l, c);
+  }
+}
+
+// Задача вернулась из пула: убрать из списка соединения
+static void Unlink(struct Conn *c, struct Job *job) {
+  if (job->conn_prev)
+    job->conn_prev->conn_next = job->conn_next;
+  else
+    c->jobs = job->conn_next;
+  if (job->conn_next)
+    job->conn_next->conn_prev = job->conn_prev;
+}
+
+// Кадр FRAME_CANCEL: отмена запроса, на который уже ответили, ничего не
+// делает
+static void CancelById(struct Conn *c, uint32_t id) {
+  for (struct Job *job = c->jobs; job; job = job->conn_next) {
+    if (job->id == id) {
+      Cancel(job);
+      return;
+    }
+  }
+}
+
+// Соединение v1 ждёт места в очереди: не читаем его и время от времени
+// пробуем снова (RetryBlocked)
+static void Block(struct Loop *l, struct Conn *c) {
+  if (c->blocked)
+    return;
+  if (!c->throttled)
+    MetricAdd(M_THROTTLED, 1);
+  c->throttled = true;
+  c->blocked = true;
+  c->refs++;
+  c->blocked_next = l->blocked;
+  l->blocked = c;
+}
+
+// Отказ v2 уходит сразу, без пула (см. Dispatch)
+static void Reject(struct Loop *l, struct Conn *c, uint32_t id,
+                   uint64_t retry_ns) {
+  MetricAdd(M_REJECTED, 1);
+  unsigned char reply[REPLY_FRAME_SIZE];
+  EncodeFlaggedReply(reply, id, FRAME_FLAG_REJECTED, retry_ns / 1000 + 1);
+  if (!Append(c, reply, sizeof(reply))) {
+    fprintf(stderr, "Out of memory for reply\n");
+    CloseConn(l, c);
+  }
+}
+
+// Взять сообщение из начала in. Возвращает его длину; 0 — оно ещё не
+// дочитано или брать его сейчас нельзя, -1 — мусор в потоке
+static ssize_t NextMessage(struct Loop *l, struct Conn *c,
+                           const unsigned char *in, size_t len) {
+  uint64_t now = NowNs(), retry;
+  if (c->proto == CONN_V1) {
+    // Ответы v1 не подписаны, поэтому по одному запросу за раз
+    if (c->inflight > 0 || len < REQUEST_PAYLOAD)
+      return 0;
+    // v1 шлёт числа в порядке байт клиента
+    uint64_t v[3];
+    memcpy(v, in, sizeof(v));
+    if (l->recorder && !c->throttled)
+      RecorderAdd(l->recorder, c->trace_id, now, v[0], v[1], v[2], 0);
+    if (l->admit && !Admit(l->admit, Numbers(v[0], v[1]), now, 0, &retry)) {
+      Block(l, c);
+      return 0;
+    }
+    c->throttled = false;
+    Submit(l, c, FRAME_REQUEST, 0, v[0], v[1], v[2], now, 0);
+    return REQUEST_PAYLOAD;
+  }
+
+  if (len < FRAME_HEADER_SIZE)
+    return 0;
+  struct FrameHeader h;
+  if (!DecodeHeader(in, &h))
+    return -1;
+  if (len < FRAME_HEADER_SIZE + h.length)
+    return 0;
+  if (h.type == FRAME_CANCEL && h.length == 0) {
+    CancelById(c, h.id);
+    return FRAME_HEADER_SIZE;
+  }
+  const unsigned char *p = in + FRAME_HEADER_SIZE;
+  if (h.type == FRAME_REDUCE && h.length == REDUCE_PAYLOAD && l->reduce) {
+    if (c->inflight >= CONN_MAX_INFLIGHT)
+      return 0;
+    if (!l->admit || Admit(l->admit, 0, now, 0, &retry))
+      Submit(l, c, FRAME_REDUCE, h.id, GetU64(p), GetU64(p + 8), 0, now, 0);
+    else
+      Reject(l, c, h.id, retry);
+    return FRAME_HEADER_SIZE + h.length;
+  }
+  if (h.type != FRAME_REQUEST || (h.length != REQUEST_PAYLOAD &&
+                                  h.length != REQUEST_DEADLINE_PAYLOAD))
+    return -1;
+  if (c->inflight >= CONN_MAX_INFLIGHT)
+    return 0;
+  uint64_t begin = GetU64(p), end = GetU64(p + 8), mod = GetU64(p + 16);
+  uint64_t budget_us = h.length == REQUEST_DEADLINE_PAYLOAD ? GetU64(p + 24) : 0;
+  if (l->recorder)
+    RecorderAdd(l->recorder, c->trace_id, now, begin, end, mod, budget_us);
+  uint64_t deadline = 0;
+  if (budget_us)
+    deadline = budget_us > (UINT64_MAX - now) / 1000 ? UINT64_MAX
+                                                     : now + budget_us * 1000;
+  if (l->admit &&
+      !Admit(l->admit, Numbers(begin, end), now, deadline, &retry))
+    Reject(l, c, h.id, retry);
+  else
+    Submit(l, c, FRAME_REQUEST, h.id, begin, end, mod, now, deadline);
+  return FRAME_HEADER_SIZE + h.length;
+}
+
+// Отдать в пул все целиком пришедшие запросы, сколько сейчас можно
+static void Dispatch(struct Loop *l, struct Conn *c) {
+  const unsigned char *in = (const unsigned char *)c->in;
+  size_t off = 0;
+  while (!c->dead) {
+    if (c->proto == CONN_UNKNOWN) {
+      if (c->in_len < PROTO_MAGIC_SIZE)
+        break;
+      c->proto = GetU32(in) == PROTO_MAGIC ? CONN_V2 : CONN_V1;
+    }
+    ssize_t used = NextMessage(l, c, in + off, c->in_len - off);
+    if (used < 0) {
+      fprintf(stderr, "Client send wrong data format\n");
+      MetricAdd(M_BAD_FRAMES, 1);
+      CloseConn(l, c);
+    }
+    if (used <= 0)
+      break;
+    off += (size_t)used;
+  }
+  if (c->dead)
+    return;
+  // Разобранное убираем из буфера одним сдвигом
+  c->in_len -= off;
+  memmove(c->in, c->in + off, c->in_len);
+  // Отказы уходят сразу, не дожидаясь ответов пула
+  if (c->out_off < c->out_len)
+    Flush(l, c);
+}
+
+static void OnReadable(struct Loop *l, struct Conn *c) {
+  while (c->in_len < CONN_IN_BUF) {
+    ssize_t got = recv(c->fd, c->in + c->in_len, CONN_IN_BUF - c->in_len, 0);
+    if (got > 0) {
+      c->in_len += (size_t)got;
+      MetricAdd(M_BYTES_IN, (uint64_t)got);
+      continue;
+    }
+    if (got == 0) {
+      // Клиент ушёл: его запросы больше никому не нужны
+      CloseConn(l, c);
+      return;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    fprintf(stderr, "Client read failed\n");
+    CloseConn(l, c);
+    return;
+  }
+  Dispatch(l, c);
+  if (!c->dead)
+    UpdateEvents(l, c);
+}
+
+static void OnWritable(struct Loop *l, struct Conn *c) {
+  if (!Flush(l, c))
+    return;
+  Dispatch(l, c);
+  if (!c->dead)
+    UpdateEvents(l, c);
+}
+
+static void AcceptAll(struct Loop *l) {
+  while (true) {
+    int fd = accept4(l->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        fprintf(stderr, "Could not establish new connection\n");
+      return;
+    }
+    struct Conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+      fprintf(stderr, "Out of memory for new connection\n");
+      close(fd);
+      continue;
+    }
+    MetricAdd(M_ACCEPTED, 1);
+    c->fd = fd;
+    if (l->recorder)
+      c->trace_id = RecorderConn(l->recorder);
+    c->events = EPOLLIN | EPOLLRDHUP;
+    c->refs = 1;
+    struct epoll_event ev = {.events = c->events, .data.ptr = c};
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("epoll_ctl");
+      close(fd);
+      free(c);
+      continue;
+    }
+    l->nconns++;
+  }
+}
+
+// Разослать ответы, которые насчитали рабочие. Сначала все ответы
+// раскладываются по выходным буферам, потом каждое соединение
+// отправляет свои одним send.
+static void OnCompletions(struct Loop *l) {
+  uint64_t count;
+  if (read(l->evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    perror("eventfd read");
+
+  LsLock(&l->done_lock);
+  struct Job *job = l->done_head;
+  l->done_head = l->done_tail = NULL;
+  LsUnlock(&l->done_lock);
+
+  struct Conn *dirty = NULL;
+  while (job) {
+    struct Job *next = job->next;
+    struct Conn *c = job->conn;
+    c->inflight--;
+    Unlink(c, job);
+    // Ответ на закрытое соединение тоже засчитываем: иначе inflight
+    // расходился бы с тем, что реально считается
+    MetricAdd(M_REPLIES, 1);
+    if (job->expired)
+      MetricAdd(M_EXPIRED, 1);
+    else
+      MetricRecord(H_LATENCY, NowNs() - job->received_ns);
+    if (!c->dead) {
+      if (job->logged && !job->cancel && !job->expired)
+        printf("Total: %llu\n", (unsigned long long)job->result);
+      unsigned char reply[REDUCE_REPLY_FRAME_SIZE];
+      size_t len = REPLY_PAYLOAD;
+      // Отмена на живом соединении и срок бывают только у v2
+      if (c->proto == CONN_V2) {
+        if (job->cancel)
+          EncodeFlaggedReply(reply, job->id, FRAME_FLAG_CANCELLED, 0);
+        else if (job->expired)
+          EncodeFlaggedReply(reply, job->id, FRAME_FLAG_EXPIRED, 0);
+        else if (job->kind == FRAME_REDUCE)
+          EncodeReduceReply(reply, job->id, &job->reduced);
+        else
+          EncodeReply(reply, job->id, job->result);
+        len = job->kind == FRAME_REDUCE && !job->cancel && !job->expired
+                  ? REDUCE_REPLY_FRAME_SIZE
+                  : REPLY_FRAME_SIZE;
+      } else {
+        memcpy(reply, &job->result, sizeof(job->result));
+      }
+      if (!Append(c, reply, len)) {
+        fprintf(stderr, "Out of memory for reply\n");
+        CloseConn(l, c);
+      } else if (!c->dirty) {
+        // Ссылку задачи передаём списку, отпустим после отправки
+        c->dirty = true;
+        c->dirty_next = dirty;
+        dirty = c;
+        free(job);
+        job = next;
+        continue;
+      }
+    }
+    Unref(l, c);
+    free(job);
+    job = next;
+  }
+
+  while (dirty) {
+    struct Conn *c = dirty;
+    dirty = c->dirty_next;
+    c->dirty = false;
+    if (!c->dead && Flush(l, c)) {
+      Dispatch(l, c);
+      if (!c->dead)
+        UpdateEvents(l, c);
+    }
+    Unref(l, c);
+  }
+}
+
+// Снова попробовать поставить в очередь запросы ждущих соединений
+static void RetryBlocked(struct Loop *l) {
+  struct Conn *c = l->blocked;
+  l->blocked = NULL;
+  while (c) {
+    struct Conn *next = c->blocked_next;
+    c->blocked = false;
+    if (!c->dead) {
+      Dispatch(l, c);
+      if (!c->dead)
+        UpdateEvents(l, c);
+    }
+    Unref(l, c);
+    c = next;
+  }
+}
+
+// Клиенту порта статистики — текст метрик, и соединение закрывается
+static void ServeStats(struct Loop *l) {
+  while (true) {
+    int fd = accept4(l->stats_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (f) {
+      l->report(f, l->report_ctx);
+      fclose(f);
+      // Текст в пару килобайт, сокет блокирующий: уходит за один send
+      if (send(fd, text, len, MSG_NOSIGNAL) < 0)
+        perror("stats send");
+      free(text);
+    }
+    close(fd);
+  }
+}
+
+int LoopInit(struct Loop *l, int listen_fd, struct Pool *pool,
+             RequestFn handle, void *ctx) {
+  memset(l, 0, sizeof(*l));
+  l->listen_fd = listen_fd;
+  l->pool = pool;
+  l->handle = handle;
+  l->ctx = ctx;
+  l->stats_fd = l->sigfd = -1;
+  LsMutexInit(&l->done_lock, "loop_done");
+
+  if (SetNonBlocking(listen_fd) < 0) {
+    perror("fcntl");
+    return -1;
+  }
+  l->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (l->epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  l->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (l->evfd < 0) {
+    perror("eventfd");
+    return -1;
+  }
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &listen_tag};
+  if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  ev.data.ptr = &event_tag;
+  if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->evfd, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  return 0;
+}
+
+int LoopEnableStats(struct Loop *l, int stats_fd, ReportFn report,
+                    void *ctx) {
+  l->report = report;
+  l->report_ctx = ctx;
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  l->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (l->sigfd < 0) {
+    perror("signalfd");
+    return -1;
+  }
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &signal_tag};
+  if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->sigfd, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+
+  if (stats_fd < 0)
+    return 0;
+  if (SetNonBlocking(stats_fd) < 0) {
+    perror("fcntl");
+    return -1;
+  }
+  l->stats_fd = stats_fd;
+  ev.data.ptr = &stats_tag;
+  if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, stats_fd, &ev) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  return 0;
+}
+
+void LoopSetAdmission(struct Loop *l, struct Admission *a) { l->admit = a; }
+
+void LoopSetRecorder(struct Loop *l, struct Recorder *r) { l->recorder = r; }
+
+void LoopSetReduce(struct Loop *l, ReduceFn fn, void *ctx) {
+  l->reduce = fn;
+  l->reduce_ctx = ctx;
+}
+
+void LoopRun(struct Loop *l) {
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  while (true) {
+    fflush(stdout);
+    if (l->recorder)
+      RecorderFlush(l->recorder);
+    int n = epoll_wait(l->epfd, events, LOOP_MAX_EVENTS,
+                       l->blocked ? LOOP_RETRY_MS : -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return;
+    }
+    if (l->blocked)
+      RetryBlocked(l);
+    for (int i = 0; i < n; i++) {
+      void *tag = events[i].data.ptr;
+      if (tag == &listen_tag) {
+        AcceptAll(l);
+        continue;
+      }
+      if (tag == &event_tag) {
+        OnCompletions(l);
+        continue;
+      }
+      if (tag == &stats_tag) {
+        ServeStats(l);
+        continue;
+      }
+      if (tag == &signal_tag) {
+        struct signalfd_siginfo si;
+        while (read(l->sigfd, &si, sizeof(si)) == sizeof(si)) {
+          printf("# stats\n");
+          l->report(stdout, l->report_ctx);
+        }
+        continue;
+      }
+      // Пока разбираем событие, соединение держим сами: обработчики
+      // могут закрыть его, но не освободить. Закрытое раньше в этой же
+      // пачке уже может лежать в graveyard — его события пропускаем
+      struct Conn *c = tag;
+      if (c->dead)
+        continue;
+      uint32_t e = events[i].events;
+      c->refs++;
+      if (e & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        // Клиент закрыл соединение или оно сброшено — ответ уже не
+        // нужен, а недосчитанные запросы отменяются
+        CloseConn(l, c);
+      } else {
+        if (e & EPOLLIN)
+          OnReadable(l, c);
+        if (!c->dead && (e & EPOLLOUT))
+          OnWritable(l, c);
+      }
+      Unref(l, c);
+    }
+    Bury(l);
+  }
+}
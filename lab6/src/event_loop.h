@@ -0,0 +1,102 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "admit.h"
+#include "lockstat.h"
+#include "pool.h"
+#include "protocol.h"
+#include "record.h"
+
+/*
+ * Неблокирующий сетевой цикл сервера на epoll.
+ *
+ * Один поток принимает соединения и читает/пишет все сокеты. Запрос
+ * (см. protocol.h) собирается из сколь угодно мелких кусков во входном
+ * буфере соединения и уходит в пул задачей PoolSubmit. Рабочий поток
+ * кладёт готовый ответ в очередь завершений и будит цикл через eventfd;
+ * отправляет ответ снова сетевой поток.
+ *
+ * Соединение v1 ждёт ответа на каждый запрос, прежде чем брать
+ * следующий: ответы v1 не подписаны. На соединении v2 в пуле может быть
+ * до CONN_MAX_INFLIGHT запросов сразу, ответы уходят по готовности.
+ *
+ * У каждого запроса свой флаг отмены. Его взводит кадр FRAME_CANCEL или
+ * закрытие соединения клиентом (EPOLLRDHUP): задача, ещё стоящая в
+ * очереди, не считается вовсе, начатая бросает счёт на ближайшей
+ * проверке (см. coalesce.h).
+ *
+ * Запросы идут в пул по возрастанию срока; у запроса без срока он
+ * условный — LOOP_DEFAULT_BUDGET_NS от приёма, чтобы поток запросов со
+ * сроками не задержал его навсегда. Если подключён допуск (admit.h),
+ * запрос v2, который не помещается в очередь или не успеет к сроку,
+ * сразу получает отказ. Отказать запросу v1 нечем — такое соединение
+ * просто не читается, пока очередь не освободится (раз в
+ * LOOP_RETRY_MS), и давление доходит до клиента через TCP.
+ */
+
+#define CONN_IN_BUF 4096
+#define CONN_MAX_INFLIGHT 64
+#define LOOP_MAX_EVENTS 256
+#define LOOP_DEFAULT_BUDGET_NS 10000000000ull
+#define LOOP_RETRY_MS 5
+
+// Обработка одного запроса; вызывается в рабочем потоке пула. Когда
+// взведён *cancel, можно вернуть что угодно — ответ не нужен
+typedef uint64_t (*RequestFn)(uint64_t begin, uint64_t end, uint64_t mod,
+                              const bool *cancel, void *ctx);
+
+// Текст со статистикой сервера
+typedef void (*ReportFn)(FILE *f, void *ctx);
+// Свёртка кадра FRAME_REDUCE; тоже в рабочем потоке пула
+typedef void (*ReduceFn)(uint64_t begin, uint64_t end, const bool *cancel,
+                         struct ReduceResult *out, void *ctx);
+
+struct Job;
+struct Conn;
+
+struct Loop {
+  int epfd;
+  int evfd;       // eventfd: рабочие сообщают о готовых ответах
+  int listen_fd;
+  int stats_fd;  // -1 — порта статистики нет
+  int sigfd;     // signalfd на SIGUSR1
+  ReportFn report;
+  void *report_ctx;
+  struct Pool *pool;
+  struct Admission *admit;  // NULL — брать всё
+  struct Recorder *recorder;  // NULL — трасса не пишется
+  RequestFn handle;
+  void *ctx;
+  ReduceFn reduce;  // NULL — FRAME_REDUCE считается мусором
+  void *reduce_ctx;
+  struct LsMutex done_lock;
+  struct Job *done_head;  // готовые ответы, в порядке завершения
+  struct Job *done_tail;
+  size_t nconns;
+  struct Conn *blocked;  // соединения v1, ждущие места в очереди
+  struct Conn *graveyard;  // без ссылок, освободятся после пачки событий
+};
+
+// listen_fd переводится в неблокирующий режим.
+// Возвращает 0 или -1 (причина уже напечатана).
+int LoopInit(struct Loop *l, int listen_fd, struct Pool *pool,
+             RequestFn handle, void *ctx);
+// Отдавать report: каждому, кто подключится к stats_fd (-1 — не
+// слушать), и в stdout по SIGUSR1. SIGUSR1 должен быть заблокирован
+// во всех потоках процесса до их создания.
+int LoopEnableStats(struct Loop *l, int stats_fd, ReportFn report,
+                    void *ctx);
+// Пускать запросы в пул через a (общий для всех циклов сервера)
+void LoopSetAdmission(struct Loop *l, struct Admission *a);
+// Писать каждый принятый запрос в трассу r (общую для всех циклов)
+void LoopSetRecorder(struct Loop *l, struct Recorder *r);
+// Принимать кадры FRAME_REDUCE и считать их через fn
+void LoopSetReduce(struct Loop *l, ReduceFn fn, void *ctx);
+// Не возвращается, пока не сломается epoll
+void LoopRun(struct Loop *l);
+
+#endif  // EVENT_LOOP_H
@@ -0,0 +1,128 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <getopt.h>
+
+#include "common.h"
+#include "utils.h"  // из ЛР3: GenerateArray
+
+/*
+ * Файлы шардов для server --shard.
+ *
+ * Пишет массив GenerateArray(seed, size) из ЛР3 — тот же, что считают
+ * lab3/lab4 с теми же --seed и размером, так что их min/max/sum можно
+ * сверить с reduce. С --parts N массив режется на N идущих подряд кусков
+ * почти равной длины: PATH.0 ... PATH.N-1, по файлу на сервер; в файле
+ * серверов для reduce они перечисляются в том же порядке.
+ */
+
+#define MAX_PARTS 1024
+
+static void WritePart(const char *path, const int *data, size_t count) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  if (fwrite(data, sizeof(*data), count, f) != count || fclose(f) != 0) {
+    fprintf(stderr, "Write to %s failed\n", path);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 0, size = 0, parts = 1;
+  const char *out = NULL;
+
+  while (true) {
+    static struct option options[] = {{"seed", required_argument, 0, 0},
+                                      {"size", required_argument, 0, 0},
+                                      {"out", required_argument, 0, 0},
+                                      {"parts", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ConvertStringToUI64(optarg, &seed) || seed > UINT_MAX) {
+          fprintf(stderr, "seed must be in 0..%u\n", UINT_MAX);
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &size) || !size || size > UINT_MAX) {
+          fprintf(stderr, "size must be in 1..%u\n", UINT_MAX);
+          return 1;
+        }
+        break;
+      case 2:
+        out = optarg;
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &parts) || !parts ||
+            parts > MAX_PARTS) {
+          fprintf(stderr, "parts must be in 1..%d\n", MAX_PARTS);
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (!size || !out) {
+    fprintf(stderr,
+            "Using: %s --seed 1 --size 1000000 --out /path/to/shard "
+            "[--parts 1]\n",
+            argv[0]);
+    return 1;
+  }
+  if (parts > size) {
+    fprintf(stderr, "parts must not exceed size\n");
+    return 1;
+  }
+
+  int *array = malloc(sizeof(int) * (size_t)size);
+  if (!array) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  GenerateArray(array, (unsigned)size, (unsigned)seed);
+
+  if (parts == 1) {
+    WritePart(out, array, (size_t)size);
+  } else {
+    char path[PATH_MAX];
+    size_t base = (size_t)(size / parts), rem = (size_t)(size % parts);
+    size_t begin = 0;
+    for (size_t i = 0; i < parts; i++) {
+      size_t count = base + (i < rem ? 1 : 0);
+      if (snprintf(path, sizeof(path), "%s.%zu", out, i) >= (int)sizeof(path)) {
+        fprintf(stderr, "Path too long: %s\n", out);
+        return 1;
+      }
+      WritePart(path, array + begin, count);
+      begin += count;
+    }
+  }
+  free(array);
+  return 0;
+}
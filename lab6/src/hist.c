@@ -0,0 +1,62 @@
+#include "hist.h"
+
+#include <string.h>
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static unsigned Index(uint64_t v) {
+  if (v < HIST_SUB)
+    return (unsigned)v;
+  unsigned e = 63u - (unsigned)__builtin_clzll(v);
+  unsigned shift = e - (HIST_SUB_BITS - 1);
+  unsigned sub = (unsigned)(v >> shift);  // в [HIST_SUB / 2, HIST_SUB)
+  return HIST_SUB + (shift - 1) * (HIST_SUB / 2) + (sub - HIST_SUB / 2);
+}
+
+// Верхняя граница значений в корзине i
+static uint64_t Upper(unsigned i) {
+  if (i < HIST_SUB)
+    return i;
+  unsigned shift = (i - HIST_SUB) / (HIST_SUB / 2) + 1;
+  uint64_t sub = (i - HIST_SUB) % (HIST_SUB / 2) + HIST_SUB / 2;
+  return ((sub + 1) << shift) - 1;
+}
+
+void HistInit(struct Hist *h) { memset(h, 0, sizeof(*h)); }
+
+void HistRecord(struct Hist *h, uint64_t value) {
+  unsigned i = Index(value);
+  STORE(h->counts[i], LOAD(h->counts[i]) + 1);
+  STORE(h->total, LOAD(h->total) + 1);
+  STORE(h->sum, LOAD(h->sum) + value);
+  if (value > LOAD(h->max))
+    STORE(h->max, value);
+}
+
+void HistMerge(struct Hist *dst, const struct Hist *src) {
+  for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    dst->counts[i] += LOAD(src->counts[i]);
+  dst->total += LOAD(src->total);
+  dst->sum += LOAD(src->sum);
+  uint64_t max = LOAD(src->max);
+  if (max > dst->max)
+    dst->max = max;
+}
+
+uint64_t HistPercentile(const struct Hist *h, double p) {
+  if (h->total == 0)
+    return 0;
+  uint64_t want = (uint64_t)(p / 100.0 * (double)h->total + 0.5);
+  if (want == 0)
+    want = 1;
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= want) {
+      uint64_t v = Upper(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
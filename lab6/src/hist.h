@@ -0,0 +1,36 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/*
+ * Гистограмма задержек в духе HDR Histogram.
+ *
+ * Значения до HIST_SUB хранятся точно, дальше каждый интервал
+ * [2^e, 2^(e+1)) делится на HIST_SUB / 2 равных частей — относительная
+ * ошибка не больше 1/64 на всём диапазоне uint64_t при ~30 КиБ памяти.
+ *
+ * Писатель у гистограммы один, читателей сколько угодно: счётчики
+ * меняются атомарными store без блокировок, и HistMerge можно звать
+ * на лету, пока писатель работает.
+ */
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB + (64 - HIST_SUB_BITS) * (HIST_SUB / 2))
+
+struct Hist {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+};
+
+void HistInit(struct Hist *h);
+void HistRecord(struct Hist *h, uint64_t value);
+// dst += src; src может одновременно писаться своим потоком
+void HistMerge(struct Hist *dst, const struct Hist *src);
+// Значение, не меньше которого p процентов записей (0 < p <= 100)
+uint64_t HistPercentile(const struct Hist *h, double p);
+
+#endif  // HIST_H
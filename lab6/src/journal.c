@@ -0,0 +1,161 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "protocol.h"
+
+#define JOURNAL_MAGIC 0x524A4146u  // "FAJR"
+#define JOURNAL_VERSION 1
+#define READ_RECORDS 1024
+
+static bool WriteAll(int fd, const unsigned char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// Прочитать до len байт; меньше — только в конце файла
+static ssize_t ReadAll(int fd, unsigned char *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    got += (size_t)n;
+  }
+  return (ssize_t)got;
+}
+
+static bool Replay(struct Journal *j, const char *path, uint64_t k,
+                   uint64_t mod, JournalRestoreFn restore, void *ctx) {
+  unsigned char header[JOURNAL_HEADER_SIZE];
+  if (ReadAll(j->fd, header, sizeof(header)) != (ssize_t)sizeof(header) ||
+      GetU32(header) != JOURNAL_MAGIC ||
+      GetU32(header + 4) != JOURNAL_VERSION) {
+    fprintf(stderr, "%s: not a factorial journal\n", path);
+    return false;
+  }
+  if (GetU64(header + 8) != k || GetU64(header + 16) != mod) {
+    fprintf(stderr, "%s: journal is for k=%llu mod=%llu\n", path,
+            (unsigned long long)GetU64(header + 8),
+            (unsigned long long)GetU64(header + 16));
+    return false;
+  }
+
+  static unsigned char buf[READ_RECORDS * JOURNAL_RECORD_SIZE];
+  off_t valid = JOURNAL_HEADER_SIZE;
+  size_t records = 0;
+  ssize_t n;
+  while ((n = ReadAll(j->fd, buf, sizeof(buf))) > 0) {
+    size_t whole = (size_t)n / JOURNAL_RECORD_SIZE;
+    for (size_t i = 0; i < whole; i++) {
+      const unsigned char *r = buf + i * JOURNAL_RECORD_SIZE;
+      if (!restore(GetU64(r), GetU64(r + 8), GetU64(r + 16), ctx)) {
+        fprintf(stderr, "%s: bad record %zu\n", path, records);
+        return false;
+      }
+      records++;
+    }
+    valid += (off_t)(whole * JOURNAL_RECORD_SIZE);
+    if (whole * JOURNAL_RECORD_SIZE != (size_t)n)
+      break;
+  }
+  if (n < 0) {
+    perror(path);
+    return false;
+  }
+  // Хвост недописанной записи мешал бы следующим
+  struct stat st;
+  if (fstat(j->fd, &st) == 0 && st.st_size > valid) {
+    fprintf(stderr, "%s: dropping torn record at the end\n", path);
+    if (ftruncate(j->fd, valid) < 0) {
+      perror(path);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JournalOpen(struct Journal *j, const char *path, uint64_t k,
+                 uint64_t mod, JournalRestoreFn restore, void *ctx) {
+  j->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  j->synced_at = 0;
+  j->dirty = false;
+  if (j->fd < 0) {
+    perror(path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(j->fd, &st) < 0) {
+    perror(path);
+    close(j->fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    if (!Replay(j, path, k, mod, restore, ctx)) {
+      close(j->fd);
+      return false;
+    }
+    return true;
+  }
+
+  unsigned char header[JOURNAL_HEADER_SIZE];
+  PutU32(header, JOURNAL_MAGIC);
+  PutU32(header + 4, JOURNAL_VERSION);
+  PutU64(header + 8, k);
+  PutU64(header + 16, mod);
+  if (!WriteAll(j->fd, header, sizeof(header)) || fdatasync(j->fd) < 0) {
+    perror(path);
+    close(j->fd);
+    return false;
+  }
+  return true;
+}
+
+bool JournalAppend(struct Journal *j, uint64_t begin, uint64_t end,
+                   uint64_t value, uint64_t now) {
+  unsigned char r[JOURNAL_RECORD_SIZE];
+  PutU64(r, begin);
+  PutU64(r + 8, end);
+  PutU64(r + 16, value);
+  // Запись целиком одним write: O_APPEND не даст ей разорваться посередине
+  // файла, а обрыв в конце отрежет следующий JournalOpen
+  if (!WriteAll(j->fd, r, sizeof(r))) {
+    perror("journal write");
+    return false;
+  }
+  j->dirty = true;
+  if (now - j->synced_at >= JOURNAL_SYNC_NS) {
+    if (fdatasync(j->fd) < 0) {
+      perror("journal fdatasync");
+      return false;
+    }
+    j->synced_at = now;
+    j->dirty = false;
+  }
+  return true;
+}
+
+void JournalClose(struct Journal *j) {
+  if (j->dirty && fdatasync(j->fd) < 0)
+    perror("journal fdatasync");
+  close(j->fd);
+}
@@ -0,0 +1,44 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Журнал посчитанных кусков (клиент, --journal).
+ *
+ * Файл только дописывается: заголовок JOURNAL_HEADER_SIZE байт (magic,
+ * версия, k, mod), дальше записи по JOURNAL_RECORD_SIZE байт — begin,
+ * end и произведение по модулю, все little-endian. Запись появляется,
+ * когда кусок засчитан, так что перезапущенный клиент с тем же журналом
+ * пересчитывает только то, чего в нём нет.
+ *
+ * На диск журнал сбрасывается не чаще раза в JOURNAL_SYNC_NS: при сбое
+ * машины теряется не больше последней секунды работы. Недописанная
+ * последняя запись (клиент убит посреди write) при открытии отрезается.
+ */
+
+#define JOURNAL_HEADER_SIZE 24
+#define JOURNAL_RECORD_SIZE 24
+#define JOURNAL_SYNC_NS 1000000000ull
+
+struct Journal {
+  int fd;
+  uint64_t synced_at;
+  bool dirty;  // есть записи после последнего fdatasync
+};
+
+// Кусок из журнала прежнего запуска. false — запись не подходит к задаче
+typedef bool (*JournalRestoreFn)(uint64_t begin, uint64_t end, uint64_t value,
+                                 void *ctx);
+
+// Открыть журнал задачи (k, mod), создав его при необходимости, и отдать
+// все прежние записи в restore. false — ошибка (уже напечатана)
+bool JournalOpen(struct Journal *j, const char *path, uint64_t k,
+                 uint64_t mod, JournalRestoreFn restore, void *ctx);
+// false — запись не удалась (уже напечатано)
+bool JournalAppend(struct Journal *j, uint64_t begin, uint64_t end,
+                   uint64_t value, uint64_t now);
+void JournalClose(struct Journal *j);
+
+#endif  // JOURNAL_H
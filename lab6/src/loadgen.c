@@ -0,0 +1,377 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+#include "hist.h"
+#include "protocol.h"
+
+/*
+ * Генератор нагрузки для сервера факториала (протокол v2).
+ *
+ * Замкнутый цикл (--rate 0): на каждом соединении один запрос в полёте,
+ * следующий уходит сразу после ответа; задержка — от отправки.
+ *
+ * Открытый цикл (--rate R): запросы назначаются на моменты t0 + i / R
+ * по кругу на соединения и уходят независимо от ответов. Задержка
+ * считается от назначенного момента, а не от фактической отправки,
+ * поэтому отставание генератора или сервера не прячется
+ * (coordinated omission): запрос, который из-за очереди ушёл позже,
+ * честно получает это время в свою задержку.
+ *
+ * С --deadline-ms запрос несёт срок: сколько ему осталось от
+ * назначенного момента. Отвергнутые и просроченные сервером запросы в
+ * гистограмму не идут и считаются отдельно, как и ответы, пришедшие
+ * позже срока; goodput — ответы, успевшие к сроку, в секунду.
+ */
+
+#define DEFAULT_CONNECTIONS 16
+#define DEFAULT_DURATION 5
+#define DEFAULT_MIX "100000:1000000007"
+#define DRAIN_NS 5000000000ull
+#define MAX_EVENTS 256
+
+struct MixEntry {
+  uint64_t k;
+  uint64_t mod;
+  uint64_t weight;
+};
+
+static struct MixEntry *mix;
+static size_t mix_num;
+static uint64_t mix_weight;
+static uint64_t spread = 1;
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+// Назначенное время каждого запроса по id; 0 — ответ уже получен
+static uint64_t *intended;
+static size_t intended_cap;
+static uint32_t next_id;
+
+static struct Hist hist;
+static uint64_t completed;
+static uint64_t budget_ns;  // срок запроса от назначенного момента; 0 — нет
+static uint64_t rejected, expired, late;
+
+static uint64_t Random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+// "k:mod[:вес],k:mod[:вес],..."
+static bool ParseMix(const char *spec) {
+  char *copy = strdup(spec);
+  for (char *item = strtok(copy, ","); item; item = strtok(NULL, ",")) {
+    char *fields[3] = {item, NULL, NULL};
+    for (int i = 1; i < 3 && fields[i - 1]; i++) {
+      char *colon = strchr(fields[i - 1], ':');
+      if (colon) {
+        *colon = '\0';
+        fields[i] = colon + 1;
+      }
+    }
+    struct MixEntry e = {0, 0, 1};
+    if (!fields[1] || !ConvertStringToUI64(fields[0], &e.k) || e.k == 0 ||
+        !ConvertStringToUI64(fields[1], &e.mod) || e.mod == 0 ||
+        (fields[2] && (!ConvertStringToUI64(fields[2], &e.weight) ||
+                       e.weight == 0))) {
+      free(copy);
+      return false;
+    }
+    mix = Realloc(mix, (mix_num + 1) * sizeof(*mix));
+    mix[mix_num++] = e;
+    mix_weight += e.weight;
+  }
+  free(copy);
+  return mix_num > 0;
+}
+
+// Поставить запрос в выходной буфер соединения
+static void Issue(struct Stream *c, uint64_t when) {
+  uint64_t pick = Random() % mix_weight;
+  size_t i = 0;
+  while (pick >= mix[i].weight)
+    pick -= mix[i++].weight;
+  uint64_t begin = 1 + Random() % spread;
+
+  uint32_t id = next_id++;
+  if (id == intended_cap) {
+    intended_cap = intended_cap ? intended_cap * 2 : 4096;
+    intended = Realloc(intended, intended_cap * sizeof(*intended));
+  }
+  intended[id] = when;
+
+  unsigned char *frame = StreamReserve(c, REQUEST_DEADLINE_FRAME_SIZE);
+  uint64_t end = begin + mix[i].k - 1;
+  if (!budget_ns) {
+    EncodeRequest(frame, id, begin, end, mix[i].mod);
+    c->out_len += REQUEST_FRAME_SIZE;
+    return;
+  }
+  // Отставание генератора съедает срок; опоздавшему — минимальный
+  uint64_t now = NowNs(), left = when + budget_ns - now;
+  if (when + budget_ns <= now)
+    left = 1000;
+  EncodeRequestDeadline(frame, id, begin, end, mix[i].mod, left / 1000);
+  c->out_len += REQUEST_DEADLINE_FRAME_SIZE;
+}
+
+// Ответ на запрос h.id
+static bool OnReply(const struct FrameHeader *h, uint64_t now, void *ctx) {
+  (void)ctx;
+  if (h->id >= next_id || !intended[h->id])
+    return false;
+  if (h->flags & FRAME_FLAG_REJECTED) {
+    rejected++;
+  } else if (h->flags & FRAME_FLAG_EXPIRED) {
+    expired++;
+  } else {
+    HistRecord(&hist, now - intended[h->id]);
+    if (budget_ns && now - intended[h->id] > budget_ns)
+      late++;
+  }
+  intended[h->id] = 0;
+  completed++;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *server = NULL;
+  uint64_t connections = DEFAULT_CONNECTIONS;
+  uint64_t duration = DEFAULT_DURATION;
+  uint64_t rate = 0;
+  const char *mix_spec = DEFAULT_MIX;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"connections", required_argument, 0, 0},
+                                      {"duration", required_argument, 0, 0},
+                                      {"rate", required_argument, 0, 0},
+                                      {"mix", required_argument, 0, 0},
+                                      {"spread", required_argument, 0, 0},
+                                      {"seed", required_argument, 0, 0},
+                                      {"deadline-ms", required_argument, 0,
+                                       0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    bool ok = true;
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        server = optarg;
+        break;
+      case 1:
+        ok = ConvertStringToUI64(optarg, &connections) && connections > 0;
+        break;
+      case 2:
+        ok = ConvertStringToUI64(optarg, &duration) && duration > 0;
+        break;
+      case 3:
+        ok = ConvertStringToUI64(optarg, &rate) && rate <= 1000000000;
+        break;
+      case 4:
+        mix_spec = optarg;
+        break;
+      case 5:
+        ok = ConvertStringToUI64(optarg, &spread) && spread > 0;
+        break;
+      case 6:
+        ok = ConvertStringToUI64(optarg, &rng) && rng != 0;
+        break;
+      case 7:
+        ok = ConvertStringToUI64(optarg, &budget_ns) &&
+             budget_ns <= 1000000000;
+        budget_ns *= 1000000;
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+    if (!ok) {
+      fprintf(stderr, "Bad value for --%s: %s\n", options[option_index].name,
+              optarg);
+      return 1;
+    }
+  }
+
+  if (!server) {
+    fprintf(stderr,
+            "Using: %s --server 127.0.0.1:20001 [--connections 16] "
+            "[--duration 5] [--rate 0] [--mix k:mod[:weight],...] "
+            "[--spread 1] [--seed N] [--deadline-ms N]\n"
+            "  --rate 0 — closed loop, otherwise requests per second\n"
+            "  --deadline-ms N — server may reject or expire requests "
+            "older than N ms\n",
+            argv[0]);
+    return 1;
+  }
+  if (!ParseMix(mix_spec)) {
+    fprintf(stderr, "Bad --mix: %s\n", mix_spec);
+    return 1;
+  }
+
+  int epfd = epoll_create1(0);
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (epfd < 0 || tfd < 0) {
+    perror("epoll/timerfd");
+    return 1;
+  }
+  struct epoll_event tev = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &tev);
+
+  struct Stream *conns = calloc(connections, sizeof(*conns));
+  if (!conns) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < connections; i++) {
+    conns[i].fd = Connect(server, true);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &conns[i]};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+  }
+  HistInit(&hist);
+
+  uint64_t start = NowNs();
+  uint64_t deadline = start + duration * 1000000000ull;
+  uint64_t period = rate ? 1000000000ull / rate : 0;
+  uint64_t due = start;  // следующий запрос открытого цикла
+  size_t rr = 0;
+  size_t outstanding = 0;
+
+  if (rate) {
+    ArmTimer(tfd, due);
+  } else {
+    for (size_t i = 0; i < connections; i++) {
+      Issue(&conns[i], NowNs());
+      StreamFlush(&conns[i]);
+      StreamWatch(epfd, &conns[i], &conns[i]);
+    }
+    outstanding = connections;
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    uint64_t now = NowNs();
+    if (now >= deadline && (outstanding == 0 || now >= deadline + DRAIN_NS))
+      break;
+    uint64_t until = now < deadline ? deadline : deadline + DRAIN_NS;
+    int timeout = (int)((until - now) / 1000000 + 1);
+    int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return 1;
+    }
+    for (int i = 0; i < n; i++) {
+      struct Stream *c = events[i].data.ptr;
+      if (!c) {
+        uint64_t ticks;
+        if (read(tfd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+          perror("timerfd");
+        // Выдаём все запросы, чьё время уже подошло, даже если проснулись
+        // поздно: опоздание войдёт в их задержку
+        now = NowNs();
+        while (due <= now && due < deadline) {
+          struct Stream *to = &conns[rr++ % connections];
+          Issue(to, due);
+          outstanding++;
+          due += period;
+        }
+        for (size_t j = 0; j < connections; j++) {
+          if (conns[j].out_len) {
+            StreamFlush(&conns[j]);
+            StreamWatch(epfd, &conns[j], &conns[j]);
+          }
+        }
+        if (due < deadline)
+          ArmTimer(tfd, due);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT)
+        StreamFlush(c);
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        size_t got = StreamReceive(c, OnReply, NULL);
+        outstanding -= got;
+        if (!rate && NowNs() < deadline) {
+          for (size_t j = 0; j < got; j++) {
+            Issue(c, NowNs());
+            outstanding++;
+          }
+          StreamFlush(c);
+        }
+      }
+      StreamWatch(epfd, c, c);
+    }
+  }
+
+  // Не дождавшиеся ответа запросы тоже попадают в гистограмму — со
+  // временем, которое они уже прождали: это нижняя граница их задержки
+  uint64_t end = NowNs();
+  uint64_t unanswered = 0;
+  for (uint32_t id = 0; id < next_id; id++) {
+    if (intended[id]) {
+      HistRecord(&hist, end - intended[id]);
+      unanswered++;
+    }
+  }
+
+  double seconds = (double)(deadline - start) / 1e9;
+  if (rate)
+    printf("mode: open loop, %llu req/s", (unsigned long long)rate);
+  else
+    printf("mode: closed loop");
+  printf(", %llu connections, %.1f s", (unsigned long long)connections,
+         seconds);
+  if (budget_ns)
+    printf(", deadline %llu ms", (unsigned long long)(budget_ns / 1000000));
+  printf("\n");
+  printf("requests: %u sent, %llu completed, %llu unanswered\n", next_id,
+         (unsigned long long)completed, (unsigned long long)unanswered);
+  printf("throughput: %.1f req/s\n", (double)completed / seconds);
+  // Отказы бывают и без срока — при полной очереди сервера
+  if (budget_ns || rejected) {
+    printf("not served: %llu rejected, %llu expired, %llu late\n",
+           (unsigned long long)rejected, (unsigned long long)expired,
+           (unsigned long long)late);
+    printf("goodput: %.1f req/s\n",
+           (double)(completed - rejected - expired - late) / seconds);
+  }
+  printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f  "
+         "mean %.1f\n",
+         Us(HistPercentile(&hist, 50)), Us(HistPercentile(&hist, 90)),
+         Us(HistPercentile(&hist, 99)), Us(HistPercentile(&hist, 99.9)),
+         Us(hist.max), hist.total ? Us(hist.sum / hist.total) : 0.0);
+
+  for (size_t i = 0; i < connections; i++) {
+    close(conns[i].fd);
+    free(conns[i].out);
+  }
+  free(conns);
+  free(intended);
+  free(mix);
+  return unanswered ? 2 : 0;
+}
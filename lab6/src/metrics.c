@@ -0,0 +1,102 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+struct ThreadMetrics {
+  uint64_t counters[M_COUNTERS];
+  uint64_t logged;  // запросов, прошедших через MetricsSampleLog
+  struct Hist hists[H_HISTS];
+  struct ThreadMetrics *next;
+};
+
+static const char *counter_names[M_COUNTERS] = {
+    "requests", "replies", "bytes_in", "bytes_out",
+    "connections_accepted", "connections_closed", "bad_frames",
+    "cancelled", "rejected", "expired", "throttled"};
+static const char *hist_names[H_HISTS] = {"queue_wait_us", "compute_us",
+                                          "latency_us"};
+
+static struct ThreadMetrics *all;
+static __thread struct ThreadMetrics *local;
+static uint64_t log_every;
+
+static struct ThreadMetrics *Local(void) {
+  if (local)
+    return local;
+  struct ThreadMetrics *m = calloc(1, sizeof(*m));
+  if (!m) {
+    perror("calloc");
+    exit(1);
+  }
+  m->next = __atomic_load_n(&all, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all, &m->next, m, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  local = m;
+  return m;
+}
+
+void MetricAdd(enum MetricCounter m, uint64_t v) {
+  struct ThreadMetrics *t = Local();
+  STORE(t->counters[m], LOAD(t->counters[m]) + v);
+}
+
+void MetricRecord(enum MetricHist h, uint64_t ns) {
+  HistRecord(&Local()->hists[h], ns);
+}
+
+void MetricsSetLogEvery(uint64_t every) { log_every = every; }
+
+bool MetricsSampleLog(void) {
+  if (!log_every)
+    return false;
+  struct ThreadMetrics *t = Local();
+  return t->logged++ % log_every == 0;
+}
+
+void MetricsDump(FILE *f) {
+  uint64_t counters[M_COUNTERS] = {0};
+  // 30 КиБ на гистограмму — не на стек
+  struct Hist *hists = calloc(H_HISTS, sizeof(*hists));
+  if (!hists) {
+    fprintf(f, "error out of memory\n");
+    return;
+  }
+
+  for (struct ThreadMetrics *t = __atomic_load_n(&all, __ATOMIC_ACQUIRE); t;
+       t = t->next) {
+    for (int m = 0; m < M_COUNTERS; m++)
+      counters[m] += LOAD(t->counters[m]);
+    for (int h = 0; h < H_HISTS; h++)
+      HistMerge(&hists[h], &t->hists[h]);
+  }
+
+  for (int m = 0; m < M_COUNTERS; m++)
+    fprintf(f, "%s %llu\n", counter_names[m], (unsigned long long)counters[m]);
+  // Счётчики читаются не одномоментно, поэтому разность может на миг
+  // уйти в минус — показываем 0
+  uint64_t inflight = counters[M_REQUESTS] > counters[M_REPLIES]
+                          ? counters[M_REQUESTS] - counters[M_REPLIES]
+                          : 0;
+  uint64_t open = counters[M_ACCEPTED] > counters[M_CLOSED]
+                      ? counters[M_ACCEPTED] - counters[M_CLOSED]
+                      : 0;
+  fprintf(f, "inflight %llu\n", (unsigned long long)inflight);
+  fprintf(f, "connections_open %llu\n", (unsigned long long)open);
+
+  static const double quantiles[] = {50, 90, 99, 99.9};
+  static const char *qnames[] = {"p50", "p90", "p99", "p999"};
+  for (int h = 0; h < H_HISTS; h++) {
+    const struct Hist *hist = &hists[h];
+    fprintf(f, "%s_count %llu\n", hist_names[h],
+            (unsigned long long)hist->total);
+    for (int q = 0; q < 4; q++)
+      fprintf(f, "%s_%s %.1f\n", hist_names[h], qnames[q],
+              (double)HistPercentile(hist, quantiles[q]) / 1e3);
+    fprintf(f, "%s_max %.1f\n", hist_names[h], (double)hist->max / 1e3);
+  }
+  free(hists);
+}
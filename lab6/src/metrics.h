@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
+
+/*
+ * Метрики сервера без блокировок.
+ *
+ * У каждого потока свой набор счётчиков и гистограмм, который только
+ * он и пишет (атомарные store без lock-префикса). Набор заводится при
+ * первом обращении потока и добавляется в общий список через CAS.
+ * Чтение (MetricsDump) обходит список и складывает всё на лету — пишущие
+ * потоки при этом не останавливаются.
+ */
+
+enum MetricCounter {
+  M_REQUESTS,     // принято запросов
+  M_REPLIES,      // отправлено ответов
+  M_BYTES_IN,
+  M_BYTES_OUT,
+  M_ACCEPTED,     // соединений принято
+  M_CLOSED,       // соединений закрыто
+  M_BAD_FRAMES,   // соединений, закрытых из-за мусора в потоке
+  M_CANCELLED,    // запросов отменено
+  M_REJECTED,     // запросов v2, не принятых в очередь
+  M_EXPIRED,      // запросов, чей срок истёк в очереди
+  M_THROTTLED,    // запросов v1, ждавших места в очереди
+  M_COUNTERS
+};
+
+enum MetricHist {
+  H_QUEUE_WAIT,  // от приёма запроса до начала счёта
+  H_COMPUTE,     // счёт в рабочем потоке
+  H_LATENCY,     // от приёма запроса до готового ответа
+  H_HISTS
+};
+
+void MetricAdd(enum MetricCounter m, uint64_t v);
+void MetricRecord(enum MetricHist h, uint64_t ns);
+
+// Писать в журнал этот запрос? Каждый log_every-й, 0 — никакой
+void MetricsSetLogEvery(uint64_t every);
+bool MetricsSampleLog(void);
+
+// Все метрики текстом "имя значение", по одной на строку
+void MetricsDump(FILE *f);
+
+#endif  // METRICS_H
@@ -0,0 +1,157 @@
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Взять следующую задачу из головы очереди; под p->lock.
+// Пачка уходит из очереди, как только разобраны все её задачи.
+static struct PoolBatch *Take(struct Pool *p, size_t *index) {
+  struct PoolBatch *b = p->head;
+  if (!b)
+    return NULL;
+  *index = b->next++;
+  if (b->next == b->n) {
+    p->head = b->qnext;
+    if (!p->head)
+      p->tail = NULL;
+  }
+  return b;
+}
+
+// Задача пачки b закончена; под p->lock
+static void Finish(struct Pool *p, struct PoolBatch *b) {
+  if (++b->done < b->n)
+    return;
+  if (b->detached)
+    free(b);
+  else
+    pthread_cond_broadcast(&p->done);
+}
+
+static void *Worker(void *arg) {
+  struct Pool *p = arg;
+  LsLock(&p->lock);
+  while (true) {
+    size_t index;
+    struct PoolBatch *b;
+    while (!(b = Take(p, &index)) && !p->stop)
+      pthread_cond_wait(&p->work, &p->lock.m);
+    if (!b)
+      break;
+    LsUnlock(&p->lock);
+    b->fn(index, b->arg);
+    LsLock(&p->lock);
+    Finish(p, b);
+  }
+  LsUnlock(&p->lock);
+  return NULL;
+}
+
+int PoolInit(struct Pool *p, int nthreads) {
+  LsMutexInit(&p->lock, "pool");
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->head = p->tail = NULL;
+  p->stop = false;
+  p->nthreads = 0;
+  p->threads = malloc(sizeof(pthread_t) *
+                      (size_t)(nthreads > 0 ? nthreads : 1));
+  if (!p->threads)
+    return -1;
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&p->threads[i], NULL, Worker, p)) {
+      fprintf(stderr, "Error: pthread_create failed for worker %d\n", i);
+      break;
+    }
+    p->nthreads++;
+  }
+  return nthreads == 0 || p->nthreads > 0 ? 0 : -1;
+}
+
+void PoolDestroy(struct Pool *p) {
+  LsLock(&p->lock);
+  p->stop = true;
+  pthread_cond_broadcast(&p->work);
+  LsUnlock(&p->lock);
+  for (int i = 0; i < p->nthreads; i++)
+    pthread_join(p->threads[i], NULL);
+  free(p->threads);
+  pthread_cond_destroy(&p->work);
+  pthread_cond_destroy(&p->done);
+  LsMutexDestroy(&p->lock);
+}
+
+void PoolRun(struct Pool *p, PoolTaskFn fn, void *arg, size_t n) {
+  if (n == 0)
+    return;
+  if (n == 1) {
+    fn(0, arg);
+    return;
+  }
+
+  struct PoolBatch b = {fn, arg, n, 0, 0, false, 0, NULL};
+  LsLock(&p->lock);
+  // В начало очереди: это части уже идущего запроса
+  b.qnext = p->head;
+  p->head = &b;
+  if (!p->tail)
+    p->tail = &b;
+  pthread_cond_broadcast(&p->work);
+
+  // Разбираем свою же пачку, пока в ней есть задачи
+  while (b.next < b.n) {
+    size_t index = b.next++;
+    if (b.next == b.n) {
+      // Забрали последнюю задачу — пачку из очереди убираем сами
+      struct PoolBatch **pp = &p->head;
+      struct PoolBatch *prev = NULL;
+      while (*pp != &b) {
+        prev = *pp;
+        pp = &(*pp)->qnext;
+      }
+      *pp = b.qnext;
+      if (p->tail == &b)
+        p->tail = prev;
+    }
+    LsUnlock(&p->lock);
+    fn(index, arg);
+    LsLock(&p->lock);
+    b.done++;  // ждём пачку только мы сами — будить некого
+  }
+  while (b.done < b.n)
+    pthread_cond_wait(&p->done, &p->lock.m);
+  LsUnlock(&p->lock);
+}
+
+int PoolSubmit(struct Pool *p, PoolTaskFn fn, void *arg, uint64_t deadline) {
+  if (p->nthreads == 0) {
+    fn(0, arg);
+    return 0;
+  }
+  struct PoolBatch *b = malloc(sizeof(*b));
+  if (!b)
+    return -1;
+  *b = (struct PoolBatch){fn, arg, 1, 0, 0, true, deadline, NULL};
+  LsLock(&p->lock);
+  // За пачками PoolRun и задачами со сроком не позже нашего. Обычно
+  // срок не раньше, чем у хвоста, и проход не нужен; иначе он ограничен
+  // длиной очереди (см. admit.h)
+  struct PoolBatch *prev = NULL;
+  if (p->tail && (!p->tail->detached || p->tail->deadline <= deadline)) {
+    prev = p->tail;
+  } else {
+    for (struct PoolBatch *q = p->head;
+         q && (!q->detached || q->deadline <= deadline); q = q->qnext)
+      prev = q;
+  }
+  b->qnext = prev ? prev->qnext : p->head;
+  if (prev)
+    prev->qnext = b;
+  else
+    p->head = b;
+  if (!b->qnext)
+    p->tail = b;
+  pthread_cond_signal(&p->work);
+  LsUnlock(&p->lock);
+  return 0;
+}
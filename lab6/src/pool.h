@@ -0,0 +1,61 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lockstat.h"
+
+/*
+ * Пул долгоживущих рабочих потоков.
+ *
+ * Работа подаётся пачками: PoolRun(pool, fn, arg, n) выполняет
+ * fn(0, arg) ... fn(n - 1, arg) и возвращается, когда все задачи пачки
+ * закончены. Вызывающий поток сам тоже разбирает задачи своей пачки,
+ * поэтому PoolRun можно звать из любого потока (в том числе из задачи
+ * пула) без риска, что все рабочие будут ждать друг друга.
+ *
+ * PoolSubmit(pool, fn, arg, deadline) ставит одну задачу и сразу
+ * возвращается — так сетевой цикл отдаёт запросы пулу, не блокируясь.
+ * Такие задачи стоят в очереди по возрастанию срока (EDF), при равных
+ * сроках — по порядку постановки. Пачки PoolRun встают в начало очереди:
+ * уже начатые запросы доделываются раньше, чем берутся новые.
+ */
+
+typedef void (*PoolTaskFn)(size_t index, void *arg);
+
+struct PoolBatch {
+  PoolTaskFn fn;
+  void *arg;
+  size_t n;
+  size_t next;  // первая ещё не взятая задача
+  size_t done;  // сколько задач закончено
+  bool detached;  // из PoolSubmit: пачку освобождает пул
+  uint64_t deadline;  // для PoolSubmit: место в очереди
+  struct PoolBatch *qnext;
+};
+
+struct Pool {
+  struct LsMutex lock;
+  pthread_cond_t work;  // появились задачи или пора завершаться
+  pthread_cond_t done;  // закончилась чья-то пачка
+  struct PoolBatch *head;
+  struct PoolBatch *tail;
+  pthread_t *threads;
+  int nthreads;
+  bool stop;
+};
+
+// nthreads может быть 0: тогда всё выполняет вызывающий PoolRun поток.
+// Возвращает 0 или -1, если не удалось создать ни одного потока.
+int PoolInit(struct Pool *p, int nthreads);
+void PoolDestroy(struct Pool *p);
+void PoolRun(struct Pool *p, PoolTaskFn fn, void *arg, size_t n);
+// fn(0, arg) в одном из рабочих потоков (без рабочих — прямо здесь)
+// раньше задач с большим deadline. Возвращает 0 или -1, если не хватило
+// памяти.
+int PoolSubmit(struct Pool *p, PoolTaskFn fn, void *arg, uint64_t deadline);
+
+#endif  // POOL_H
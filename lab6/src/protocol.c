@@ -0,0 +1,113 @@
+#include "protocol.h"
+
+#include <endian.h>
+#include <string.h>
+
+void PutU32(unsigned char *buf, uint32_t v) {
+  v = htole32(v);
+  memcpy(buf, &v, sizeof(v));
+}
+
+void PutU64(unsigned char *buf, uint64_t v) {
+  v = htole64(v);
+  memcpy(buf, &v, sizeof(v));
+}
+
+uint32_t GetU32(const unsigned char *buf) {
+  uint32_t v;
+  memcpy(&v, buf, sizeof(v));
+  return le32toh(v);
+}
+
+uint64_t GetU64(const unsigned char *buf) {
+  uint64_t v;
+  memcpy(&v, buf, sizeof(v));
+  return le64toh(v);
+}
+
+void EncodeHeader(unsigned char *buf, uint8_t type, uint32_t length,
+                  uint32_t id) {
+  PutU32(buf, PROTO_MAGIC);
+  buf[4] = PROTO_VERSION;
+  buf[5] = type;
+  buf[6] = buf[7] = 0;
+  PutU32(buf + 8, length);
+  PutU32(buf + 12, id);
+}
+
+bool DecodeHeader(const unsigned char *buf, struct FrameHeader *h) {
+  h->magic = GetU32(buf);
+  h->version = buf[4];
+  h->type = buf[5];
+  h->flags = (uint16_t)(buf[6] | buf[7] << 8);
+  h->length = GetU32(buf + 8);
+  h->id = GetU32(buf + 12);
+  return h->magic == PROTO_MAGIC && h->version == PROTO_VERSION &&
+         h->length <= FRAME_MAX_PAYLOAD;
+}
+
+void EncodeRequest(unsigned char *buf, uint32_t id, uint64_t begin,
+                   uint64_t end, uint64_t mod) {
+  EncodeHeader(buf, FRAME_REQUEST, REQUEST_PAYLOAD, id);
+  PutU64(buf + FRAME_HEADER_SIZE, begin);
+  PutU64(buf + FRAME_HEADER_SIZE + 8, end);
+  PutU64(buf + FRAME_HEADER_SIZE + 16, mod);
+}
+
+void EncodeRequestDeadline(unsigned char *buf, uint32_t id, uint64_t begin,
+                           uint64_t end, uint64_t mod, uint64_t budget_us) {
+  EncodeRequest(buf, id, begin, end, mod);
+  PutU32(buf + 8, REQUEST_DEADLINE_PAYLOAD);
+  PutU64(buf + FRAME_HEADER_SIZE + 24, budget_us);
+}
+
+void EncodeReply(unsigned char *buf, uint32_t id, uint64_t value) {
+  EncodeHeader(buf, FRAME_REPLY, REPLY_PAYLOAD, id);
+  PutU64(buf + FRAME_HEADER_SIZE, value);
+}
+
+void EncodeFlaggedReply(unsigned char *buf, uint32_t id, uint16_t flags,
+                        uint64_t value) {
+  EncodeReply(buf, id, value);
+  buf[6] = (unsigned char)(flags & 0xff);
+  buf[7] = (unsigned char)(flags >> 8);
+}
+
+void EncodeReduce(unsigned char *buf, uint32_t id, uint64_t begin,
+                  uint64_t end) {
+  EncodeHeader(buf, FRAME_REDUCE, REDUCE_PAYLOAD, id);
+  PutU64(buf + FRAME_HEADER_SIZE, begin);
+  PutU64(buf + FRAME_HEADER_SIZE + 8, end);
+}
+
+void EncodeReduceReply(unsigned char *buf, uint32_t id,
+                       const struct ReduceResult *r) {
+  EncodeHeader(buf, FRAME_REDUCE_REPLY, REDUCE_REPLY_PAYLOAD, id);
+  unsigned char *p = buf + FRAME_HEADER_SIZE;
+  PutU64(p, r->size);
+  PutU64(p + 8, r->count);
+  PutU64(p + 16, (uint64_t)r->sum);
+  PutU32(p + 24, (uint32_t)r->min);
+  PutU32(p + 28, (uint32_t)r->max);
+}
+
+void DecodeReduceReply(const unsigned char *body, struct ReduceResult *r) {
+  r->size = GetU64(body);
+  r->count = GetU64(body + 8);
+  r->sum = (int64_t)GetU64(body + 16);
+  r->min = (int32_t)GetU32(body + 24);
+  r->max = (int32_t)GetU32(body + 28);
+}
+
+void MergeReduce(struct ReduceResult *a, const struct ReduceResult *b) {
+  a->count += b->count;
+  a->sum += b->sum;
+  if (b->min < a->min)
+    a->min = b->min;
+  if (b->max > a->max)
+    a->max = b->max;
+}
+
+void EncodeCancel(unsigned char *buf, uint32_t id) {
+  EncodeHeader(buf, FRAME_CANCEL, 0, id);
+}
@@ -0,0 +1,133 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Протокол клиента и сервера факториала.
+ *
+ * v1 — голые 24 байта запроса (begin, end, mod) и 8 байт ответа, по
+ * одному запросу на соединение за раз.
+ *
+ * v2 — кадры с заголовком FRAME_HEADER_SIZE байт:
+ *   magic   u32  "FAC2"
+ *   version u8   PROTO_VERSION
+ *   type    u8   enum FrameType
+ *   flags   u16
+ *   length  u32  длина тела после заголовка
+ *   id      u32  номер запроса, ответ приходит с тем же id
+ * Все числа — little-endian. Запросов в полёте на соединении может быть
+ * много, ответы идут в порядке готовности.
+ *
+ * FRAME_CANCEL с id запроса просит бросить его счёт. На каждый запрос
+ * всё равно приходит ровно один ответ: с флагом FRAME_FLAG_CANCELLED,
+ * если счёт прерван, или обычный, если отмена опоздала. Закрытие
+ * соединения клиентом (в том числе shutdown на запись) отменяет все его
+ * запросы — ответов на них уже никто не ждёт.
+ *
+ * Запрос может нести срок: четвёртое число тела — сколько микросекунд
+ * от приёма сервером ответ ещё нужен (0 — срока нет). Запрос, который сервер заведомо
+ * не успеет посчитать или не может взять из-за полной очереди, получает
+ * ответ с FRAME_FLAG_REJECTED, а в значении — через сколько микросекунд
+ * стоит повторить. Запрос, чей срок истёк в очереди, не считается и
+ * получает ответ с FRAME_FLAG_EXPIRED.
+ *
+ * Сервер с шардом данных (server --shard) принимает и FRAME_REDUCE:
+ * begin, end — полуинтервал индексов int32 в шарде (обрезается по его
+ * длине). В ответе FRAME_REDUCE_REPLY сразу всё, что даёт один проход:
+ * длина шарда, число элементов, сумма, минимум и максимум. Пустой
+ * диапазон даёт count 0, min INT32_MAX и max INT32_MIN — нейтральные
+ * для слияния значения. Отвергнутый, отменённый или просроченный
+ * FRAME_REDUCE получает обычный FRAME_REPLY с флагом.
+ *
+ * Сервер определяет версию по первым четырём байтам соединения: magic —
+ * значит v2, иначе это начало запроса v1 (v1-запрос с младшими байтами
+ * begin, совпавшими с magic, будет принят за v2).
+ */
+
+#define PROTO_MAGIC 0x32434146u  // "FAC2"
+#define PROTO_VERSION 2
+#define PROTO_MAGIC_SIZE 4
+
+#define FRAME_HEADER_SIZE 16
+#define FRAME_MAX_PAYLOAD 1024
+
+#define REQUEST_PAYLOAD (3 * sizeof(uint64_t))
+#define REQUEST_DEADLINE_PAYLOAD (4 * sizeof(uint64_t))
+#define REPLY_PAYLOAD sizeof(uint64_t)
+#define REQUEST_FRAME_SIZE (FRAME_HEADER_SIZE + REQUEST_PAYLOAD)
+#define REQUEST_DEADLINE_FRAME_SIZE \
+  (FRAME_HEADER_SIZE + REQUEST_DEADLINE_PAYLOAD)
+#define REPLY_FRAME_SIZE (FRAME_HEADER_SIZE + REPLY_PAYLOAD)
+#define REDUCE_PAYLOAD (2 * sizeof(uint64_t))
+#define REDUCE_REPLY_PAYLOAD 32
+#define REDUCE_FRAME_SIZE (FRAME_HEADER_SIZE + REDUCE_PAYLOAD)
+#define REDUCE_REPLY_FRAME_SIZE (FRAME_HEADER_SIZE + REDUCE_REPLY_PAYLOAD)
+
+enum FrameType {
+  FRAME_REQUEST = 1,  // begin, end, mod[, срок в мкс]
+  FRAME_REPLY = 2,    // begin * ... * end mod mod
+  FRAME_CANCEL = 3,   // без тела; id — отменяемый запрос
+  FRAME_REDUCE = 4,   // begin, end — индексы в шарде
+  FRAME_REDUCE_REPLY = 5,  // struct ReduceResult
+};
+
+// Флаги ответа. Значение в таком ответе — не результат
+#define FRAME_FLAG_CANCELLED 1u  // значение не определено
+#define FRAME_FLAG_REJECTED 2u   // значение — через сколько мкс повторить
+#define FRAME_FLAG_EXPIRED 4u    // значение не определено
+
+// Итог свёртки куска шарда; size — длина всего шарда
+struct ReduceResult {
+  uint64_t size;
+  uint64_t count;
+  int64_t sum;
+  int32_t min;
+  int32_t max;
+};
+
+struct FrameHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint16_t flags;
+  uint32_t length;
+  uint32_t id;
+};
+
+void PutU32(unsigned char *buf, uint32_t v);
+void PutU64(unsigned char *buf, uint64_t v);
+uint32_t GetU32(const unsigned char *buf);
+uint64_t GetU64(const unsigned char *buf);
+
+void EncodeHeader(unsigned char *buf, uint8_t type, uint32_t length,
+                  uint32_t id);
+// false — не наш magic, чужая версия или слишком длинное тело
+bool DecodeHeader(const unsigned char *buf, struct FrameHeader *h);
+
+// Кадр целиком: REQUEST_FRAME_SIZE и REPLY_FRAME_SIZE байт
+void EncodeRequest(unsigned char *buf, uint32_t id, uint64_t begin,
+                   uint64_t end, uint64_t mod);
+// Запрос со сроком: REQUEST_DEADLINE_FRAME_SIZE байт
+void EncodeRequestDeadline(unsigned char *buf, uint32_t id, uint64_t begin,
+                           uint64_t end, uint64_t mod, uint64_t budget_us);
+void EncodeReply(unsigned char *buf, uint32_t id, uint64_t value);
+// Ответ с флагами FRAME_FLAG_*
+void EncodeFlaggedReply(unsigned char *buf, uint32_t id, uint16_t flags,
+                        uint64_t value);
+// Запрос свёртки: REDUCE_FRAME_SIZE байт
+void EncodeReduce(unsigned char *buf, uint32_t id, uint64_t begin,
+                  uint64_t end);
+// Ответ свёртки: REDUCE_REPLY_FRAME_SIZE байт
+void EncodeReduceReply(unsigned char *buf, uint32_t id,
+                       const struct ReduceResult *r);
+// Тело ответа свёртки (после заголовка)
+void DecodeReduceReply(const unsigned char *body, struct ReduceResult *r);
+// Слить b в a (size берётся из a)
+void MergeReduce(struct ReduceResult *a, const struct ReduceResult *b);
+// Кадр отмены: FRAME_HEADER_SIZE байт
+void EncodeCancel(unsigned char *buf, uint32_t id);
+
+#endif  // PROTOCOL_H
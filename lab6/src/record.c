@@ -0,0 +1,66 @@
+#include "record.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// Вызывается под r->lock. Ошибку записи печатаем, но сервер не роняем:
+// трасса вспомогательная
+static void WriteOut(struct Recorder *r) {
+  size_t off = 0;
+  while (off < r->len) {
+    ssize_t n = write(r->fd, r->buf + off, r->len - off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("trace write");
+      break;
+    }
+    off += (size_t)n;
+  }
+  r->len = 0;
+}
+
+int RecorderOpen(struct Recorder *r, const char *path) {
+  r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (r->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  LsMutexInit(&r->lock, "recorder");
+  r->start = NowNs();
+  r->next_conn = 0;
+  TraceEncodeHeader(r->buf);
+  r->len = TRACE_HEADER_SIZE;
+  WriteOut(r);
+  return 0;
+}
+
+uint32_t RecorderConn(struct Recorder *r) {
+  return __atomic_fetch_add(&r->next_conn, 1, __ATOMIC_RELAXED);
+}
+
+void RecorderAdd(struct Recorder *r, uint32_t conn, uint64_t now,
+                 uint64_t begin, uint64_t end, uint64_t mod,
+                 uint64_t budget_us) {
+  struct TraceRecord rec = {now - r->start, conn,
+                            budget_us > UINT32_MAX ? UINT32_MAX
+                                                   : (uint32_t)budget_us,
+                            begin, end, mod};
+  LsLock(&r->lock);
+  if (r->len + TRACE_RECORD_SIZE > sizeof(r->buf))
+    WriteOut(r);
+  TraceEncode(r->buf + r->len, &rec);
+  r->len += TRACE_RECORD_SIZE;
+  LsUnlock(&r->lock);
+}
+
+void RecorderFlush(struct Recorder *r) {
+  LsLock(&r->lock);
+  if (r->len)
+    WriteOut(r);
+  LsUnlock(&r->lock);
+}
@@ -0,0 +1,40 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lockstat.h"
+#include "trace.h"
+
+/*
+ * Запись трассы принятых запросов (server --record, формат в trace.h).
+ *
+ * Один писатель на все сетевые циклы: записи копятся в буфере под
+ * мьютексом и уходят в файл, когда буфер полон или когда цикл
+ * собирается заснуть в epoll_wait (RecorderFlush). Так под нагрузкой
+ * запись стоит одного write на пачку, а в тишине трасса на диске не
+ * отстаёт от сервера — его можно просто убить.
+ */
+
+#define RECORDER_BUF (1024 * TRACE_RECORD_SIZE)
+
+struct Recorder {
+  struct LsMutex lock;
+  int fd;
+  uint64_t start;
+  uint32_t next_conn;
+  unsigned char buf[RECORDER_BUF];
+  size_t len;
+};
+
+// Создать файл трассы заново. -1 — ошибка (уже напечатана)
+int RecorderOpen(struct Recorder *r, const char *path);
+// Номер для нового соединения
+uint32_t RecorderConn(struct Recorder *r);
+void RecorderAdd(struct Recorder *r, uint32_t conn, uint64_t now,
+                 uint64_t begin, uint64_t end, uint64_t mod,
+                 uint64_t budget_us);
+void RecorderFlush(struct Recorder *r);
+
+#endif  // RECORD_H
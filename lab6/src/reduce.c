@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "protocol.h"
+
+/*
+ * Свёртка min/max/sum/count по шардам на нескольких серверах
+ * (server --shard).
+ *
+ * Шарды в файле серверов идут по порядку и вместе образуют один массив:
+ * --begin/--end — полуинтервал индексов в нём. Если диапазон задан, сначала
+ * у всех серверов спрашиваются длины шардов (пустой FRAME_REDUCE), потом
+ * каждому уходит его часть диапазона. Запросы уходят всем серверам
+ * сразу, ответы сливаются по мере прихода.
+ *
+ * Шарды пишет gen_shard: gen_shard --seed 1 --size N --out /tmp/a --parts 2
+ * даёт /tmp/a.0 и /tmp/a.1 — по файлу на server --shard.
+ */
+
+#define MAX_SERVERS 1024
+
+struct Shard {
+  char name[300];
+  int fd;
+  uint64_t begin;  // локальный диапазон запроса
+  uint64_t end;
+  bool answered;
+  struct ReduceResult result;
+};
+
+static void Send(struct Shard *s) {
+  unsigned char frame[REDUCE_FRAME_SIZE];
+  EncodeReduce(frame, 0, s->begin, s->end);
+  if (send(s->fd, frame, sizeof(frame), MSG_NOSIGNAL) !=
+      (ssize_t)sizeof(frame)) {
+    fprintf(stderr, "Send to %s failed\n", s->name);
+    exit(1);
+  }
+  s->answered = false;
+}
+
+// Прочитать ровно len байт. false — сервер закрыл соединение
+static bool ReadAll(int fd, unsigned char *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = recv(fd, buf + got, len - got, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    got += (size_t)n;
+  }
+  return true;
+}
+
+// Один ответ сервера. Занятый сервер просит повторить позже — повторяем
+static void Receive(struct Shard *s) {
+  unsigned char buf[REDUCE_REPLY_FRAME_SIZE];
+  struct FrameHeader h;
+  if (!ReadAll(s->fd, buf, FRAME_HEADER_SIZE) || !DecodeHeader(buf, &h) ||
+      h.length > REDUCE_REPLY_PAYLOAD ||
+      !ReadAll(s->fd, buf + FRAME_HEADER_SIZE, h.length)) {
+    fprintf(stderr, "Bad reply from %s\n", s->name);
+    exit(1);
+  }
+  if (h.type == FRAME_REPLY && (h.flags & FRAME_FLAG_REJECTED) &&
+      h.length == REPLY_PAYLOAD) {
+    usleep((useconds_t)GetU64(buf + FRAME_HEADER_SIZE));
+    Send(s);
+    return;
+  }
+  if (h.type != FRAME_REDUCE_REPLY || h.length != REDUCE_REPLY_PAYLOAD) {
+    fprintf(stderr, "%s does not serve a shard\n", s->name);
+    exit(1);
+  }
+  DecodeReduceReply(buf + FRAME_HEADER_SIZE, &s->result);
+  s->answered = true;
+}
+
+// Отправить всем их диапазоны и дождаться всех ответов
+static void Gather(struct Shard *shards, size_t n) {
+  struct pollfd fds[MAX_SERVERS];
+  for (size_t i = 0; i < n; i++)
+    Send(&shards[i]);
+  size_t left = n;
+  while (left) {
+    for (size_t i = 0; i < n; i++) {
+      fds[i].fd = shards[i].answered ? -1 : shards[i].fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (!fds[i].revents)
+        continue;
+      Receive(&shards[i]);
+      if (shards[i].answered)
+        left--;
+    }
+  }
+}
+
+static size_t ReadShards(const char *path, struct Shard *shards) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  char line[sizeof(shards[0].name)];
+  size_t n = 0;
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#')
+      continue;
+    if (n == MAX_SERVERS) {
+      fprintf(stderr, "More than %d servers in %s\n", MAX_SERVERS, path);
+      exit(1);
+    }
+    snprintf(shards[n].name, sizeof(shards[n].name), "%s", line);
+    shards[n].fd = Connect(line, false);
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+int main(int argc, char **argv) {
+  const char *servers = NULL;
+  const char *op = "all";
+  uint64_t begin = 0, end = UINT64_MAX;
+
+  while (true) {
+    static struct option options[] = {{"servers", required_argument, 0, 0},
+                                      {"op", required_argument, 0, 0},
+                                      {"begin", required_argument, 0, 0},
+                                      {"end", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        servers = optarg;
+        break;
+      case 1:
+        op = optarg;
+        break;
+      case 2:
+        if (!ConvertStringToUI64(optarg, &begin)) {
+          fprintf(stderr, "begin must be a non-negative integer\n");
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ConvertStringToUI64(optarg, &end)) {
+          fprintf(stderr, "end must be a non-negative integer\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  bool all = strcmp(op, "all") == 0;
+  if (!servers || begin > end ||
+      (!all && strcmp(op, "min") && strcmp(op, "max") && strcmp(op, "sum") &&
+       strcmp(op, "count"))) {
+    fprintf(stderr,
+            "Using: %s --servers /path/to/file [--op all|min|max|sum|count] "
+            "[--begin 0] [--end N]\n"
+            "  shards in the file form one array; [begin, end) indexes it\n",
+            argv[0]);
+    return 1;
+  }
+
+  static struct Shard shards[MAX_SERVERS];
+  size_t n = ReadShards(servers, shards);
+  if (n == 0) {
+    fprintf(stderr, "No servers in %s\n", servers);
+    return 1;
+  }
+
+  // Весь массив — каждому весь его шард, длины не нужны
+  for (size_t i = 0; i < n; i++) {
+    shards[i].begin = 0;
+    shards[i].end = begin == 0 && end == UINT64_MAX ? UINT64_MAX : 0;
+  }
+  if (begin != 0 || end != UINT64_MAX) {
+    Gather(shards, n);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t size = shards[i].result.size;
+      uint64_t lo = begin > offset ? begin - offset : 0;
+      uint64_t hi = end - offset < size ? end - offset : size;
+      if (end <= offset)
+        hi = 0;
+      shards[i].begin = lo < hi ? lo : 0;
+      shards[i].end = lo < hi ? hi : 0;
+      offset += size;
+    }
+  }
+  Gather(shards, n);
+
+  struct ReduceResult total = {0, 0, 0, INT32_MAX, INT32_MIN};
+  for (size_t i = 0; i < n; i++) {
+    MergeReduce(&total, &shards[i].result);
+    close(shards[i].fd);
+  }
+
+  if (all || !strcmp(op, "count"))
+    printf("Count: %llu\n", (unsigned long long)total.count);
+  if (all || !strcmp(op, "sum"))
+    printf("Sum: %lld\n", (long long)total.sum);
+  if (total.count == 0 && (all || !strcmp(op, "min") || !strcmp(op, "max"))) {
+    printf("Empty range: no min or max\n");
+    return 0;
+  }
+  if (all || !strcmp(op, "min"))
+    printf("Min: %d\n", total.min);
+  if (all || !strcmp(op, "max"))
+    printf("Max: %d\n", total.max);
+  return 0;
+}
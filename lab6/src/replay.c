@@ -0,0 +1,332 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "common.h"
+#include "hist.h"
+#include "protocol.h"
+#include "trace.h"
+
+/*
+ * Повтор трассы, записанной server --record, против сервера (v2).
+ *
+ * Каждому соединению трассы — своё соединение, запросы в нём идут в
+ * записанном порядке. С --speed X запрос уходит в момент t_ns / X от
+ * начала повтора, и задержка считается от этого момента, как в открытом
+ * цикле loadgen. С --speed 0 — так быстро, как отвечает сервер: на
+ * каждом соединении по одному запросу в полёте, следующий уходит сразу
+ * после ответа, задержка — от отправки.
+ */
+
+#define DRAIN_NS 5000000000ull
+#define MAX_EVENTS 256
+
+struct Conn {
+  struct Stream io;
+  uint32_t *queue;  // номера записей этого соединения по порядку
+  size_t nqueue;
+  size_t next;      // первый ещё не отправленный
+};
+
+static struct TraceRecord *records;
+static size_t nrecords;
+// Назначенное время запроса по номеру записи (он же id кадра); 0 —
+// ответ получен или запрос ещё не ушёл
+static uint64_t *intended;
+
+static struct Hist hist;
+static uint64_t completed, rejected, expired;
+
+static int ByTime(const void *a, const void *b) {
+  const struct TraceRecord *x = a, *y = b;
+  if (x->t_ns != y->t_ns)
+    return x->t_ns < y->t_ns ? -1 : 1;
+  return 0;
+}
+
+static int ByConn(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Разложить записи по соединениям; conn записи становится индексом в conns
+static struct Conn *SplitByConn(size_t *count) {
+  uint32_t *ids = Realloc(NULL, nrecords * sizeof(*ids));
+  for (size_t i = 0; i < nrecords; i++)
+    ids[i] = records[i].conn;
+  qsort(ids, nrecords, sizeof(*ids), ByConn);
+  size_t n = 0;
+  for (size_t i = 0; i < nrecords; i++)
+    if (n == 0 || ids[n - 1] != ids[i])
+      ids[n++] = ids[i];
+
+  struct Conn *conns = calloc(n, sizeof(*conns));
+  if (!conns) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < nrecords; i++) {
+    uint32_t *at = bsearch(&records[i].conn, ids, n, sizeof(*ids), ByConn);
+    records[i].conn = (uint32_t)(at - ids);
+    conns[records[i].conn].nqueue++;
+  }
+  for (size_t c = 0; c < n; c++) {
+    conns[c].queue = Realloc(NULL, conns[c].nqueue * sizeof(uint32_t));
+    conns[c].nqueue = 0;
+  }
+  for (size_t i = 0; i < nrecords; i++) {
+    struct Conn *c = &conns[records[i].conn];
+    c->queue[c->nqueue++] = (uint32_t)i;
+  }
+  free(ids);
+  *count = n;
+  return conns;
+}
+
+// Поставить следующий запрос соединения в его выходной буфер
+static void Issue(struct Conn *c, uint64_t when) {
+  uint32_t id = c->queue[c->next++];
+  const struct TraceRecord *r = &records[id];
+  intended[id] = when;
+  unsigned char *frame = StreamReserve(&c->io, REQUEST_DEADLINE_FRAME_SIZE);
+  if (!r->budget_us) {
+    EncodeRequest(frame, id, r->begin, r->end, r->mod);
+    c->io.out_len += REQUEST_FRAME_SIZE;
+    return;
+  }
+  // Срок считается от назначенного момента, как у сервера — от приёма
+  uint64_t now = NowNs(), budget = (uint64_t)r->budget_us * 1000;
+  uint64_t left = when + budget > now ? when + budget - now : 1000;
+  EncodeRequestDeadline(frame, id, r->begin, r->end, r->mod, left / 1000);
+  c->io.out_len += REQUEST_DEADLINE_FRAME_SIZE;
+}
+
+// Ответ на запрос h.id
+static bool OnReply(const struct FrameHeader *h, uint64_t now, void *ctx) {
+  (void)ctx;
+  if (h->id >= nrecords || !intended[h->id])
+    return false;
+  if (h->flags & FRAME_FLAG_REJECTED)
+    rejected++;
+  else if (h->flags & FRAME_FLAG_EXPIRED)
+    expired++;
+  else
+    HistRecord(&hist, now - intended[h->id]);
+  intended[h->id] = 0;
+  completed++;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *server = NULL;
+  const char *trace = NULL;
+  double speed = 1;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"trace", required_argument, 0, 0},
+                                      {"speed", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        server = optarg;
+        break;
+      case 1:
+        trace = optarg;
+        break;
+      case 2: {
+        char *end;
+        speed = strtod(optarg, &end);
+        if (*end || end == optarg || !(speed >= 0)) {
+          fprintf(stderr, "speed must be a non-negative number\n");
+          return 1;
+        }
+      } break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (!server || !trace) {
+    fprintf(stderr,
+            "Using: %s --server 127.0.0.1:20001 --trace /path/to/trace "
+            "[--speed 1]\n"
+            "  --speed X — X times the recorded rate, 0 — as fast as "
+            "possible\n",
+            argv[0]);
+    return 1;
+  }
+
+  records = TraceLoad(trace, &nrecords);
+  if (!records)
+    return 1;
+  if (nrecords == 0 || nrecords > UINT32_MAX) {
+    fprintf(stderr, "%s: %zu requests, nothing to replay\n", trace, nrecords);
+    return 1;
+  }
+  // Записи разных сетевых циклов могут чуть перемешаться
+  qsort(records, nrecords, sizeof(*records), ByTime);
+  uint64_t recorded_ns = records[nrecords - 1].t_ns - records[0].t_ns;
+  uint64_t base = records[0].t_ns;
+  size_t nconns = 0;
+  struct Conn *conns = SplitByConn(&nconns);
+  intended = calloc(nrecords, sizeof(*intended));
+  if (!intended) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  int epfd = epoll_create1(0);
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (epfd < 0 || tfd < 0) {
+    perror("epoll/timerfd");
+    return 1;
+  }
+  struct epoll_event tev = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &tev);
+  for (size_t i = 0; i < nconns; i++) {
+    conns[i].io.fd = Connect(server, true);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &conns[i]};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].io.fd, &ev);
+  }
+  HistInit(&hist);
+
+  uint64_t start = NowNs();
+  size_t sent = 0;  // для --speed > 0: записи уходят по порядку времени
+  size_t outstanding = 0;
+  uint64_t last_sent = start;
+  if (speed > 0) {
+    ArmTimer(tfd, start);
+  } else {
+    for (size_t i = 0; i < nconns; i++) {
+      Issue(&conns[i], NowNs());
+      StreamFlush(&conns[i].io);
+      StreamWatch(epfd, &conns[i].io, &conns[i]);
+    }
+    sent = outstanding = nconns;
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (sent < nrecords || outstanding > 0) {
+    uint64_t now = NowNs();
+    if (sent == nrecords && now >= last_sent + DRAIN_NS)
+      break;
+    int timeout = sent < nrecords
+                      ? -1
+                      : (int)((last_sent + DRAIN_NS - now) / 1000000 + 1);
+    int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return 1;
+    }
+    for (int i = 0; i < n; i++) {
+      struct Conn *c = events[i].data.ptr;
+      if (!c) {
+        uint64_t ticks;
+        if (read(tfd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+          perror("timerfd");
+        // Всё, чьё время подошло, — сразу, даже если проснулись поздно
+        now = NowNs();
+        uint64_t due = 0;
+        while (sent < nrecords) {
+          const struct TraceRecord *r = &records[sent];
+          due = start + (uint64_t)((double)(r->t_ns - base) / speed);
+          if (due > now)
+            break;
+          Issue(&conns[r->conn], due);
+          sent++;
+          outstanding++;
+        }
+        last_sent = now;
+        for (size_t j = 0; j < nconns; j++) {
+          if (conns[j].io.out_len) {
+            StreamFlush(&conns[j].io);
+            StreamWatch(epfd, &conns[j].io, &conns[j]);
+          }
+        }
+        if (sent < nrecords)
+          ArmTimer(tfd, due);
+        continue;
+      }
+      if (events[i].events & EPOLLOUT)
+        StreamFlush(&c->io);
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        size_t got = StreamReceive(&c->io, OnReply, NULL);
+        outstanding -= got;
+        if (speed == 0 && got && c->next < c->nqueue) {
+          Issue(c, NowNs());
+          StreamFlush(&c->io);
+          sent++;
+          outstanding++;
+          last_sent = NowNs();
+        }
+      }
+      StreamWatch(epfd, &c->io, c);
+    }
+  }
+
+  // Не дождавшиеся ответа — в гистограмму с уже прождённым временем
+  uint64_t end = NowNs();
+  uint64_t unanswered = 0;
+  for (size_t id = 0; id < nrecords; id++) {
+    if (intended[id]) {
+      HistRecord(&hist, end - intended[id]);
+      unanswered++;
+    }
+  }
+
+  double seconds = (double)(end - start) / 1e9;
+  printf("trace: %zu requests, %zu connections, %.3f s recorded\n", nrecords,
+         nconns, (double)recorded_ns / 1e9);
+  if (speed > 0)
+    printf("mode: %.2fx recorded rate, %.3f s\n", speed, seconds);
+  else
+    printf("mode: as fast as possible, %.3f s\n", seconds);
+  printf("requests: %zu sent, %llu completed, %llu unanswered\n", sent,
+         (unsigned long long)completed, (unsigned long long)unanswered);
+  if (rejected || expired)
+    printf("not served: %llu rejected, %llu expired\n",
+           (unsigned long long)rejected, (unsigned long long)expired);
+  printf("throughput: %.1f req/s\n", (double)completed / seconds);
+  printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f  "
+         "mean %.1f\n",
+         Us(HistPercentile(&hist, 50)), Us(HistPercentile(&hist, 90)),
+         Us(HistPercentile(&hist, 99)), Us(HistPercentile(&hist, 99.9)),
+         Us(hist.max), hist.total ? Us(hist.sum / hist.total) : 0.0);
+
+  for (size_t i = 0; i < nconns; i++) {
+    close(conns[i].io.fd);
+    free(conns[i].queue);
+    free(conns[i].io.out);
+  }
+  free(conns);
+  free(intended);
+  free(records);
+  return unanswered ? 2 : 0;
+}
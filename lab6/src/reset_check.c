@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "protocol.h"
+
+/*
+ * Проверка сервера на клиентов, которые сбрасывают соединение, пока
+ * ответы ещё в пути.
+ *
+ * Каждый раунд открывает --connections соединений v2, отправляет в
+ * каждое пачку запросов разной тяжести и после короткой паузы сбрасывает
+ * все разом (SO_LINGER 0 + close шлёт RST). Тогда в одной пачке событий
+ * сервера оказываются и сброс, и готовые ответы тех же соединений,
+ * и ответы пулов на уже закрытые соединения. После всех раундов сервер
+ * должен быть жив и правильно отвечать. Ошибки памяти ловит сервер,
+ * собранный с -fsanitize=address (make check).
+ */
+
+#define PIPELINE 16
+#define MAX_CONNECTIONS 1024
+
+static void Reset(int fd) {
+  struct linger lg = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  close(fd);
+}
+
+static void Round(const char *server, int *fds, size_t connections,
+                  unsigned delay_us) {
+  unsigned char frames[PIPELINE * REQUEST_FRAME_SIZE];
+  for (size_t i = 0; i < connections; i++) {
+    fds[i] = Connect(server, false);
+    for (uint32_t j = 0; j < PIPELINE; j++) {
+      // Половина запросов считается мгновенно, половина — заметно дольше
+      uint64_t end = j % 2 ? 20000 + i * 100 + j : 10 + j;
+      EncodeRequest(frames + j * REQUEST_FRAME_SIZE, j, 1, end, 1000000007);
+    }
+    if (send(fds[i], frames, sizeof(frames), MSG_NOSIGNAL) !=
+        (ssize_t)sizeof(frames)) {
+      perror("send");
+      exit(1);
+    }
+  }
+  if (delay_us)
+    usleep(delay_us);
+  for (size_t i = 0; i < connections; i++)
+    Reset(fds[i]);
+}
+
+// Обычный запрос после всех сбросов: 10! mod 1e9+7
+static bool Alive(const char *server) {
+  int fd = Connect(server, false);
+  unsigned char req[REQUEST_FRAME_SIZE], buf[REPLY_FRAME_SIZE];
+  EncodeRequest(req, 7, 1, 10, 1000000007);
+  if (send(fd, req, sizeof(req), MSG_NOSIGNAL) != (ssize_t)sizeof(req))
+    return false;
+  size_t got = 0;
+  while (got < sizeof(buf)) {
+    ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    got += (size_t)n;
+  }
+  close(fd);
+  struct FrameHeader h;
+  return DecodeHeader(buf, &h) && h.type == FRAME_REPLY && h.id == 7 &&
+         !h.flags && GetU64(buf + FRAME_HEADER_SIZE) == 3628800;
+}
+
+int main(int argc, char **argv) {
+  const char *server = NULL;
+  uint64_t rounds = 50;
+  uint64_t connections = 32;
+
+  while (true) {
+    static struct option options[] = {{"server", required_argument, 0, 0},
+                                      {"rounds", required_argument, 0, 0},
+                                      {"connections", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        server = optarg;
+        break;
+      case 1:
+        if (!ConvertStringToUI64(optarg, &rounds)) {
+          fprintf(stderr, "rounds must be a non-negative integer\n");
+          return 1;
+        }
+        break;
+      case 2:
+        if (!ConvertStringToUI64(optarg, &connections) || !connections ||
+            connections > MAX_CONNECTIONS) {
+          fprintf(stderr, "connections must be in 1..%d\n", MAX_CONNECTIONS);
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (!server) {
+    fprintf(stderr,
+            "Using: %s --server 127.0.0.1:20001 [--rounds 50] "
+            "[--connections 32]\n",
+            argv[0]);
+    return 1;
+  }
+
+  int fds[MAX_CONNECTIONS];
+  for (uint64_t r = 0; r < rounds; r++) {
+    // Паузы разной длины: сброс застаёт ответы в пуле, в буфере
+    // соединения и уже на полпути к клиенту
+    Round(server, fds, connections, (unsigned)(r % 5) * 300);
+  }
+  if (!Alive(server)) {
+    fprintf(stderr, "Server does not answer after %llu rounds of resets\n",
+            (unsigned long long)rounds);
+    return 1;
+  }
+  printf("reset_check: %llu rounds of %llu connections, server alive\n",
+         (unsigned long long)rounds, (unsigned long long)connections);
+  return 0;
+}
@@ -0,0 +1,199 @@
+#include "sched.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+void SchedInit(struct Sched *s, uint64_t k, uint64_t mod, size_t links) {
+  s->k = k;
+  s->mod = mod;
+  s->next = 1;
+  s->chunks = NULL;
+  s->n = s->cap = 0;
+  s->done = 0;
+  s->first_open = 0;
+  s->orphans = 0;
+  s->restored = NULL;
+  s->nrestored = s->restored_cap = s->restored_next = 0;
+  s->restored_numbers = 0;
+  s->links = links;
+  s->answer = 1 % mod;
+}
+
+void SchedFree(struct Sched *s) {
+  free(s->chunks);
+  s->chunks = NULL;
+  free(s->restored);
+  s->restored = NULL;
+}
+
+static void *Grow(void *p, size_t *cap, size_t size) {
+  *cap = *cap ? *cap * 2 : 64;
+  p = realloc(p, *cap * size);
+  if (!p) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+// Перешагнуть посчитанные в прошлый раз отрезки, начинающиеся с next
+static void SkipRestored(struct Sched *s) {
+  while (s->restored_next < s->nrestored &&
+         s->restored[s->restored_next].begin <= s->next) {
+    s->next = s->restored[s->restored_next].end + 1;
+    s->restored_next++;
+  }
+}
+
+bool SchedRestore(struct Sched *s, uint64_t begin, uint64_t end,
+                  uint64_t value) {
+  if (begin == 0 || begin > end || end > s->k || value >= s->mod ||
+      begin < s->next)
+    return false;
+  // Журнал пишется почти по порядку: место ищем с конца
+  size_t i = s->nrestored;
+  while (i > s->restored_next && s->restored[i - 1].begin > begin)
+    i--;
+  if ((i > 0 && s->restored[i - 1].end >= begin) ||
+      (i < s->nrestored && s->restored[i].begin <= end))
+    return false;
+  if (s->nrestored == s->restored_cap)
+    s->restored = Grow(s->restored, &s->restored_cap, sizeof(*s->restored));
+  memmove(&s->restored[i + 1], &s->restored[i],
+          (s->nrestored - i) * sizeof(*s->restored));
+  s->restored[i] = (struct Span){begin, end};
+  s->nrestored++;
+  s->restored_numbers += end - begin + 1;
+  s->answer = MultModulo(s->answer, value, s->mod);
+  SkipRestored(s);
+  return true;
+}
+
+double LinkSpeed(const struct LinkRate *r, uint64_t now) {
+  uint64_t busy = r->busy_ns;
+  if (r->inflight)
+    busy += now - r->busy_since;
+  return r->work && busy ? (double)r->work / (double)busy : 0;
+}
+
+// Длина следующего куска для сервера r
+static uint64_t ChunkLen(const struct Sched *s, const struct LinkRate *r,
+                         uint64_t now) {
+  uint64_t remaining = s->k - s->next + 1;
+  double speed = LinkSpeed(r, now);
+  uint64_t len = speed > 0 ? (uint64_t)(speed * SCHED_TARGET_NS)
+                           : SCHED_FIRST_LEN;
+  // Под конец каждому серверу — не больше половины его доли остатка:
+  // последние куски короткие и заканчиваются почти одновременно
+  uint64_t fair = remaining / (2 * s->links);
+  if (len > fair)
+    len = fair;
+  if (len < SCHED_ALIGN)
+    len = SCHED_ALIGN;
+  return len < remaining ? len : remaining;
+}
+
+static long NewChunk(struct Sched *s, struct LinkRate *r, uint64_t now) {
+  if (s->n == s->cap) {
+    if (s->cap * 2 > UINT32_MAX)
+      return -1;
+    s->chunks = Grow(s->chunks, &s->cap, sizeof(*s->chunks));
+  }
+
+  uint64_t end = s->next + ChunkLen(s, r, now) - 1;
+  // Конец — на границу блока, а слишком короткий остаток — в этот же кусок
+  if (end < s->k && (end + 1) / SCHED_ALIGN * SCHED_ALIGN > s->next)
+    end = (end + 1) / SCHED_ALIGN * SCHED_ALIGN - 1;
+  if (s->k - end < SCHED_ALIGN)
+    end = s->k;
+  // Посчитанное в прошлый раз не повторяем
+  if (s->restored_next < s->nrestored &&
+      end >= s->restored[s->restored_next].begin)
+    end = s->restored[s->restored_next].begin - 1;
+
+  size_t id = s->n++;
+  struct Chunk *c = &s->chunks[id];
+  c->begin = s->next;
+  c->end = end;
+  c->copies = 1;
+  c->done = false;
+  EncodeRequest(c->frame, (uint32_t)id, c->begin, c->end, s->mod);
+  s->next = end + 1;
+  SkipRestored(s);
+  return (long)id;
+}
+
+static long Pick(struct Sched *s, struct LinkRate *r, uint64_t now) {
+  // Брошенный кусок стоит в ответе раньше новых: выдаём его первым
+  for (size_t i = s->first_open; s->orphans && i < s->n; i++) {
+    struct Chunk *c = &s->chunks[i];
+    if (!c->done && c->copies == 0) {
+      c->copies = 1;
+      s->orphans--;
+      return (long)i;
+    }
+  }
+  if (s->next <= s->k)
+    return NewChunk(s, r, now);
+  if (r->inflight)
+    return -1;
+  // Куски выдаются по порядку, поэтому первый незаконченный без копии
+  // и есть самый давно отправленный
+  for (size_t i = s->first_open; i < s->n; i++) {
+    struct Chunk *c = &s->chunks[i];
+    if (!c->done && c->copies == 1) {
+      c->copies++;
+      r->hedges++;
+      return (long)i;
+    }
+  }
+  return -1;
+}
+
+long SchedNext(struct Sched *s, struct LinkRate *r, uint64_t now) {
+  long id = Pick(s, r, now);
+  if (id >= 0 && r->inflight++ == 0)
+    r->busy_since = now;
+  return id;
+}
+
+bool SchedComplete(struct Sched *s, uint32_t id, uint64_t value,
+                   struct LinkRate *r, uint64_t now) {
+  struct Chunk *c = &s->chunks[id];
+  c->copies--;
+
+  // Скорость сервера меряем и по проигравшим копиям: работу он сделал
+  uint64_t len = c->end - c->begin + 1;
+  r->work += len;
+  if (--r->inflight == 0)
+    r->busy_ns += now - r->busy_since;
+
+  if (c->done)
+    return false;
+  c->done = true;
+  s->done++;
+  s->answer = MultModulo(s->answer, value, s->mod);
+  r->numbers += len;
+  r->chunks++;
+  while (s->first_open < s->n && s->chunks[s->first_open].done)
+    s->first_open++;
+  return true;
+}
+
+void SchedAbandon(struct Sched *s, uint32_t id, struct LinkRate *r,
+                  uint64_t now) {
+  struct Chunk *c = &s->chunks[id];
+  if (--c->copies == 0 && !c->done)
+    s->orphans++;
+  // Недосчитанное в скорость не идёт, а время занятости — идёт: сервер
+  // был занят и этим
+  if (--r->inflight == 0)
+    r->busy_ns += now - r->busy_since;
+}
+
+bool SchedFinished(const struct Sched *s) {
+  return s->next > s->k && s->done == s->n;
+}
@@ -0,0 +1,108 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/*
+ * Динамическое распределение [1, k] между серверами (клиент).
+ *
+ * Диапазон режется на куски по ходу работы: каждый сервер держит
+ * несколько кусков в полёте и, ответив на один, получает следующий.
+ * Длина куска подстраивается под измеренную скорость сервера так, чтобы
+ * кусок считался около SCHED_TARGET_NS, но к концу диапазона куски
+ * мельчают, чтобы все серверы закончили примерно вместе.
+ *
+ * Когда новых чисел не осталось, простаивающий сервер получает копию
+ * самого давно отправленного незаконченного куска (хедж): кто ответит
+ * первым, тот и засчитан, а копию у второго клиент отменяет.
+ *
+ * Кусок, от которого сервер отказался (очередь полна или истёк срок) и
+ * у которого не осталось копий, выдаётся снова раньше новых чисел.
+ *
+ * Куски, посчитанные в прошлый запуск (journal.h), передаются в
+ * SchedRestore до начала работы: новые куски их обходят.
+ */
+
+// Границы кусков кратны блоку coalescer'а и кэша сервера
+#define SCHED_ALIGN (1ull << 16)
+#define SCHED_TARGET_NS 50000000ull
+// Пока скорость сервера неизвестна, куски берутся такой длины
+#define SCHED_FIRST_LEN (1ull << 20)
+
+struct Chunk {
+  uint64_t begin;
+  uint64_t end;
+  int copies;        // на скольких серверах кусок сейчас в работе
+  bool done;
+  unsigned char frame[REQUEST_FRAME_SIZE];  // id кадра — номер куска
+};
+
+// Что планировщик знает об одном сервере. Скорость — посчитанные
+// числа (включая проигравшие копии) на время, когда у сервера была
+// работа: простой и пачки ответов, пришедшие разом, её не искажают
+struct LinkRate {
+  uint64_t work;        // чисел посчитано сервером
+  uint64_t busy_ns;     // суммарное время с кусками в полёте
+  uint64_t busy_since;  // начало текущего такого отрезка
+  size_t inflight;
+  uint64_t numbers;  // засчитанных чисел
+  size_t chunks;
+  size_t hedges;  // отправлено копий чужих кусков
+  size_t wins;    // из них засчитано
+};
+
+// Отрезок [begin, end], уже посчитанный в прошлый запуск
+struct Span {
+  uint64_t begin;
+  uint64_t end;
+};
+
+struct Sched {
+  uint64_t k;
+  uint64_t mod;
+  uint64_t next;  // первое ещё не выданное число
+  struct Chunk *chunks;
+  size_t n;
+  size_t cap;
+  size_t done;
+  size_t first_open;  // все куски левее уже посчитаны
+  size_t orphans;     // незасчитанных кусков без копий в работе
+  struct Span *restored;  // по возрастанию, без пересечений
+  size_t nrestored;
+  size_t restored_cap;
+  size_t restored_next;  // первый отрезок правее next
+  uint64_t restored_numbers;
+  size_t links;
+  uint64_t answer;
+};
+
+void SchedInit(struct Sched *s, uint64_t k, uint64_t mod, size_t links);
+void SchedFree(struct Sched *s);
+
+// Номер куска для сервера r или -1, если давать нечего. Хедж
+// достаётся только серверу без кусков в работе.
+long SchedNext(struct Sched *s, struct LinkRate *r, uint64_t now);
+
+// Чисел в наносекунду; 0 — пока неизвестно
+double LinkSpeed(const struct LinkRate *r, uint64_t now);
+
+// Пришёл ответ на кусок id. false — кусок уже был засчитан
+bool SchedComplete(struct Sched *s, uint32_t id, uint64_t value,
+                   struct LinkRate *r, uint64_t now);
+// Копия куска id снята с сервера r без ответа (отменена или отвергнута)
+void SchedAbandon(struct Sched *s, uint32_t id, struct LinkRate *r,
+                  uint64_t now);
+
+// Отрезок из журнала: произведение уже известно. Только до первого
+// SchedNext. false — отрезок вне [1, k], пересекает прежние или value
+// не меньше mod
+bool SchedRestore(struct Sched *s, uint64_t begin, uint64_t end,
+                  uint64_t value);
+
+bool SchedFinished(const struct Sched *s);
+
+#endif  // SCHED_H
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np
+
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -9,51 +11,263 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/types.h>
 
 #include "pthread.h"
+#include "admit.h"
+#include "cache.h"
+#include "coalesce.h"
+#include "common.h"
+#include "compute.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "pool.h"
+#include "protocol.h"
+#include "record.h"
+#include "shard.h"
+#include "shm_ring.h"
+
+#define DEFAULT_CACHE_MB 64
+
+// Общая для всех клиентов таблица считающихся сейчас блоков
+static struct Coalescer coalescer;
+
+// Уже посчитанные блоки; работает под мьютексом coalescer'а
+static struct RangeCache cache;
+
+// Долгоживущие рабочие потоки: на запрос потоки больше не создаются
+static struct Pool pool;
+
+// Очередь пула одна на все сетевые циклы — и допуск в неё тоже
+static struct Admission admission;
+
+// Трасса запросов (--record); recording — открыта ли она
+static struct Recorder recorder;
+static bool recording;
+
+// Данные для свёрток (--shard)
+static struct Shard shard;
+
+// Запрос клиента; выполняется в рабочем потоке пула
+static uint64_t HandleRequest(uint64_t begin, uint64_t end, uint64_t mod,
+                              const bool *cancel, void *ctx) {
+  (void)ctx;
+  return CoalescedProduct(&coalescer, begin, end, mod,
+                          UsePrimeEngine(begin, end), cancel, ComputeRanges,
+                          &pool);
+}
+
+// Кадр FRAME_REDUCE; выполняется в рабочем потоке пула
+static void HandleReduce(uint64_t begin, uint64_t end, const bool *cancel,
+                         struct ReduceResult *out, void *ctx) {
+  ShardReduce(ctx, begin, end, cancel, out);
+}
 
-struct FactorialArgs {
-  uint64_t begin;
-  uint64_t end;
-  uint64_t mod;
+// Метрики потоков плюс счётчики coalescer'а и кэша
+static void Report(FILE *f, void *ctx) {
+  (void)ctx;
+  MetricsDump(f);
+  LsLock(&coalescer.lock);
+  uint64_t computed = coalescer.computed, shared = coalescer.shared;
+  uint64_t abandoned = coalescer.abandoned;
+  uint64_t hits = cache.hits, misses = cache.misses;
+  uint64_t evictions = cache.evictions;
+  size_t used = cache.used;
+  LsUnlock(&coalescer.lock);
+  fprintf(f, "blocks_computed %llu\n", (unsigned long long)computed);
+  fprintf(f, "blocks_shared %llu\n", (unsigned long long)shared);
+  fprintf(f, "blocks_abandoned %llu\n", (unsigned long long)abandoned);
+  fprintf(f, "cache_hits %llu\n", (unsigned long long)hits);
+  fprintf(f, "cache_misses %llu\n", (unsigned long long)misses);
+  fprintf(f, "cache_evictions %llu\n", (unsigned long long)evictions);
+  fprintf(f, "cache_blocks %zu\n", used);
+  fprintf(f, "cache_capacity %zu\n", cache.capacity);
+  size_t pending;
+  double ns_per_number;
+  AdmissionStats(&admission, &pending, &ns_per_number);
+  fprintf(f, "queue_pending %zu\n", pending);
+  fprintf(f, "ns_per_number %.3f\n", ns_per_number);
+  if (shard.pool)
+    fprintf(f, "shard_elements %zu\n", shard.size);
+  fflush(f);
+}
+
+// Сетевой цикл со своим слушающим сокетом. С SO_REUSEPORT у каждого
+// цикла свой сокет на одном порту, и соединения между ними раздаёт
+// ядро — общей очереди accept и блокировки на ней нет
+struct Acceptor {
+  struct Loop loop;
+  pthread_t thread;
+  int cpu;  // -1 — не привязывать
 };
 
-uint64_t MultModulo(uint64_t a, uint64_t b, uint64_t mod) {
-  uint64_t result = 0;
-  a = a % mod;
-  while (b > 0) {
-    if (b % 2 == 1)
-      result = (result + a) % mod;
-    a = (a * 2) % mod;
-    b /= 2;
+static void *RunAcceptor(void *arg) {
+  struct Acceptor *a = arg;
+  if (a->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(a->cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err)
+      fprintf(stderr, "Can not pin acceptor to CPU %d: %s\n", a->cpu,
+              strerror(err));
   }
-
-  return result % mod;
+  LoopRun(&a->loop);
+  return NULL;
 }
 
-uint64_t Factorial(const struct FactorialArgs *args) {
-  uint64_t ans = 1;
+// Запросы клиента на этой же машине через разделяемую память. Поток
+// канала считает запросы по одному прямо у себя: CoalescedProduct и так
+// раздаёт блоки запроса рабочим пула, а следующие запросы тем временем
+// ждут в кольце
+static void *ServeShm(void *arg) {
+  struct ShmChannel *ch = arg;
+  // Все клиенты канала в трассе — одно соединение: в полёте у них
+  // всё равно один конвейер
+  uint32_t trace_id = recording ? RecorderConn(&recorder) : 0;
+  while (true) {
+    const unsigned char *frame = ShmPeek(&ch->req);
+    if (!frame) {
+      if (recording)
+        RecorderFlush(&recorder);
+      ShmWait(&ch->req, -1);
+      continue;
+    }
+    uint64_t received = NowNs();
+    MetricAdd(M_BYTES_IN, REQUEST_FRAME_SIZE);
+    // На каждый запрос — ровно один ответ (см. ShmAttach). На мусор
+    // отвечаем нулевым кадром, который клиент не разберёт
+    unsigned char reply[REPLY_FRAME_SIZE] = {0};
+    struct FrameHeader h;
+    if (DecodeHeader(frame, &h) && h.type == FRAME_REQUEST &&
+        h.length == REQUEST_PAYLOAD) {
+      const unsigned char *p = frame + FRAME_HEADER_SIZE;
+      uint64_t begin = GetU64(p), end = GetU64(p + 8), mod = GetU64(p + 16);
+      bool logged = MetricsSampleLog();
+      MetricAdd(M_REQUESTS, 1);
+      if (recording)
+        RecorderAdd(&recorder, trace_id, received, begin, end, mod, 0);
+      if (logged)
+        printf("Receive: %llu %llu %llu\n", (unsigned long long)begin,
+               (unsigned long long)end, (unsigned long long)mod);
+      uint64_t value = HandleRequest(begin, end, mod, NULL, NULL);
+      MetricRecord(H_COMPUTE, NowNs() - received);
+      if (logged) {
+        printf("Total: %llu\n", (unsigned long long)value);
+        fflush(stdout);
+      }
+      EncodeReply(reply, h.id, value);
+    } else {
+      fprintf(stderr, "Client send wrong data format\n");
+      MetricAdd(M_BAD_FRAMES, 1);
+    }
+    // Больше SHM_SLOTS запросов в полёте клиент не держит, так что
+    // место для ответа есть всегда; ждём, только если клиент нарушил это
+    while (!ShmPush(&ch->rep, reply, sizeof(reply)))
+      usleep(1000);
+    ShmRelease(&ch->req);
+    MetricAdd(M_REPLIES, 1);
+    MetricAdd(M_BYTES_OUT, REPLY_FRAME_SIZE);
+    MetricRecord(H_LATENCY, NowNs() - received);
+  }
+  return NULL;
+}
 
-  // TODO: your code here
+// Слушающий сокет AF_UNIX: для клиента на этой же машине минует TCP
+static int OpenUnixListener(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
 
-  return ans;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Can not create server socket!\n");
+    return -1;
+  }
+  // Сокет от прошлого запуска
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Can not bind to %s!\n", path);
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, SOMAXCONN) < 0) {
+    fprintf(stderr, "Could not listen on socket\n");
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
-void *ThreadFactorial(void *args) {
-  struct FactorialArgs *fargs = (struct FactorialArgs *)args;
-  return (void *)(uint64_t *)Factorial(fargs);
+static int OpenListener(int port, bool reuse_port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Can not create server socket!\n");
+    return -1;
+  }
+
+  struct sockaddr_in server;
+  server.sin_family = AF_INET;
+  server.sin_port = htons((uint16_t)port);
+  server.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  int opt_val = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+  if (reuse_port &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt_val, sizeof(opt_val)) < 0) {
+    perror("SO_REUSEPORT");
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+    fprintf(stderr, "Can not bind to port %d!\n", port);
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, SOMAXCONN) < 0) {
+    fprintf(stderr, "Could not listen on socket\n");
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
 int main(int argc, char **argv) {
   int tnum = -1;
   int port = -1;
+  long cache_mb = DEFAULT_CACHE_MB;
+  int stats_port = -1;
+  long log_every = 0;
+  int acceptors = 1;
+  bool pin = false;
+  const char *unix_path = NULL;
+  const char *shm_name = NULL;
+  long max_queue = ADMIT_DEFAULT_LIMIT;
+  const char *record_path = NULL;
+  const char *shard_path = NULL;
 
   while (true) {
     int current_optind = optind ? optind : 1;
 
     static struct option options[] = {{"port", required_argument, 0, 0},
                                       {"tnum", required_argument, 0, 0},
+                                      {"cache-mb", required_argument, 0, 0},
+                                      {"stats-port", required_argument, 0, 0},
+                                      {"log-every", required_argument, 0, 0},
+                                      {"acceptors", required_argument, 0, 0},
+                                      {"pin", no_argument, 0, 0},
+                                      {"unix", required_argument, 0, 0},
+                                      {"shm", required_argument, 0, 0},
+                                      {"max-queue", required_argument, 0, 0},
+                                      {"record", required_argument, 0, 0},
+                                      {"shard", required_argument, 0, 0},
                                       {0, 0, 0, 0}};
 
     int option_index = 0;
@@ -73,6 +287,60 @@ int main(int argc, char **argv) {
         tnum = atoi(optarg);
         // TODO: your code here
         break;
+      case 2:
+        cache_mb = atol(optarg);
+        if (cache_mb < 0) {
+          fprintf(stderr, "cache-mb must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 3:
+        stats_port = atoi(optarg);
+        if (stats_port < 1 || stats_port > 65535) {
+          fprintf(stderr, "stats-port must be in 1..65535\n");
+          return 1;
+        }
+        break;
+      case 4:
+        log_every = atol(optarg);
+        if (log_every < 0) {
+          fprintf(stderr, "log-every must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 5:
+        acceptors = atoi(optarg);
+        if (acceptors <= 0) {
+          fprintf(stderr, "acceptors must be positive\n");
+          return 1;
+        }
+        break;
+      case 6:
+        pin = true;
+        break;
+      case 7:
+        unix_path = optarg;
+        break;
+      case 8:
+        shm_name = optarg;
+        if (shm_name[0] != '/') {
+          fprintf(stderr, "shm name must start with /\n");
+          return 1;
+        }
+        break;
+      case 9:
+        max_queue = atol(optarg);
+        if (max_queue < 0) {
+          fprintf(stderr, "max-queue must be non-negative\n");
+          return 1;
+        }
+        break;
+      case 10:
+        record_path = optarg;
+        break;
+      case 11:
+        shard_path = optarg;
+        break;
       default:
         printf("Index %d is out of options\n", option_index);
       }
@@ -86,111 +354,108 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (port == -1 || tnum == -1) {
-    fprintf(stderr, "Using: %s --port 20001 --tnum 4\n", argv[0]);
+  if (port == -1 || tnum <= 0) {
+    fprintf(stderr,
+            "Using: %s --port 20001 --tnum 4 [--cache-mb %d] "
+            "[--stats-port 20002] [--log-every N] [--acceptors N [--pin]] "
+            "[--unix /path] [--shm /name] [--max-queue %d] "
+            "[--record /path] [--shard /path]\n"
+            "  --log-every N  log every N-th request (default 0: none)\n"
+            "  --acceptors N  N event loops on one port via SO_REUSEPORT\n"
+            "  --pin          pin event loop i to CPU i\n"
+            "  --unix /path   also listen on an AF_UNIX socket\n"
+            "  --shm /name    also serve one local client via shared memory\n"
+            "  --max-queue N  queued requests before rejecting (0: no limit)\n"
+            "  --record /path write every request to a trace for replay\n"
+            "  --shard /path  serve min/max/sum/count over an int32 file\n"
+            "  kill -USR1 <pid> dumps stats to stdout\n",
+            argv[0], DEFAULT_CACHE_MB, ADMIT_DEFAULT_LIMIT);
     return 1;
   }
 
-  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd < 0) {
-    fprintf(stderr, "Can not create server socket!");
+  // SIGUSR1 читает сетевой цикл через signalfd; маску наследуют все
+  // потоки, созданные дальше
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+
+  // Сокет AF_UNIX обслуживает ещё один сетевой цикл, последний
+  int loops = acceptors + (unix_path != NULL);
+  struct Acceptor *acc = calloc((size_t)loops, sizeof(*acc));
+  int *listen_fds = calloc((size_t)loops, sizeof(*listen_fds));
+  if (!acc || !listen_fds) {
+    fprintf(stderr, "Out of memory\n");
     return 1;
   }
+  for (int i = 0; i < acceptors; i++) {
+    listen_fds[i] = OpenListener(port, acceptors > 1);
+    if (listen_fds[i] < 0)
+      return 1;
+  }
+  if (unix_path && (listen_fds[acceptors] = OpenUnixListener(unix_path)) < 0)
+    return 1;
+  struct ShmChannel *shm = NULL;
+  if (shm_name && !(shm = ShmCreate(shm_name)))
+    return 1;
+  int stats_fd = -1;
+  if (stats_port != -1 && (stats_fd = OpenListener(stats_port, false)) < 0)
+    return 1;
 
-  struct sockaddr_in server;
-  server.sin_family = AF_INET;
-  server.sin_port = htons((uint16_t)port);
-  server.sin_addr.s_addr = htonl(INADDR_ANY);
-
-  int opt_val = 1;
-  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
-
-  int err = bind(server_fd, (struct sockaddr *)&server, sizeof(server));
-  if (err < 0) {
-    fprintf(stderr, "Can not bind to socket!");
+  if (RangeCacheInit(&cache, (size_t)cache_mb << 20) != 0) {
+    fprintf(stderr, "Can not allocate %ld MiB for cache\n", cache_mb);
     return 1;
   }
-
-  err = listen(server_fd, 128);
-  if (err < 0) {
-    fprintf(stderr, "Could not listen on socket\n");
+  CoalescerInit(&coalescer, &cache);
+  MetricsSetLogEvery((uint64_t)log_every);
+  AdmissionInit(&admission, (size_t)max_queue);
+  if (record_path) {
+    if (RecorderOpen(&recorder, record_path) != 0)
+      return 1;
+    recording = true;
+  }
+  if (shard_path && ShardOpen(&shard, shard_path, &pool) != 0)
+    return 1;
+  // Сетевой цикл сам не считает: все --tnum потоков — рабочие пула
+  if (PoolInit(&pool, tnum) != 0) {
+    fprintf(stderr, "Can not start worker pool\n");
     return 1;
   }
 
-  printf("Server listening at %d\n", port);
-
-  while (true) {
-    struct sockaddr_in client;
-    socklen_t client_len = sizeof(client);
-    int client_fd = accept(server_fd, (struct sockaddr *)&client, &client_len);
-
-    if (client_fd < 0) {
-      fprintf(stderr, "Could not establish new connection\n");
-      continue;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int i = 0; i < loops; i++) {
+    acc[i].cpu = pin ? (int)(i % (ncpu > 0 ? ncpu : 1)) : -1;
+    if (LoopInit(&acc[i].loop, listen_fds[i], &pool, HandleRequest, NULL) !=
+        0) {
+      fprintf(stderr, "Can not start event loop\n");
+      return 1;
     }
+    LoopSetAdmission(&acc[i].loop, &admission);
+    if (recording)
+      LoopSetRecorder(&acc[i].loop, &recorder);
+    if (shard_path)
+      LoopSetReduce(&acc[i].loop, HandleReduce, &shard);
+  }
+  // Статистику и SIGUSR1 обслуживает первый цикл
+  if (LoopEnableStats(&acc[0].loop, stats_fd, Report, NULL) != 0) {
+    fprintf(stderr, "Can not start stats\n");
+    return 1;
+  }
+  printf("Server listening at %d\n", port);
+  fflush(stdout);
 
-    while (true) {
-      unsigned int buffer_size = sizeof(uint64_t) * 3;
-      char from_client[buffer_size];
-      int read = recv(client_fd, from_client, buffer_size, 0);
-
-      if (!read)
-        break;
-      if (read < 0) {
-        fprintf(stderr, "Client read failed\n");
-        break;
-      }
-      if (read < buffer_size) {
-        fprintf(stderr, "Client send wrong data format\n");
-        break;
-      }
-
-      pthread_t threads[tnum];
-
-      uint64_t begin = 0;
-      uint64_t end = 0;
-      uint64_t mod = 0;
-      memcpy(&begin, from_client, sizeof(uint64_t));
-      memcpy(&end, from_client + sizeof(uint64_t), sizeof(uint64_t));
-      memcpy(&mod, from_client + 2 * sizeof(uint64_t), sizeof(uint64_t));
-
-      fprintf(stdout, "Receive: %llu %llu %llu\n", begin, end, mod);
-
-      struct FactorialArgs args[tnum];
-      for (uint32_t i = 0; i < tnum; i++) {
-        // TODO: parallel somehow
-        args[i].begin = 1;
-        args[i].end = 1;
-        args[i].mod = mod;
-
-        if (pthread_create(&threads[i], NULL, ThreadFactorial,
-                           (void *)&args[i])) {
-          printf("Error: pthread_create failed!\n");
-          return 1;
-        }
-      }
-
-      uint64_t total = 1;
-      for (uint32_t i = 0; i < tnum; i++) {
-        uint64_t result = 0;
-        pthread_join(threads[i], (void **)&result);
-        total = MultModulo(total, result, mod);
-      }
-
-      printf("Total: %llu\n", total);
-
-      char buffer[sizeof(total)];
-      memcpy(buffer, &total, sizeof(total));
-      err = send(client_fd, buffer, sizeof(total), 0);
-      if (err < 0) {
-        fprintf(stderr, "Can't send data to client\n");
-        break;
-      }
+  for (int i = 1; i < loops; i++) {
+    if (pthread_create(&acc[i].thread, NULL, RunAcceptor, &acc[i])) {
+      fprintf(stderr, "Error: pthread_create failed for acceptor %d\n", i);
+      return 1;
     }
-
-    shutdown(client_fd, SHUT_RDWR);
-    close(client_fd);
   }
+  pthread_t shm_thread;
+  if (shm && pthread_create(&shm_thread, NULL, ServeShm, shm)) {
+    fprintf(stderr, "Error: pthread_create failed for shm channel\n");
+    return 1;
+  }
+  RunAcceptor(&acc[0]);
 
-  return 0;
+  return 1;
 }
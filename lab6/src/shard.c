@@ -0,0 +1,107 @@
+#include "shard.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "coalesce.h"
+
+int ShardOpen(struct Shard *s, const char *path, struct Pool *pool) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  if (st.st_size % (off_t)sizeof(int32_t)) {
+    fprintf(stderr, "%s: size is not a multiple of 4 bytes\n", path);
+    close(fd);
+    return -1;
+  }
+  s->size = (size_t)st.st_size / sizeof(int32_t);
+  s->pool = pool;
+  s->data = NULL;
+  if (s->size) {
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return -1;
+    }
+    // Проход всегда последовательный
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    s->data = p;
+  }
+  close(fd);
+  return 0;
+}
+
+static void Empty(struct ReduceResult *r, uint64_t size) {
+  r->size = size;
+  r->count = 0;
+  r->sum = 0;
+  r->min = INT32_MAX;
+  r->max = INT32_MIN;
+}
+
+struct ReducePlan {
+  const int32_t *data;
+  uint64_t begin;
+  uint64_t end;
+  const bool *cancel;
+  struct ReduceResult *parts;
+};
+
+// Один проход на все четыре свёртки: шард читается из памяти один раз
+static void RunReduceTask(size_t index, void *arg) {
+  struct ReducePlan *plan = arg;
+  struct ReduceResult *r = &plan->parts[index];
+  Empty(r, 0);
+  if (Cancelled(plan->cancel))
+    return;
+  uint64_t lo = plan->begin + (uint64_t)index * SHARD_TASK_ELEMS;
+  uint64_t hi = plan->end - lo < SHARD_TASK_ELEMS ? plan->end
+                                                  : lo + SHARD_TASK_ELEMS;
+  int64_t sum = 0;
+  int32_t min = INT32_MAX, max = INT32_MIN;
+  for (uint64_t i = lo; i < hi; i++) {
+    int32_t v = plan->data[i];
+    sum += v;
+    min = v < min ? v : min;
+    max = v > max ? v : max;
+  }
+  r->count = hi - lo;
+  r->sum = sum;
+  r->min = min;
+  r->max = max;
+}
+
+void ShardReduce(struct Shard *s, uint64_t begin, uint64_t end,
+                 const bool *cancel, struct ReduceResult *out) {
+  Empty(out, s->size);
+  if (end > s->size)
+    end = s->size;
+  if (begin >= end)
+    return;
+  size_t ntasks = (size_t)((end - begin + SHARD_TASK_ELEMS - 1) /
+                           SHARD_TASK_ELEMS);
+  struct ReduceResult *parts = malloc(ntasks * sizeof(*parts));
+  if (!parts) {
+    perror("malloc");
+    exit(1);
+  }
+  struct ReducePlan plan = {s->data, begin, end, cancel, parts};
+  PoolRun(s->pool, RunReduceTask, &plan, ntasks);
+  for (size_t i = 0; i < ntasks; i++)
+    MergeReduce(out, &parts[i]);
+  free(parts);
+}
@@ -0,0 +1,40 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+#include "protocol.h"
+
+/*
+ * Локальный шард данных для свёрток (server --shard).
+ *
+ * Файл — просто массив int32 в порядке байт машины; gen_shard пишет в
+ * него массив GenerateArray из lab3/lab4 и режет его на шарды по
+ * серверам. Файл отображается в память только для чтения: страницы
+ * подгружает ядро, а несколько серверов на одной машине делят одну
+ * копию в page cache.
+ *
+ * Свёртка диапазона режется на куски по SHARD_TASK_ELEMS и идёт через
+ * PoolRun, как пачки факториала (compute.h): длинный запрос занимает
+ * все рабочие потоки и проверяет отмену между кусками.
+ */
+
+#define SHARD_TASK_ELEMS (1u << 22)
+
+struct Shard {
+  const int32_t *data;
+  size_t size;  // элементов
+  struct Pool *pool;
+};
+
+// -1 — ошибка (уже напечатана)
+int ShardOpen(struct Shard *s, const char *path, struct Pool *pool);
+// Свёртка [begin, end) ∩ [0, size). Когда взведён *cancel, результат
+// не определён
+void ShardReduce(struct Shard *s, uint64_t begin, uint64_t end,
+                 const bool *cancel, struct ReduceResult *out);
+
+#endif  // SHARD_H
@@ -0,0 +1,198 @@
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SHM_MAGIC 0x314D4853u  // "SHM1"
+#define SLOT_MASK (SHM_SLOTS - 1)
+
+// Ждём сервер, пока он досчитывает запросы прежнего клиента
+#define DRAIN_POLL_MS 100
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define LOAD(x, o) __atomic_load_n(&(x), (o))
+#define STORE(x, v, o) __atomic_store_n(&(x), (v), (o))
+
+// Слово futex лежит в общей памяти двух процессов, поэтому без
+// FUTEX_PRIVATE_FLAG
+static void FutexWait(uint32_t *addr, uint32_t val, int timeout_ms) {
+  struct timespec ts, *tp = NULL;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    tp = &ts;
+  }
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, tp, NULL, 0);
+}
+
+static void FutexWake(uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static bool Alive(int32_t pid) {
+  return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+static struct ShmChannel *Map(int fd) {
+  void *p = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+  return p;
+}
+
+struct ShmChannel *ShmCreate(const char *name) {
+  // Объект от прошлого запуска мог остаться с чужим клиентом внутри
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    perror(name);
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(struct ShmChannel)) < 0) {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  struct ShmChannel *ch = Map(fd);
+  if (!ch) {
+    shm_unlink(name);
+    return NULL;
+  }
+  // ftruncate уже обнулил память; magic — последним
+  STORE(ch->server, (int32_t)getpid(), __ATOMIC_RELAXED);
+  STORE(ch->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  return ch;
+}
+
+struct ShmChannel *ShmAttach(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    perror(name);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct ShmChannel)) {
+    fprintf(stderr, "%s: not a factorial channel\n", name);
+    close(fd);
+    return NULL;
+  }
+  struct ShmChannel *ch = Map(fd);
+  if (!ch)
+    return NULL;
+  if (LOAD(ch->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+    fprintf(stderr, "%s: not a factorial channel\n", name);
+    munmap(ch, sizeof(*ch));
+    return NULL;
+  }
+
+  int32_t self = (int32_t)getpid();
+  int32_t cur = 0;
+  while (!__atomic_compare_exchange_n(&ch->owner, &cur, self, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    if (Alive(cur)) {
+      fprintf(stderr, "%s: busy with client %d\n", name, (int)cur);
+      munmap(ch, sizeof(*ch));
+      return NULL;
+    }
+  }
+
+  // На каждый запрос сервер отвечает ровно одним ответом: когда ответов
+  // столько же, сколько запросов, старых кадров в пути больше нет
+  uint32_t sent = LOAD(ch->req.tail, __ATOMIC_ACQUIRE);
+  while (true) {
+    uint32_t replied = LOAD(ch->rep.tail, __ATOMIC_ACQUIRE);
+    STORE(ch->rep.head, replied, __ATOMIC_RELEASE);
+    if (replied == sent)
+      break;
+    if (!ShmServerAlive(ch)) {
+      fprintf(stderr, "%s: server is gone\n", name);
+      ShmDetach(ch);
+      return NULL;
+    }
+    ShmWait(&ch->rep, DRAIN_POLL_MS);
+  }
+  return ch;
+}
+
+void ShmDetach(struct ShmChannel *ch) {
+  STORE(ch->owner, 0, __ATOMIC_RELEASE);
+  munmap(ch, sizeof(*ch));
+}
+
+bool ShmServerAlive(const struct ShmChannel *ch) {
+  return Alive(LOAD(ch->server, __ATOMIC_RELAXED));
+}
+
+bool ShmPush(struct ShmRing *r, const void *frame, size_t len) {
+  uint32_t t = LOAD(r->tail, __ATOMIC_RELAXED);
+  if (t - LOAD(r->head, __ATOMIC_ACQUIRE) == SHM_SLOTS)
+    return false;
+  memcpy(r->slots[t & SLOT_MASK], frame, len);
+  STORE(r->tail, t + 1, __ATOMIC_RELEASE);
+  // Пара к барьеру в ShmWait: либо читатель увидит новый tail, либо мы
+  // увидим его флаг
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (LOAD(r->waiting, __ATOMIC_RELAXED))
+    FutexWake(&r->tail);
+  return true;
+}
+
+const unsigned char *ShmPeek(struct ShmRing *r) {
+  uint32_t h = LOAD(r->head, __ATOMIC_RELAXED);
+  if (h == LOAD(r->tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return r->slots[h & SLOT_MASK];
+}
+
+void ShmRelease(struct ShmRing *r) {
+  STORE(r->head, LOAD(r->head, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// На одном процессоре крутиться бесполезно: писатель не работает, пока
+// мы занимаем процессор
+static int SpinLimit(void) {
+  static int limit = -1;
+  int l = LOAD(limit, __ATOMIC_RELAXED);
+  if (l < 0) {
+    l = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+    STORE(limit, l, __ATOMIC_RELAXED);
+  }
+  return l;
+}
+
+void ShmWait(struct ShmRing *r, int timeout_ms) {
+  uint32_t h = LOAD(r->head, __ATOMIC_RELAXED);
+  int spin = SpinLimit();
+  for (int i = 0; i < spin; i++) {
+    if (LOAD(r->tail, __ATOMIC_ACQUIRE) != h)
+      return;
+    CPU_RELAX();
+  }
+  STORE(r->waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint32_t t = LOAD(r->tail, __ATOMIC_ACQUIRE);
+  // futex сам сверит tail с t: запись между проверкой и сном не теряется
+  if (t == h)
+    FutexWait(&r->tail, t, timeout_ms);
+  STORE(r->waiting, 0, __ATOMIC_RELAXED);
+}
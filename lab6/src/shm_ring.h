@@ -0,0 +1,67 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Транспорт через разделяемую память для клиента и сервера на одной
+ * машине (shm:/name в файле серверов).
+ *
+ * Сервер заводит объект POSIX shm с двумя кольцами по SHM_SLOTS слотов:
+ * запросы клиент -> сервер и ответы сервер -> клиент. В слоте лежит
+ * обычный кадр v2 (protocol.h) — id, разбор и проверки те же, что в
+ * сокете. У каждого кольца один писатель и один читатель, поэтому хватает
+ * двух счётчиков: tail двигает писатель, head — читатель.
+ *
+ * Читатель пустого кольца сначала крутится SHM_SPIN проверок (если
+ * процессоров больше одного), потом ставит флаг waiting и засыпает на
+ * futex по tail. Писатель будит его, только если флаг стоит, — пока
+ * кольцо не пустеет, обмен идёт без единого системного вызова.
+ *
+ * К каналу подключён один клиент за раз: его pid лежит в owner. Клиент,
+ * чей процесс умер, вытесняется следующим.
+ */
+
+#define SHM_SLOTS 64  // степень двойки; не меньше конвейера клиента
+#define SHM_SLOT_SIZE 64
+#define SHM_SPIN 2000
+
+struct ShmRing {
+  uint32_t head;  // следующий слот читателя
+  char pad1[60];
+  uint32_t tail;  // следующий слот писателя; на нём ждёт futex
+  uint32_t waiting;  // читатель спит или собирается заснуть
+  char pad2[56];
+  unsigned char slots[SHM_SLOTS][SHM_SLOT_SIZE];
+};
+
+struct ShmChannel {
+  uint32_t magic;
+  int32_t owner;   // pid клиента, 0 — свободен
+  int32_t server;  // pid сервера
+  char pad[52];
+  struct ShmRing req;  // клиент -> сервер
+  struct ShmRing rep;  // сервер -> клиент
+};
+
+// Сервер: завести канал name заново. NULL — ошибка (уже напечатана)
+struct ShmChannel *ShmCreate(const char *name);
+// Клиент: подключиться к каналу name и дождаться, пока сервер ответит на
+// запросы предыдущего клиента. NULL — ошибка (уже напечатана)
+struct ShmChannel *ShmAttach(const char *name);
+void ShmDetach(struct ShmChannel *ch);
+// Жив ли процесс сервера: futex не сообщит, что будить уже некому
+bool ShmServerAlive(const struct ShmChannel *ch);
+
+// Положить кадр длиной len <= SHM_SLOT_SIZE; false — кольцо полно
+bool ShmPush(struct ShmRing *r, const void *frame, size_t len);
+// Первый непрочитанный кадр или NULL. Слот занят до ShmRelease
+const unsigned char *ShmPeek(struct ShmRing *r);
+void ShmRelease(struct ShmRing *r);
+// Ждать, пока в кольце что-то появится, не дольше timeout_ms (-1 —
+// сколько угодно). Может вернуться и раньше
+void ShmWait(struct ShmRing *r, int timeout_ms);
+
+#endif  // SHM_RING_H
@@ -0,0 +1,72 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define TRACE_MAGIC 0x52544146u  // "FATR"
+#define TRACE_VERSION 1
+
+void TraceEncodeHeader(unsigned char *buf) {
+  PutU32(buf, TRACE_MAGIC);
+  PutU32(buf + 4, TRACE_VERSION);
+  memset(buf + 8, 0, TRACE_HEADER_SIZE - 8);
+}
+
+void TraceEncode(unsigned char *buf, const struct TraceRecord *r) {
+  PutU64(buf, r->t_ns);
+  PutU32(buf + 8, r->conn);
+  PutU32(buf + 12, r->budget_us);
+  PutU64(buf + 16, r->begin);
+  PutU64(buf + 24, r->end);
+  PutU64(buf + 32, r->mod);
+}
+
+struct TraceRecord *TraceLoad(const char *path, size_t *count) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  unsigned char buf[TRACE_RECORD_SIZE];
+  if (fread(buf, 1, TRACE_HEADER_SIZE, f) != TRACE_HEADER_SIZE ||
+      GetU32(buf) != TRACE_MAGIC || GetU32(buf + 4) != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a factorial trace\n", path);
+    fclose(f);
+    return NULL;
+  }
+
+  size_t n = 0, cap = 1024;
+  struct TraceRecord *records = malloc(cap * sizeof(*records));
+  while (records && fread(buf, 1, TRACE_RECORD_SIZE, f) == TRACE_RECORD_SIZE) {
+    if (n == cap) {
+      cap *= 2;
+      struct TraceRecord *grown = realloc(records, cap * sizeof(*records));
+      if (!grown) {
+        free(records);
+        records = NULL;
+        break;
+      }
+      records = grown;
+    }
+    struct TraceRecord *r = &records[n++];
+    r->t_ns = GetU64(buf);
+    r->conn = GetU32(buf + 8);
+    r->budget_us = GetU32(buf + 12);
+    r->begin = GetU64(buf + 16);
+    r->end = GetU64(buf + 24);
+    r->mod = GetU64(buf + 32);
+  }
+  if (!records)
+    fprintf(stderr, "Out of memory\n");
+  else if (ferror(f)) {
+    perror(path);
+    free(records);
+    records = NULL;
+  }
+  fclose(f);
+  *count = n;
+  return records;
+}
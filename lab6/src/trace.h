@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Трасса запросов сервера (server --record, replay).
+ *
+ * Заголовок TRACE_HEADER_SIZE байт (magic, версия), дальше записи по
+ * TRACE_RECORD_SIZE байт в порядке приёма, все числа little-endian:
+ *   t_ns      u64  от начала записи
+ *   conn      u32  номер соединения, у всех запросов соединения один
+ *   budget_us u32  срок запроса (protocol.h), 0 — без срока
+ *   begin, end, mod  u64
+ * Версия протокола соединения не пишется: replay всё шлёт кадрами v2.
+ */
+
+#define TRACE_HEADER_SIZE 16
+#define TRACE_RECORD_SIZE 40
+
+struct TraceRecord {
+  uint64_t t_ns;
+  uint32_t conn;
+  uint32_t budget_us;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t mod;
+};
+
+void TraceEncodeHeader(unsigned char *buf);
+void TraceEncode(unsigned char *buf, const struct TraceRecord *r);
+
+// Прочитать трассу целиком; обрезанная последняя запись отбрасывается.
+// NULL — ошибка (уже напечатана)
+struct TraceRecord *TraceLoad(const char *path, size_t *count);
+
+#endif  // TRACE_H
@@ -0,0 +1,43 @@
+#include "common.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+bool ParseSize(const char *str, size_t max, size_t *val) {
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(str, &end, 10);
+  if (errno || end == str || *end || str[0] == '-' || v == 0 || v > max)
+    return false;
+  *val = (size_t)v;
+  return true;
+}
+
+uint64_t NowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void WriteAllV(int fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("write");
+      exit(1);
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= (ssize_t)iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+}
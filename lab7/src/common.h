@@ -0,0 +1,23 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Код, общий для TCP- и UDP-клиента и сервера ЛР7.
+ */
+
+// Целое в 1..max; false — не число, ноль или больше max
+bool ParseSize(const char *str, size_t max, size_t *val);
+
+// Монотонное время в наносекундах
+uint64_t NowNs(void);
+
+// Записать все cnt буферов, дописывая остаток после частичной записи.
+// iov портится. Ошибка записи — exit(1)
+void WriteAllV(int fd, struct iovec *iov, int cnt);
+
+#endif  // COMMON_H
@@ -0,0 +1,32 @@
+#include "rudp.h"
+
+#include <endian.h>
+#include <string.h>
+
+void RudpEncode(unsigned char *buf, const struct RudpHeader *h) {
+  uint16_t len = htole16(h->len);
+  uint32_t session = htole32(h->session), seq = htole32(h->seq);
+  buf[0] = h->type;
+  buf[1] = h->flags;
+  memcpy(buf + 2, &len, sizeof(len));
+  memcpy(buf + 4, &session, sizeof(session));
+  memcpy(buf + 8, &seq, sizeof(seq));
+}
+
+bool RudpDecode(const unsigned char *buf, size_t size, struct RudpHeader *h) {
+  if (size < RUDP_HEADER_SIZE)
+    return false;
+  uint16_t len;
+  uint32_t session, seq;
+  memcpy(&len, buf + 2, sizeof(len));
+  memcpy(&session, buf + 4, sizeof(session));
+  memcpy(&seq, buf + 8, sizeof(seq));
+  h->type = buf[0];
+  h->flags = buf[1];
+  h->len = le16toh(len);
+  h->session = le32toh(session);
+  h->seq = le32toh(seq);
+  if (h->type == RUDP_DATA)
+    return size - RUDP_HEADER_SIZE == h->len;
+  return h->type == RUDP_ACK && size == RUDP_ACK_SIZE;
+}
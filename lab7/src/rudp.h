@@ -0,0 +1,53 @@
+#ifndef RUDP_H
+#define RUDP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Надёжная передача потока поверх UDP (udpclient --reliable →
+ * udpserver --reliable).
+ *
+ * Каждая датаграмма начинается с заголовка RUDP_HEADER_SIZE байт:
+ *   type     u8   RUDP_DATA или RUDP_ACK
+ *   flags    u8   RUDP_FLAG_FIN
+ *   len      u16  DATA — длина данных после заголовка, ACK — окно
+ *                 получателя в пакетах
+ *   session  u32  номер передачи, его выбирает отправитель
+ *   seq      u32  DATA — номер пакета, ACK — сколько пакетов подряд
+ *                 с начала получено (номер первого недостающего)
+ * Все числа — little-endian.
+ *
+ * DATA с флагом FIN и seq = числом пакетов закрывает передачу; когда
+ * всё до него собрано, получатель отвечает ACK с тем же флагом.
+ *
+ * За заголовком ACK — битовая карта выборочных подтверждений на
+ * RUDP_SACK_BITS пакетов: бит i (младший бит байта i / 8 первым) значит,
+ * что пакет seq + 1 + i уже у получателя.
+ */
+
+#define RUDP_DATA 1
+#define RUDP_ACK 2
+
+#define RUDP_FLAG_FIN 1
+
+#define RUDP_HEADER_SIZE 12
+#define RUDP_SACK_BITS 512
+#define RUDP_ACK_SIZE (RUDP_HEADER_SIZE + RUDP_SACK_BITS / 8)
+// Больше в одну UDP-датаграмму не влезет
+#define RUDP_MAX_PAYLOAD (65507 - RUDP_HEADER_SIZE)
+
+struct RudpHeader {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t len;
+  uint32_t session;
+  uint32_t seq;
+};
+
+void RudpEncode(unsigned char *buf, const struct RudpHeader *h);
+// false — слишком короткая или неизвестного типа датаграмма
+bool RudpDecode(const unsigned char *buf, size_t size, struct RudpHeader *h);
+
+#endif  // RUDP_H
@@ -1,23 +1,181 @@
+#define _GNU_SOURCE  // splice
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "common.h"
+
 #define BUFSIZE 100
+#define BULK_CHUNK (1 << 20)
 #define SADDR struct sockaddr
 #define SIZE sizeof(struct sockaddr_in)
 
+/*
+ * --bulk: весь stdin уходит в сокет без копирования через память
+ * процесса. Обычный файл отдаётся sendfile, канал — splice прямо в
+ * сокет; для остального (терминал) остаётся read/write кусками по
+ * BULK_CHUNK. Сокет на время передачи закупорен TCP_CORK: хвосты
+ * короче MSS не уходят отдельными сегментами, а последний выталкивает
+ * снятие пробки.
+ */
+
+static double Seconds(const struct timespec *t) {
+  return (double)t->tv_sec + (double)t->tv_nsec / 1e9;
+}
+
+static double CpuSeconds(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+         (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Один шаг передачи: сколько байт ушло, 0 — вход кончился
+static ssize_t BulkStep(int in, int fd, mode_t mode, char *buf) {
+  if (S_ISREG(mode))
+    return sendfile(fd, in, NULL, BULK_CHUNK);
+  if (S_ISFIFO(mode))
+    return splice(in, NULL, fd, NULL, BULK_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+  ssize_t n = read(in, buf, BULK_CHUNK);
+  if (n <= 0)
+    return n;
+  for (ssize_t off = 0; off < n;) {
+    ssize_t w = send(fd, buf + off, (size_t)(n - off), MSG_MORE);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return -1;
+    off += w;
+  }
+  return n;
+}
+
+static void Bulk(int fd) {
+  struct stat st;
+  if (fstat(0, &st) < 0) {
+    perror("fstat");
+    exit(1);
+  }
+  char *buf = NULL;
+  if (!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode) &&
+      !(buf = malloc(BULK_CHUNK))) {
+    perror("malloc");
+    exit(1);
+  }
+
+  int one = 1, zero = 0;
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  double cpu = CpuSeconds();
+  unsigned long long total = 0;
+  while (1) {
+    ssize_t n = BulkStep(0, fd, st.st_mode, buf);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("send");
+      exit(1);
+    }
+    if (n == 0)
+      break;
+    total += (unsigned long long)n;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+  // Время считаем до подтверждения приёма: close дождётся отправки
+  // остатка из буфера сокета, shutdown + read — ответа сервера
+  shutdown(fd, SHUT_WR);
+  char c;
+  while (read(fd, &c, 1) > 0)
+    ;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  cpu = CpuSeconds() - cpu;
+  free(buf);
+
+  double sec = Seconds(&stop) - Seconds(&start);
+  int sndbuf = 0;
+  socklen_t len = sizeof(sndbuf);
+  getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+  printf("sent %llu bytes in %.3f s: %.1f MiB/s, cpu %.3f s (%s), "
+         "sndbuf %d\n",
+         total, sec, sec > 0 ? (double)total / sec / (1 << 20) : 0.0, cpu,
+         S_ISREG(st.st_mode) ? "sendfile"
+                             : S_ISFIFO(st.st_mode) ? "splice" : "copy",
+         sndbuf);
+}
+
 int main(int argc, char *argv[]) {
   int fd;
   int nread;
-  char buf[BUFSIZE];
   struct sockaddr_in servaddr;
-  if (argc < 3) {
+  size_t bufsize = BUFSIZE;
+  size_t sockbuf = 0;
+  bool bulk = false;
+
+  while (true) {
+    static struct option options[] = {{"bufsize", required_argument, 0, 0},
+                                      {"bulk", no_argument, 0, 0},
+                                      {"sockbuf", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ParseSize(optarg, INT_MAX, &bufsize)) {
+          fprintf(stderr, "bufsize must be a positive integer\n");
+          return 1;
+        }
+        break;
+      case 1:
+        bulk = true;
+        break;
+      case 2:
+        if (!ParseSize(optarg, INT_MAX, &sockbuf)) {
+          fprintf(stderr, "sockbuf must be a positive integer\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (argc - optind < 2) {
     printf("Too few arguments \n");
+    printf("Using: %s [--bufsize %d] [--bulk] [--sockbuf BYTES] IP PORT\n",
+           argv[0], BUFSIZE);
     exit(1);
   }
 
@@ -25,30 +183,48 @@ int main(int argc, char *argv[]) {
     perror("socket creating");
     exit(1);
   }
+  // Без --sockbuf размер буфера подбирает ядро (автотюнинг), а явное
+  // значение его отключает — задавать стоит только осознанно
+  if (sockbuf) {
+    int v = (int)sockbuf;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &v, sizeof(v));
+  }
 
   memset(&servaddr, 0, SIZE);
   servaddr.sin_family = AF_INET;
 
-  if (inet_pton(AF_INET, argv[1], &servaddr.sin_addr) <= 0) {
+  if (inet_pton(AF_INET, argv[optind], &servaddr.sin_addr) <= 0) {
     perror("bad address");
     exit(1);
   }
 
-  servaddr.sin_port = htons(atoi(argv[2]));
+  servaddr.sin_port = htons(atoi(argv[optind + 1]));
 
   if (connect(fd, (SADDR *)&servaddr, SIZE) < 0) {
     perror("connect");
     exit(1);
   }
 
+  if (bulk) {
+    Bulk(fd);
+    close(fd);
+    exit(0);
+  }
+
+  char *buf = malloc(bufsize);
+  if (!buf) {
+    perror("malloc");
+    exit(1);
+  }
   write(1, "Input message to send\n", 22);
-  while ((nread = read(0, buf, BUFSIZE)) > 0) {
+  while ((nread = read(0, buf, bufsize)) > 0) {
     if (write(fd, buf, nread) < 0) {
       perror("write");
       exit(1);
     }
   }
 
+  free(buf);
   close(fd);
   exit(0);
 }
@@ -1,62 +1,291 @@
+#define _GNU_SOURCE  // accept4, splice
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "common.h"
+
 #define SERV_PORT 10050
-#define BUFSIZE 100
+#define BUFSIZE (64 * 1024)
+#define MAX_EVENTS 64
 #define SADDR struct sockaddr
 
-int main() {
+/*
+ * Сервер принимает сколько угодно клиентов сразу: один поток, epoll,
+ * неблокирующие сокеты. У каждого соединения свой буфер на bufsize байт.
+ * За один оборот цикла из каждого готового сокета делается ровно один
+ * read в его буфер (так ни один клиент не задавит остальных), потом все
+ * заполненные буферы уходят в stdout одним writev.
+ *
+ * --bulk: вместо буфера у соединения канал, данные идут splice'ом
+ * сокет → канал → stdout и в память процесса не копируются. Каждое
+ * соединение сливает свой канал сразу после чтения.
+ */
+
+struct Conn {
+  int fd;
+  char *buf;
+  size_t len;    // прочитано в этом обороте
+  bool closing;  // EOF или ошибка: закрыть после вывода
+  unsigned long long total;
+  struct timespec start;
+  int pipe[2];  // только в --bulk
+};
+
+static size_t bufsize = BUFSIZE;
+static bool bulk = false;
+
+// Переложить всё из канала соединения в stdout
+static void Drain(struct Conn *c, size_t len) {
+  while (len > 0) {
+    ssize_t n = splice(c->pipe[0], NULL, 1, NULL, len, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EINVAL) {
+      fprintf(stderr, "stdout does not support splice, run without --bulk\n");
+      exit(1);
+    }
+    if (n < 0) {
+      perror("splice");
+      exit(1);
+    }
+    len -= (size_t)n;
+  }
+}
+
+// Одно чтение из сокета. В --bulk данные сразу уходят в stdout
+static ssize_t ReadConn(struct Conn *c) {
+  if (!bulk)
+    return read(c->fd, c->buf, bufsize);
+  ssize_t n = splice(c->fd, NULL, c->pipe[1], NULL, bufsize,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n > 0)
+    Drain(c, (size_t)n);
+  return n;
+}
+
+static void Accept(int efd, int lfd) {
+  while (1) {
+    int cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      // EMFILE и подобные не повод ронять остальных клиентов
+      perror("accept");
+      return;
+    }
+    struct Conn *c = malloc(sizeof(*c));
+    char *buf = bulk ? NULL : malloc(bufsize);
+    if (!c || (!bulk && !buf)) {
+      perror("malloc");
+      exit(1);
+    }
+    *c = (struct Conn){cfd, buf, 0, false, 0, {0, 0}, {-1, -1}};
+    clock_gettime(CLOCK_MONOTONIC, &c->start);
+    if (bulk) {
+      if (pipe2(c->pipe, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        exit(1);
+      }
+      // Без прав больше pipe-max-size не дадут; тогда остаётся 64 KiB
+      fcntl(c->pipe[1], F_SETPIPE_SZ, (int)bufsize);
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+      perror("epoll_ctl");
+      exit(1);
+    }
+    // stdout занят принятыми данными, отчёты идут в stderr
+    fprintf(stderr, "connection established\n");
+  }
+}
+
+int main(int argc, char **argv) {
   const size_t kSize = sizeof(struct sockaddr_in);
 
-  int lfd, cfd;
-  int nread;
-  char buf[BUFSIZE];
+  size_t port = SERV_PORT;
+  size_t sockbuf = 0;
+
+  while (true) {
+    static struct option options[] = {{"port", required_argument, 0, 0},
+                                      {"bufsize", required_argument, 0, 0},
+                                      {"bulk", no_argument, 0, 0},
+                                      {"sockbuf", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ParseSize(optarg, 65535, &port)) {
+          fprintf(stderr, "port must be in 1..65535\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ParseSize(optarg, INT_MAX, &bufsize)) {
+          fprintf(stderr, "bufsize must be a positive integer\n");
+          return 1;
+        }
+        break;
+      case 2:
+        bulk = true;
+        break;
+      case 3:
+        if (!ParseSize(optarg, INT_MAX, &sockbuf)) {
+          fprintf(stderr, "sockbuf must be a positive integer\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr,
+            "Using: %s [--port %d] [--bufsize %d] [--bulk] "
+            "[--sockbuf BYTES]\n",
+            argv[0], SERV_PORT, BUFSIZE);
+    return 1;
+  }
+
+  int lfd;
   struct sockaddr_in servaddr;
-  struct sockaddr_in cliaddr;
 
-  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+  if ((lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0)) < 0) {
     perror("socket");
     exit(1);
   }
+  int one = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  // Принятые сокеты наследуют размер буфера. Без --sockbuf его
+  // подбирает ядро, явное значение этот автотюнинг отключает
+  if (sockbuf) {
+    int v = (int)sockbuf;
+    setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+  }
 
   memset(&servaddr, 0, kSize);
   servaddr.sin_family = AF_INET;
   servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  servaddr.sin_port = htons(SERV_PORT);
+  servaddr.sin_port = htons((uint16_t)port);
 
   if (bind(lfd, (SADDR *)&servaddr, kSize) < 0) {
     perror("bind");
     exit(1);
   }
 
-  if (listen(lfd, 5) < 0) {
+  if (listen(lfd, SOMAXCONN) < 0) {
     perror("listen");
     exit(1);
   }
 
-  while (1) {
-    unsigned int clilen = kSize;
+  int efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd < 0) {
+    perror("epoll_create1");
+    exit(1);
+  }
+  // У слушающего сокета data.ptr == NULL
+  struct epoll_event lev = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, lfd, &lev) < 0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
 
-    if ((cfd = accept(lfd, (SADDR *)&cliaddr, &clilen)) < 0) {
-      perror("accept");
+  struct epoll_event events[MAX_EVENTS];
+  struct Conn *ready[MAX_EVENTS];
+  struct iovec iov[MAX_EVENTS];
+
+  while (1) {
+    int n = epoll_wait(efd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
       exit(1);
     }
-    printf("connection established\n");
 
-    while ((nread = read(cfd, buf, BUFSIZE)) > 0) {
-      write(1, &buf, nread);
+    int nready = 0, niov = 0;
+    for (int i = 0; i < n; i++) {
+      struct Conn *c = events[i].data.ptr;
+      if (!c) {
+        Accept(efd, lfd);
+        continue;
+      }
+      ssize_t nread = ReadConn(c);
+      if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      if (nread < 0)
+        perror("read");
+      if (nread <= 0) {
+        c->closing = true;
+      } else if (bulk) {
+        c->total += (unsigned long long)nread;
+        continue;
+      } else {
+        c->len = (size_t)nread;
+        c->total += (unsigned long long)nread;
+        iov[niov].iov_base = c->buf;
+        iov[niov].iov_len = c->len;
+        niov++;
+      }
+      ready[nready++] = c;
     }
 
-    if (nread == -1) {
-      perror("read");
-      exit(1);
+    WriteAllV(1, iov, niov);
+
+    for (int i = 0; i < nready; i++) {
+      struct Conn *c = ready[i];
+      c->len = 0;
+      if (!c->closing)
+        continue;
+      // close сам убирает сокет из epoll
+      close(c->fd);
+      if (bulk) {
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+      }
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      double sec = (double)(now.tv_sec - c->start.tv_sec) +
+                   (double)(now.tv_nsec - c->start.tv_nsec) / 1e9;
+      fprintf(stderr, "connection closed: %llu bytes in %.3f s, %.1f MiB/s\n",
+              c->total, sec,
+              sec > 0 ? (double)c->total / sec / (1 << 20) : 0.0);
+      free(c->buf);
+      free(c);
     }
-    close(cfd);
   }
 }
@@ -1,35 +1,757 @@
+#define _GNU_SOURCE  // recvmmsg, ppoll
+
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "common.h"
+#include "hist.h"
+#include "rudp.h"
+
 #define SERV_PORT 20001
 #define BUFSIZE 1024
+#define BATCH 64
+#define HEADER 12  // seq (8) + попытка (4)
+#define LOG_BUCKETS 65
+#define RELIABLE_WINDOW 4096
+#define RELIABLE_MSS 1400
+#define RELIABLE_RETRIES 12
 #define SADDR struct sockaddr
 #define SLEN sizeof(struct sockaddr_in)
 
+/*
+ * --window N: вместо stop-and-wait держим до N сообщений в полёте.
+ * В начале датаграммы номер сообщения и номер попытки; эхо-сервер
+ * возвращает их как есть. Окно скользящее: сообщение seq уходит, только
+ * когда все до seq - N получили ответ или признаны потерянными. Без
+ * ответа за --timeout-ms сообщение уходит заново, после --retries
+ * повторов считается потерянным.
+ *
+ * RTT меряется только по ответу на последнюю попытку (правило Карна:
+ * по ответу на более раннюю не понять, к какой отправке он относится).
+ * Отправка и приём пачками через sendmmsg/recvmmsg.
+ *
+ * --reliable: stdin уходит на udpserver --reliable по протоколу rudp.h
+ * пакетами по --mss байт. Окно не больше --window пакетов и окна
+ * получателя, внутри него — окно перегрузки cwnd:
+ *   - медленный старт с RUDP_INIT_CWND, дальше +1 пакет за RTT;
+ *   - пакет потерян, если подтверждены RUDP_DUPTHRESH пакетов,
+ *     отправленных после него (по SACK); такой пакет уходит заново
+ *     первым, а cwnd за эпизод потерь один раз делится пополам;
+ *   - тайм-аут (RTO по RFC 6298: srtt + 4 rttvar, удваивается на
+ *     каждом подряд) помечает потерянным всё неподтверждённое и
+ *     сбрасывает cwnd в 1. После --retries тайм-аутов подряд без
+ *     продвижения передача бросается.
+ * Номера пакетов 32-битные: до 4G пакетов на передачу.
+ */
+
+#define RUDP_INIT_CWND 10
+#define RUDP_DUPTHRESH 3
+#define RUDP_MIN_RTO_NS 2000000ull
+#define RUDP_MAX_RTO_NS 1000000000ull
+
+struct Slot {
+  uint64_t seq;
+  uint64_t sent;  // нс, время последней попытки
+  uint32_t attempt;
+  bool active;
+  char *buf;
+};
+
+struct Window {
+  int fd;
+  size_t window;
+  size_t size;
+  struct Slot *slots;
+  struct mmsghdr out[BATCH];
+  struct iovec out_iov[BATCH];
+  unsigned nout;
+  unsigned long long sent;
+  unsigned long long retransmits;
+};
+
+// Отправить накопленную пачку. Сервер, которого нет, даёт ECONNREFUSED —
+// это та же потеря, её разрулят повторы
+static void Flush(struct Window *w) {
+  for (unsigned done = 0; done < w->nout;) {
+    int n = sendmmsg(w->fd, w->out + done, w->nout - done, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != ECONNREFUSED) {
+      perror("sendmmsg");
+      exit(1);
+    }
+    done += n < 0 ? 1 : (unsigned)n;
+  }
+  w->nout = 0;
+}
+
+static void Send(struct Window *w, struct Slot *s, uint64_t now) {
+  memcpy(s->buf, &s->seq, 8);
+  memcpy(s->buf + 8, &s->attempt, 4);
+  s->sent = now;
+  s->active = true;
+  w->out_iov[w->nout].iov_base = s->buf;
+  w->out_iov[w->nout].iov_len = w->size;
+  w->out[w->nout].msg_hdr = (struct msghdr){0};
+  w->out[w->nout].msg_hdr.msg_iov = &w->out_iov[w->nout];
+  w->out[w->nout].msg_hdr.msg_iovlen = 1;
+  w->nout++;
+  w->sent++;
+  if (w->nout == BATCH)
+    Flush(w);
+}
+
+static int Windowed(int fd, size_t window, size_t count, size_t size,
+                    uint64_t timeout_ns, size_t retries) {
+  struct Window w = {fd, window, size, calloc(window, sizeof(struct Slot))};
+  char *bufs = malloc(window * size);
+  char *rx = malloc(BATCH * (size_t)BUFSIZE);
+  static struct Hist hist;
+  // log_us[b]: RTT в [2^(b-1), 2^b) мкс, log_us[0] — меньше 1 мкс
+  unsigned long long log_us[LOG_BUCKETS] = {0};
+  if (!w.slots || !bufs || !rx) {
+    perror("malloc");
+    exit(1);
+  }
+  HistInit(&hist);
+  memset(bufs, 'x', window * size);
+  for (size_t i = 0; i < window; i++)
+    w.slots[i].buf = bufs + i * size;
+
+  struct mmsghdr in[BATCH];
+  struct iovec in_iov[BATCH];
+  for (int i = 0; i < BATCH; i++) {
+    in_iov[i].iov_base = rx + (size_t)i * BUFSIZE;
+    in_iov[i].iov_len = BUFSIZE;
+    in[i].msg_hdr = (struct msghdr){0};
+    in[i].msg_hdr.msg_iov = &in_iov[i];
+    in[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  uint64_t base = 0, next = 0;
+  unsigned long long answered = 0, lost = 0, duplicates = 0;
+  uint64_t start = NowNs();
+  while (base < count) {
+    uint64_t now = NowNs();
+    uint64_t wake = UINT64_MAX;
+    for (uint64_t seq = base; seq < next; seq++) {
+      struct Slot *s = &w.slots[seq % window];
+      if (!s->active)
+        continue;
+      if (now - s->sent >= timeout_ns) {
+        if (s->attempt >= retries) {
+          s->active = false;
+          lost++;
+          continue;
+        }
+        s->attempt++;
+        w.retransmits++;
+        Send(&w, s, now);
+      }
+      if (s->sent + timeout_ns < wake)
+        wake = s->sent + timeout_ns;
+    }
+    while (base < next && !w.slots[base % window].active)
+      base++;
+    while (next < count && next < base + window) {
+      struct Slot *s = &w.slots[next % window];
+      s->seq = next++;
+      s->attempt = 0;
+      Send(&w, s, now);
+      if (now + timeout_ns < wake)
+        wake = now + timeout_ns;
+    }
+    Flush(&w);
+    if (base == count)
+      break;
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    uint64_t left = wake > now ? wake - now : 0;
+    struct timespec ts = {(time_t)(left / 1000000000ull),
+                          (long)(left % 1000000000ull)};
+    if (ppoll(&pfd, 1, wake == UINT64_MAX ? NULL : &ts, NULL) < 0 &&
+        errno != EINTR) {
+      perror("ppoll");
+      exit(1);
+    }
+    if (!(pfd.revents & (POLLIN | POLLERR)))
+      continue;
+
+    while (1) {
+      int n = recvmmsg(fd, in, BATCH, MSG_DONTWAIT, NULL);
+      if (n < 0 &&
+          (errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED))
+        break;
+      if (n < 0) {
+        perror("recvmmsg");
+        exit(1);
+      }
+      now = NowNs();
+      for (int i = 0; i < n; i++) {
+        uint64_t seq;
+        uint32_t attempt;
+        if (in[i].msg_len < HEADER)
+          continue;
+        memcpy(&seq, in_iov[i].iov_base, 8);
+        memcpy(&attempt, (char *)in_iov[i].iov_base + 8, 4);
+        struct Slot *s = &w.slots[seq % window];
+        if (seq < base || seq >= next || !s->active || s->seq != seq) {
+          duplicates++;
+          continue;
+        }
+        if (attempt == s->attempt) {
+          uint64_t us = (now - s->sent) / 1000;
+          HistRecord(&hist, now - s->sent);
+          log_us[us ? 64 - __builtin_clzll(us) : 0]++;
+        }
+        s->active = false;
+        answered++;
+      }
+      if (n < BATCH)
+        break;
+    }
+  }
+  double seconds = (double)(NowNs() - start) / 1e9;
+
+  printf("sent %llu datagrams for %zu messages (%llu retransmits)\n", w.sent,
+         count, w.retransmits);
+  printf("answered %llu, lost %llu (%.3f%%), duplicates %llu\n", answered,
+         lost, 100.0 * (double)lost / (double)count, duplicates);
+  printf("throughput: %.1f msg/s, %.2f MiB/s of payload each way\n",
+         (double)answered / seconds,
+         (double)answered * (double)size / seconds / (1 << 20));
+  printf("rtt us: p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f  "
+         "mean %.1f  (%llu samples)\n",
+         HistPercentile(&hist, 50) / 1e3, HistPercentile(&hist, 90) / 1e3,
+         HistPercentile(&hist, 99) / 1e3, HistPercentile(&hist, 99.9) / 1e3,
+         hist.max / 1e3,
+         hist.total ? (double)(hist.sum / hist.total) / 1e3 : 0.0,
+         (unsigned long long)hist.total);
+
+  // Гистограмма по степеням двойки микросекунд
+  unsigned long long peak = 0;
+  int lo = LOG_BUCKETS, hi = -1;
+  for (int b = 0; b < LOG_BUCKETS; b++) {
+    if (!log_us[b])
+      continue;
+    lo = b < lo ? b : lo;
+    hi = b;
+    peak = log_us[b] > peak ? log_us[b] : peak;
+  }
+  for (int b = lo; b <= hi; b++) {
+    char range[48];
+    snprintf(range, sizeof(range), "[%llu, %llu)", b ? 1ull << (b - 1) : 0,
+             1ull << b);
+    int bar = (int)(log_us[b] * 50 / peak);
+    printf("  %-20s %10llu %.*s\n", range, log_us[b], bar,
+           "##################################################");
+  }
+
+  free(rx);
+  free(bufs);
+  free(w.slots);
+  return lost ? 2 : 0;
+}
+
+struct Packet {
+  uint32_t seq;
+  uint32_t sent_next;  // следующий новый номер на момент отправки
+  uint16_t len;
+  bool sacked;
+  bool lost;  // ждёт повторной отправки
+  bool retx;  // уходил повторно: RTT по нему не мерить
+  uint64_t sent;
+  unsigned char *buf;  // заголовок и данные
+};
+
+struct Sender {
+  int fd;
+  uint32_t session;
+  size_t window;
+  size_t mss;
+  struct Packet *pkts;
+  uint32_t una;    // первый неподтверждённый
+  uint32_t next;   // следующий новый
+  uint32_t total;  // число пакетов, UINT32_MAX — stdin ещё не кончился
+  uint32_t high_sacked;
+  size_t sacked;  // в [una, next)
+  size_t lost;    // в [una, next)
+  uint32_t peer_window;
+  double cwnd;
+  double ssthresh;
+  bool recovery;
+  uint32_t recover;  // эпизод потерь кончается, когда una дойдёт сюда
+  uint64_t srtt;
+  uint64_t rttvar;
+  uint64_t rto;
+  uint64_t timer;  // срок тайм-аута, 0 — не взведён
+  size_t backoffs;
+  bool fin_sent;
+  bool fin_acked;
+  unsigned char fin[RUDP_HEADER_SIZE];
+  struct mmsghdr out[BATCH];
+  struct iovec out_iov[BATCH];
+  unsigned nout;
+  unsigned long long packets;
+  unsigned long long retransmits;
+  unsigned long long recoveries;
+  unsigned long long timeouts;
+  unsigned long long bytes;
+};
+
+static void SFlush(struct Sender *s) {
+  for (unsigned done = 0; done < s->nout;) {
+    int n = sendmmsg(s->fd, s->out + done, s->nout - done, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != ECONNREFUSED) {
+      perror("sendmmsg");
+      exit(1);
+    }
+    done += n < 0 ? 1 : (unsigned)n;
+  }
+  s->nout = 0;
+}
+
+static void SQueue(struct Sender *s, void *buf, size_t len) {
+  s->out_iov[s->nout].iov_base = buf;
+  s->out_iov[s->nout].iov_len = len;
+  s->out[s->nout].msg_hdr = (struct msghdr){0};
+  s->out[s->nout].msg_hdr.msg_iov = &s->out_iov[s->nout];
+  s->out[s->nout].msg_hdr.msg_iovlen = 1;
+  s->nout++;
+  if (s->nout == BATCH)
+    SFlush(s);
+}
+
+static void Transmit(struct Sender *s, struct Packet *p, uint64_t now) {
+  p->sent = now;
+  p->sent_next = s->next;
+  s->packets++;
+  SQueue(s, p->buf, RUDP_HEADER_SIZE + p->len);
+}
+
+// Прочитать до len байт; меньше — только в конце входа
+static size_t ReadFull(int fd, unsigned char *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      perror("read");
+      exit(1);
+    }
+    if (n == 0)
+      break;
+    got += (size_t)n;
+  }
+  return got;
+}
+
+static void UpdateRtt(struct Sender *s, uint64_t rtt) {
+  if (!s->srtt) {
+    s->srtt = rtt;
+    s->rttvar = rtt / 2;
+  } else {
+    uint64_t diff = s->srtt > rtt ? s->srtt - rtt : rtt - s->srtt;
+    s->rttvar = (3 * s->rttvar + diff) / 4;
+    s->srtt = (7 * s->srtt + rtt) / 8;
+  }
+  s->rto = s->srtt + 4 * s->rttvar;
+  if (s->rto < RUDP_MIN_RTO_NS)
+    s->rto = RUDP_MIN_RTO_NS;
+  if (s->rto > RUDP_MAX_RTO_NS)
+    s->rto = RUDP_MAX_RTO_NS;
+}
+
+static void OnTimeout(struct Sender *s, size_t retries, uint64_t now) {
+  if (++s->backoffs > retries) {
+    fprintf(stderr, "receiver does not answer: gave up after %zu timeouts\n",
+            retries);
+    exit(1);
+  }
+  s->timeouts++;
+  if (s->una == s->next) {
+    // Всё подтверждено, потерялся FIN или ответ на него
+    s->fin_sent = false;
+  } else {
+    size_t pipe = (size_t)(s->next - s->una) - s->sacked - s->lost;
+    s->ssthresh = pipe / 2 > 2 ? (double)(pipe / 2) : 2;
+    s->cwnd = 1;
+    s->recovery = false;
+    for (uint32_t seq = s->una; seq < s->next; seq++) {
+      struct Packet *p = &s->pkts[seq % s->window];
+      if (!p->sacked && !p->lost) {
+        p->lost = true;
+        s->lost++;
+      }
+    }
+  }
+  s->rto = s->rto * 2 > RUDP_MAX_RTO_NS ? RUDP_MAX_RTO_NS : s->rto * 2;
+  s->timer = now + s->rto;
+}
+
+// Пакет подтверждён (накопительно или выборочно)
+static void Acked(struct Sender *s, struct Packet *p, uint64_t *sample) {
+  if (p->lost) {
+    p->lost = false;
+    s->lost--;
+  }
+  if (!p->retx && p->sent > *sample)
+    *sample = p->sent;
+}
+
+static void OnAck(struct Sender *s, const struct RudpHeader *h,
+                  const unsigned char *sack, uint64_t now) {
+  // ACK старше уже подтверждённого пришёл вразнобой: его биты SACK
+  // относятся к номерам ниже una, слоты которых уже отданы новым пакетам
+  if (h->session != s->session || h->seq < s->una || h->seq > s->next)
+    return;
+  s->peer_window = h->len ? h->len : 1;
+  if ((h->flags & RUDP_FLAG_FIN) && h->seq == s->total)
+    s->fin_acked = true;
+
+  size_t newly = 0;
+  uint64_t sample = 0;
+  for (; s->una < h->seq; s->una++) {
+    struct Packet *p = &s->pkts[s->una % s->window];
+    // Выборочно подтверждённый уже учтён и дал свой замер RTT: его
+    // отправка старше этого ACK и замер бы завысила
+    if (p->sacked) {
+      p->sacked = false;
+      s->sacked--;
+    } else {
+      newly++;
+      Acked(s, p, &sample);
+    }
+  }
+  for (uint32_t i = 0; i < RUDP_SACK_BITS; i++) {
+    uint32_t seq = h->seq + 1 + i;
+    if (seq >= s->next)
+      break;
+    struct Packet *p = &s->pkts[seq % s->window];
+    if (!(sack[i / 8] & (1u << (i % 8))) || p->sacked)
+      continue;
+    p->sacked = true;
+    s->sacked++;
+    newly++;
+    Acked(s, p, &sample);
+    if (seq > s->high_sacked)
+      s->high_sacked = seq;
+  }
+  if (!newly)
+    return;
+
+  if (sample)
+    UpdateRtt(s, now - sample);
+  s->backoffs = 0;
+  s->timer = s->una < s->next ? now + s->rto : 0;
+  if (s->recovery && s->una >= s->recover)
+    s->recovery = false;
+  if (!s->recovery) {
+    if (s->cwnd < s->ssthresh)
+      s->cwnd += (double)newly;
+    else
+      s->cwnd += (double)newly / s->cwnd;
+    if (s->cwnd > (double)s->window)
+      s->cwnd = (double)s->window;
+  }
+
+  bool loss = false;
+  for (uint32_t seq = s->una; seq < s->high_sacked; seq++) {
+    struct Packet *p = &s->pkts[seq % s->window];
+    if (!p->sacked && !p->lost &&
+        s->high_sacked >= p->sent_next + RUDP_DUPTHRESH - 1) {
+      p->lost = true;
+      s->lost++;
+      loss = true;
+    }
+  }
+  if (loss && !s->recovery) {
+    s->ssthresh = s->cwnd / 2 > 2 ? s->cwnd / 2 : 2;
+    s->cwnd = s->ssthresh;
+    s->recovery = true;
+    s->recover = s->next;
+    s->recoveries++;
+  }
+}
+
+static int Reliable(int fd, size_t window, size_t mss, uint64_t timeout_ns,
+                    size_t retries) {
+  static struct Sender s;
+  s.fd = fd;
+  s.session = (uint32_t)(NowNs() ^ ((uint64_t)getpid() << 16));
+  s.window = window;
+  s.mss = mss;
+  s.pkts = calloc(window, sizeof(*s.pkts));
+  unsigned char *bufs = malloc(window * (RUDP_HEADER_SIZE + mss));
+  if (!s.pkts || !bufs) {
+    perror("malloc");
+    exit(1);
+  }
+  for (size_t i = 0; i < window; i++)
+    s.pkts[i].buf = bufs + i * (RUDP_HEADER_SIZE + mss);
+  s.total = UINT32_MAX;
+  s.peer_window = (uint32_t)window;
+  s.cwnd = RUDP_INIT_CWND;
+  s.ssthresh = (double)window;
+  s.rto = timeout_ns;
+
+  unsigned char rx[BATCH][RUDP_ACK_SIZE];
+  struct mmsghdr in[BATCH];
+  struct iovec in_iov[BATCH];
+  for (int i = 0; i < BATCH; i++) {
+    in_iov[i].iov_base = rx[i];
+    in_iov[i].iov_len = RUDP_ACK_SIZE;
+    in[i].msg_hdr = (struct msghdr){0};
+    in[i].msg_hdr.msg_iov = &in_iov[i];
+    in[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  uint64_t start = NowNs();
+  while (!s.fin_acked) {
+    uint64_t now = NowNs();
+    if (s.timer && now >= s.timer)
+      OnTimeout(&s, retries, now);
+
+    size_t limit = (size_t)s.cwnd;
+    if (limit > s.peer_window)
+      limit = s.peer_window;
+    size_t pipe = (size_t)(s.next - s.una) - s.sacked - s.lost;
+    // Сначала потерянные, по порядку
+    for (uint32_t seq = s.una; s.lost && pipe < limit && seq < s.next;
+         seq++) {
+      struct Packet *p = &s.pkts[seq % window];
+      if (!p->lost)
+        continue;
+      p->lost = false;
+      s.lost--;
+      p->retx = true;
+      s.retransmits++;
+      Transmit(&s, p, now);
+      pipe++;
+    }
+    // Новые номера — только в окне получателя, считая от una: туда же
+    // попадают и выборочно подтверждённые, которые pipe не учитывает
+    while (pipe < limit && s.total == UINT32_MAX && s.next - s.una < window &&
+           s.next - s.una < s.peer_window) {
+      struct Packet *p = &s.pkts[s.next % window];
+      size_t len = ReadFull(0, p->buf + RUDP_HEADER_SIZE, mss);
+      if (len == 0) {
+        s.total = s.next;
+        break;
+      }
+      struct RudpHeader h = {RUDP_DATA, 0, (uint16_t)len, s.session, s.next};
+      RudpEncode(p->buf, &h);
+      p->seq = s.next++;
+      p->len = (uint16_t)len;
+      p->sacked = p->lost = p->retx = false;
+      s.bytes += len;
+      Transmit(&s, p, now);
+      pipe++;
+    }
+    if (s.una == s.total && !s.fin_sent) {
+      struct RudpHeader h = {RUDP_DATA, RUDP_FLAG_FIN, 0, s.session, s.total};
+      RudpEncode(s.fin, &h);
+      SQueue(&s, s.fin, sizeof(s.fin));
+      s.fin_sent = true;
+      s.timer = now + s.rto;
+    }
+    SFlush(&s);
+    if (!s.timer && s.una < s.next)
+      s.timer = now + s.rto;
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    uint64_t left = s.timer > now ? s.timer - now : 0;
+    struct timespec ts = {(time_t)(left / 1000000000ull),
+                          (long)(left % 1000000000ull)};
+    if (ppoll(&pfd, 1, s.timer ? &ts : NULL, NULL) < 0 && errno != EINTR) {
+      perror("ppoll");
+      exit(1);
+    }
+    if (!(pfd.revents & (POLLIN | POLLERR)))
+      continue;
+
+    while (1) {
+      int n = recvmmsg(fd, in, BATCH, MSG_DONTWAIT, NULL);
+      if (n < 0 &&
+          (errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED))
+        break;
+      if (n < 0) {
+        perror("recvmmsg");
+        exit(1);
+      }
+      now = NowNs();
+      for (int i = 0; i < n; i++) {
+        struct RudpHeader h;
+        if (RudpDecode(rx[i], in[i].msg_len, &h) && h.type == RUDP_ACK)
+          OnAck(&s, &h, rx[i] + RUDP_HEADER_SIZE, now);
+      }
+      if (n < BATCH)
+        break;
+    }
+  }
+  double seconds = (double)(NowNs() - start) / 1e9;
+
+  printf("sent %llu bytes in %.3f s: %.1f MiB/s\n", s.bytes, seconds,
+         (double)s.bytes / seconds / (1 << 20));
+  printf("packets %llu for %u of data, retransmits %llu (%.2f%%), "
+         "loss episodes %llu, timeouts %llu\n",
+         s.packets, s.total, s.retransmits,
+         s.packets ? 100.0 * (double)s.retransmits / (double)s.packets : 0.0,
+         s.recoveries, s.timeouts);
+  printf("srtt %.1f us, rto %.1f ms, cwnd %.0f packets\n", s.srtt / 1e3,
+         s.rto / 1e6, s.cwnd);
+  free(bufs);
+  free(s.pkts);
+  return 0;
+}
+
 int main(int argc, char **argv) {
   int sockfd, n;
-  char sendline[BUFSIZE], recvline[BUFSIZE + 1];
   struct sockaddr_in servaddr;
-  struct sockaddr_in cliaddr;
+  size_t port = SERV_PORT;
+  size_t bufsize = BUFSIZE;
+  size_t window = 0;
+  size_t count = 100000;
+  size_t size = 64;
+  size_t timeout_ms = 200;
+  size_t retries = 0;
+  bool reliable = false;
+  size_t mss = RELIABLE_MSS;
+  size_t sockbuf = 0;
+
+  while (true) {
+    static struct option options[] = {{"port", required_argument, 0, 0},
+                                      {"bufsize", required_argument, 0, 0},
+                                      {"window", required_argument, 0, 0},
+                                      {"count", required_argument, 0, 0},
+                                      {"size", required_argument, 0, 0},
+                                      {"timeout-ms", required_argument, 0, 0},
+                                      {"retries", required_argument, 0, 0},
+                                      {"reliable", no_argument, 0, 0},
+                                      {"mss", required_argument, 0, 0},
+                                      {"sockbuf", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
+
+    if (c == -1)
+      break;
 
-  if (argc != 2) {
-    printf("usage: client <IPaddress of server>\n");
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ParseSize(optarg, 65535, &port)) {
+          fprintf(stderr, "port must be in 1..65535\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ParseSize(optarg, 65507, &bufsize)) {
+          fprintf(stderr, "bufsize must be in 1..65507\n");
+          return 1;
+        }
+        break;
+      case 2:
+        if (!ParseSize(optarg, 1 << 20, &window)) {
+          fprintf(stderr, "window must be in 1..1048576\n");
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ParseSize(optarg, SIZE_MAX, &count)) {
+          fprintf(stderr, "count must be a positive integer\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (!ParseSize(optarg, BUFSIZE, &size)) {
+          fprintf(stderr, "size must be in %d..%d\n", HEADER, BUFSIZE);
+          return 1;
+        }
+        break;
+      case 5:
+        if (!ParseSize(optarg, 3600000, &timeout_ms)) {
+          fprintf(stderr, "timeout-ms must be in 1..3600000\n");
+          return 1;
+        }
+        break;
+      case 6:
+        if (!ParseSize(optarg, 1000, &retries)) {
+          fprintf(stderr, "retries must be in 1..1000\n");
+          return 1;
+        }
+        break;
+      case 7:
+        reliable = true;
+        break;
+      case 8:
+        if (!ParseSize(optarg, RUDP_MAX_PAYLOAD, &mss)) {
+          fprintf(stderr, "mss must be in 1..%d\n", RUDP_MAX_PAYLOAD);
+          return 1;
+        }
+        break;
+      case 9:
+        if (!ParseSize(optarg, INT_MAX, &sockbuf)) {
+          fprintf(stderr, "sockbuf must be a positive integer\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (window && size < HEADER) {
+    fprintf(stderr, "size must be in %d..%d\n", HEADER, BUFSIZE);
+    return 1;
+  }
+  if (argc - optind != 1) {
+    printf("usage: client [--port %d] [--bufsize %d] [--timeout-ms 200] "
+           "<IPaddress of server>\n"
+           "       client --window N [--count 100000] [--size 64] "
+           "[--timeout-ms 200] [--retries 5] <IPaddress of server>\n"
+           "       client --reliable [--window %d] [--mss %d] "
+           "[--timeout-ms 200] [--retries %d] <IPaddress of server> "
+           "< input\n",
+           SERV_PORT, BUFSIZE, RELIABLE_WINDOW, RELIABLE_MSS,
+           RELIABLE_RETRIES);
     exit(1);
   }
 
   memset(&servaddr, 0, sizeof(servaddr));
   servaddr.sin_family = AF_INET;
-  servaddr.sin_port = htons(SERV_PORT);
+  servaddr.sin_port = htons((uint16_t)port);
 
-  if (inet_pton(AF_INET, argv[1], &servaddr.sin_addr) < 0) {
+  if (inet_pton(AF_INET, argv[optind], &servaddr.sin_addr) <= 0) {
     perror("inet_pton problem");
     exit(1);
   }
@@ -38,20 +760,59 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  if (sockbuf) {
+    int v = (int)sockbuf;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &v, sizeof(v));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+  }
+
+  if (window || reliable) {
+    // connect: чужие датаграммы не примутся, а send не нужен адрес
+    if (connect(sockfd, (SADDR *)&servaddr, SLEN) < 0) {
+      perror("connect problem");
+      exit(1);
+    }
+    if (reliable)
+      return Reliable(sockfd, window ? window : RELIABLE_WINDOW, mss,
+                      (uint64_t)timeout_ms * 1000000ull,
+                      retries ? retries : RELIABLE_RETRIES);
+    return Windowed(sockfd, window, count, size,
+                    (uint64_t)timeout_ms * 1000000ull, retries ? retries : 5);
+  }
+
+  // Без тайм-аута потерянная датаграмма вешает клиента навсегда
+  struct timeval tv = {(time_t)(timeout_ms / 1000),
+                       (suseconds_t)(timeout_ms % 1000 * 1000)};
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  char *sendline = malloc(bufsize), *recvline = malloc(bufsize + 1);
+  if (!sendline || !recvline) {
+    perror("malloc");
+    exit(1);
+  }
+
   write(1, "Enter string\n", 13);
 
-  while ((n = read(0, sendline, BUFSIZE)) > 0) {
+  while ((n = read(0, sendline, bufsize)) > 0) {
     if (sendto(sockfd, sendline, n, 0, (SADDR *)&servaddr, SLEN) == -1) {
       perror("sendto problem");
       exit(1);
     }
 
-    if (recvfrom(sockfd, recvline, BUFSIZE, 0, NULL, NULL) == -1) {
+    ssize_t got = recvfrom(sockfd, recvline, bufsize, 0, NULL, NULL);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      printf("NO REPLY FROM SERVER in %zu ms\n", timeout_ms);
+      continue;
+    }
+    if (got == -1) {
       perror("recvfrom problem");
       exit(1);
     }
+    recvline[got] = 0;
 
     printf("REPLY FROM SERVER= %s\n", recvline);
   }
+  free(sendline);
+  free(recvline);
   close(sockfd);
 }
@@ -1,56 +1,516 @@
+#define _GNU_SOURCE  // recvmmsg, pthread_setaffinity_np
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "common.h"
+#include "rudp.h"
+
 #define SERV_PORT 20001
 #define BUFSIZE 1024
+#define BATCH 64
+#define RELIABLE_BUFSIZE 2048
+#define RELIABLE_WINDOW 4096
+#define MAX_THREADS 256
 #define SADDR struct sockaddr
 #define SLEN sizeof(struct sockaddr_in)
 
-int main() {
-  int sockfd, n;
-  char mesg[BUFSIZE], ipadr[16];
+/*
+ * Эхо-сервер. Каждый рабочий поток держит свой сокет на общем порту
+ * (SO_REUSEPORT — ядро раскладывает клиентов по сокетам по хэшу адреса),
+ * привязан к своему ядру и принимает и отвечает пачками до --batch
+ * датаграмм за системный вызов: recvmmsg, затем sendmmsg тем же
+ * массивом сообщений.
+ *
+ * Печать каждого запроса (--log) стоит дороже самого эха, поэтому по
+ * умолчанию она выключена, а раз в секунду печатаются счётчики.
+ *
+ * --reliable: вместо эха — приём потока по протоколу rudp.h. Пакеты
+ * складываются в кольцо на --window пакетов, всё собранное подряд
+ * уходит в stdout одним writev на пачку, на каждую пачку recvmmsg —
+ * один ACK. Передачу в потоке ведёт одна: новый номер сессии сменяет
+ * закончившуюся или замолчавшую на RELIABLE_IDLE_NS. Счётчики и отчёт
+ * в этом режиме идут в stderr, stdout занят данными; для записи в файл
+ * нужен --threads 1. --drop-rate P выкидывает долю P пришедших пакетов
+ * данных — проверять восстановление после потерь на loopback.
+ */
+
+#define RELIABLE_IDLE_NS 1000000000ull
+
+// Приём одной надёжной передачи
+struct Session {
+  bool active;
+  bool done;
+  uint32_t id;
+  uint32_t cum;    // пакетов подряд получено и выведено
+  uint32_t total;  // номер FIN, UINT32_MAX — ещё неизвестен
+  struct sockaddr_in peer;
+  char *ring;       // window ячеек по bufsize байт
+  uint16_t *lens;   // длина данных в ячейке
+  bool *present;
+  uint64_t start;
+  uint64_t last;    // время последнего пакета
+  unsigned long long bytes;
+  unsigned long long packets;
+  unsigned long long duplicates;
+  unsigned long long dropped;
+};
+
+// Счётчики пишет только свой поток; своя кэш-линия, чтобы потоки
+// не толкались
+struct Worker {
+  pthread_t thread;
+  int fd;
+  int cpu;
+  unsigned long long packets;
+  unsigned long long bytes;
+  unsigned long long batches;
+} __attribute__((aligned(64)));
+
+static size_t bufsize = BUFSIZE;
+static size_t batch = BATCH;
+static bool logging = false;
+static bool reliable = false;
+static size_t window = RELIABLE_WINDOW;
+static double drop_rate = 0;
+
+static bool ParseRate(const char *str, double *val) {
+  char *end;
+  errno = 0;
+  double v = strtod(str, &end);
+  if (errno || end == str || *end || !(v >= 0 && v < 1))
+    return false;
+  *val = v;
+  return true;
+}
+
+static int OpenSocket(size_t port, size_t sockbuf) {
+  int sockfd;
   struct sockaddr_in servaddr;
-  struct sockaddr_in cliaddr;
 
   if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
     perror("socket problem");
     exit(1);
   }
+  int one = 1;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+    perror("SO_REUSEPORT");
+    exit(1);
+  }
+  if (sockbuf) {
+    int v = (int)sockbuf;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &v, sizeof(v));
+  }
 
   memset(&servaddr, 0, SLEN);
   servaddr.sin_family = AF_INET;
   servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  servaddr.sin_port = htons(SERV_PORT);
+  servaddr.sin_port = htons((uint16_t)port);
 
   if (bind(sockfd, (SADDR *)&servaddr, SLEN) < 0) {
     perror("bind problem");
     exit(1);
   }
-  printf("SERVER starts...\n");
+  return sockfd;
+}
+
+static void Log(const struct mmsghdr *m) {
+  char ipadr[16];
+  const struct sockaddr_in *cliaddr = m->msg_hdr.msg_name;
+  printf("REQUEST %.*s      FROM %s : %d\n", (int)m->msg_len,
+         (const char *)m->msg_hdr.msg_iov->iov_base,
+         inet_ntop(AF_INET, (void *)&cliaddr->sin_addr.s_addr, ipadr, 16),
+         ntohs(cliaddr->sin_port));
+}
+
+static void Pin(const struct Worker *w) {
+  if (w->cpu < 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(w->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *Serve(void *arg) {
+  struct Worker *w = arg;
+  Pin(w);
+
+  struct mmsghdr *msgs = calloc(batch, sizeof(*msgs));
+  struct iovec *iov = calloc(batch, sizeof(*iov));
+  struct sockaddr_in *addrs = calloc(batch, sizeof(*addrs));
+  char *bufs = malloc(batch * bufsize);
+  if (!msgs || !iov || !addrs || !bufs) {
+    perror("malloc");
+    exit(1);
+  }
+  for (size_t i = 0; i < batch; i++) {
+    iov[i].iov_base = bufs + i * bufsize;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+  }
+
+  while (1) {
+    for (size_t i = 0; i < batch; i++) {
+      iov[i].iov_len = bufsize;
+      msgs[i].msg_hdr.msg_namelen = SLEN;
+    }
+    // Ждём первую датаграмму, остальные забираем только готовые
+    int n = recvmmsg(w->fd, msgs, (unsigned)batch, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("recvmmsg");
+      exit(1);
+    }
+    unsigned long long bytes = 0;
+    for (int i = 0; i < n; i++) {
+      // Ответ — ровно то, что пришло (обрезанное до bufsize)
+      iov[i].iov_len = msgs[i].msg_len;
+      bytes += msgs[i].msg_len;
+      if (logging)
+        Log(&msgs[i]);
+    }
+
+    for (int sent = 0; sent < n;) {
+      int m = sendmmsg(w->fd, msgs + sent, (unsigned)(n - sent), 0);
+      if (m < 0 && errno == EINTR)
+        continue;
+      if (m < 0) {
+        // Недоступный клиент не повод останавливать сервер: пропускаем
+        perror("sendmmsg");
+        sent++;
+        continue;
+      }
+      sent += m;
+    }
+
+    __atomic_store_n(&w->packets, w->packets + (unsigned)n, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bytes, w->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->batches, w->batches + 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+static void Finish(struct Session *s, uint64_t now) {
+  double sec = (double)(now - s->start) / 1e9;
+  fprintf(stderr,
+          "session %u: received %llu bytes in %.3f s: %.1f MiB/s, "
+          "%llu packets, %llu duplicates, %llu dropped on purpose\n",
+          s->id, s->bytes, sec,
+          sec > 0 ? (double)s->bytes / sec / (1 << 20) : 0.0, s->packets,
+          s->duplicates, s->dropped);
+  s->done = true;
+}
+
+// Пакет данных. true — на него нужен ACK
+static bool Accept(struct Session *s, const struct RudpHeader *h,
+                   const struct sockaddr_in *from, const char *data,
+                   uint64_t now) {
+  if (!s->active || (s->id != h->session &&
+                     (s->done || now - s->last > RELIABLE_IDLE_NS))) {
+    // Новая передача
+    s->active = true;
+    s->done = false;
+    s->id = h->session;
+    s->cum = 0;
+    s->total = UINT32_MAX;
+    s->start = now;
+    s->bytes = s->packets = s->duplicates = s->dropped = 0;
+    memset(s->present, 0, window * sizeof(*s->present));
+  }
+  if (s->id != h->session)
+    return false;
+  s->peer = *from;
+  s->last = now;
+  if (h->flags & RUDP_FLAG_FIN) {
+    s->total = h->seq;
+    return true;
+  }
+  s->packets++;
+  size_t slot = h->seq % window;
+  if (h->seq < s->cum || h->seq - s->cum >= window || s->present[slot]) {
+    s->duplicates++;
+    return true;
+  }
+  memcpy(s->ring + slot * bufsize, data, h->len);
+  s->lens[slot] = h->len;
+  s->present[slot] = true;
+  return true;
+}
 
+// Вывести всё, что собралось подряд
+static void Deliver(struct Session *s) {
+  struct iovec iov[IOV_MAX];
+  int cnt = 0;
   while (1) {
-    unsigned int len = SLEN;
+    size_t slot = s->cum % window;
+    bool more = s->cum != s->total && s->present[slot];
+    if (cnt == IOV_MAX || (!more && cnt)) {
+      WriteAllV(1, iov, cnt);
+      cnt = 0;
+    }
+    if (!more)
+      return;
+    iov[cnt].iov_base = s->ring + slot * bufsize;
+    iov[cnt].iov_len = s->lens[slot];
+    cnt++;
+    s->present[slot] = false;
+    s->bytes += s->lens[slot];
+    s->cum++;
+  }
+}
+
+static void SendAck(int fd, const struct Session *s) {
+  unsigned char ack[RUDP_ACK_SIZE] = {0};
+  struct RudpHeader h = {RUDP_ACK, 0,
+                         window > UINT16_MAX ? UINT16_MAX : (uint16_t)window,
+                         s->id, s->cum};
+  if (s->done)
+    h.flags = RUDP_FLAG_FIN;
+  RudpEncode(ack, &h);
+  for (uint32_t i = 0; i < RUDP_SACK_BITS && i + 1 < window; i++) {
+    if (s->present[(s->cum + 1 + i) % window])
+      ack[RUDP_HEADER_SIZE + i / 8] |= (unsigned char)(1u << (i % 8));
+  }
+  if (sendto(fd, ack, sizeof(ack), 0, (const SADDR *)&s->peer, SLEN) < 0)
+    perror("sendto");
+}
 
-    if ((n = recvfrom(sockfd, mesg, BUFSIZE, 0, (SADDR *)&cliaddr, &len)) < 0) {
-      perror("recvfrom");
+static void *ServeReliable(void *arg) {
+  struct Worker *w = arg;
+  Pin(w);
+  struct Session s = {0};
+  s.ring = malloc(window * bufsize);
+  s.lens = calloc(window, sizeof(*s.lens));
+  s.present = calloc(window, sizeof(*s.present));
+  struct mmsghdr *msgs = calloc(batch, sizeof(*msgs));
+  struct iovec *iov = calloc(batch, sizeof(*iov));
+  struct sockaddr_in *addrs = calloc(batch, sizeof(*addrs));
+  char *bufs = malloc(batch * bufsize);
+  if (!s.ring || !s.lens || !s.present || !msgs || !iov || !addrs || !bufs) {
+    perror("malloc");
+    exit(1);
+  }
+  for (size_t i = 0; i < batch; i++) {
+    iov[i].iov_base = bufs + i * bufsize;
+    iov[i].iov_len = bufsize;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+  }
+  // Свой генератор у потока: rand() под общей блокировкой
+  unsigned seed = (unsigned)NowNs() ^ (unsigned)(uintptr_t)w;
+  bool warned = false;
+
+  while (1) {
+    for (size_t i = 0; i < batch; i++)
+      msgs[i].msg_hdr.msg_namelen = SLEN;
+    int n = recvmmsg(w->fd, msgs, (unsigned)batch, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("recvmmsg");
       exit(1);
     }
-    mesg[n] = 0;
+    uint64_t now = NowNs();
+    bool ack = false;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < n; i++) {
+      struct RudpHeader h;
+      bytes += msgs[i].msg_len;
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        if (!warned)
+          fprintf(stderr, "datagram larger than --bufsize %zu, dropped\n",
+                  bufsize);
+        warned = true;
+        continue;
+      }
+      if (!RudpDecode(iov[i].iov_base, msgs[i].msg_len, &h) ||
+          h.type != RUDP_DATA)
+        continue;
+      if (drop_rate > 0 && !(h.flags & RUDP_FLAG_FIN) &&
+          (double)rand_r(&seed) / ((double)RAND_MAX + 1) < drop_rate) {
+        if (s.active && s.id == h.session)
+          s.dropped++;
+        continue;
+      }
+      ack |= Accept(&s, &h, &addrs[i],
+                    (char *)iov[i].iov_base + RUDP_HEADER_SIZE, now);
+    }
+    if (ack) {
+      Deliver(&s);
+      if (!s.done && s.cum == s.total)
+        Finish(&s, now);
+      SendAck(w->fd, &s);
+    }
 
-    printf("REQUEST %s      FROM %s : %d\n", mesg,
-           inet_ntop(AF_INET, (void *)&cliaddr.sin_addr.s_addr, ipadr, 16),
-           ntohs(cliaddr.sin_port));
+    __atomic_store_n(&w->packets, w->packets + (unsigned)n, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bytes, w->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->batches, w->batches + 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  size_t port = SERV_PORT;
+  size_t threads = 1;
+  size_t sockbuf = 0;
+  bool pin = true;
+  bool bufsize_set = false;
+
+  while (true) {
+    static struct option options[] = {{"port", required_argument, 0, 0},
+                                      {"bufsize", required_argument, 0, 0},
+                                      {"threads", required_argument, 0, 0},
+                                      {"batch", required_argument, 0, 0},
+                                      {"sockbuf", required_argument, 0, 0},
+                                      {"log", no_argument, 0, 0},
+                                      {"no-pin", no_argument, 0, 0},
+                                      {"reliable", no_argument, 0, 0},
+                                      {"window", required_argument, 0, 0},
+                                      {"drop-rate", required_argument, 0, 0},
+                                      {0, 0, 0, 0}};
+
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "", options, &option_index);
 
-    if (sendto(sockfd, mesg, n, 0, (SADDR *)&cliaddr, len) < 0) {
-      perror("sendto");
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0: {
+      switch (option_index) {
+      case 0:
+        if (!ParseSize(optarg, 65535, &port)) {
+          fprintf(stderr, "port must be in 1..65535\n");
+          return 1;
+        }
+        break;
+      case 1:
+        if (!ParseSize(optarg, 65536, &bufsize)) {
+          fprintf(stderr, "bufsize must be in 1..65536\n");
+          return 1;
+        }
+        bufsize_set = true;
+        break;
+      case 2:
+        if (!ParseSize(optarg, MAX_THREADS, &threads)) {
+          fprintf(stderr, "threads must be in 1..%d\n", MAX_THREADS);
+          return 1;
+        }
+        break;
+      case 3:
+        if (!ParseSize(optarg, 1024, &batch)) {
+          fprintf(stderr, "batch must be in 1..1024\n");
+          return 1;
+        }
+        break;
+      case 4:
+        if (!ParseSize(optarg, INT_MAX, &sockbuf)) {
+          fprintf(stderr, "sockbuf must be a positive integer\n");
+          return 1;
+        }
+        break;
+      case 5:
+        logging = true;
+        break;
+      case 6:
+        pin = false;
+        break;
+      case 7:
+        reliable = true;
+        break;
+      case 8:
+        if (!ParseSize(optarg, 1 << 20, &window)) {
+          fprintf(stderr, "window must be in 1..1048576\n");
+          return 1;
+        }
+        break;
+      case 9:
+        if (!ParseRate(optarg, &drop_rate)) {
+          fprintf(stderr, "drop-rate must be in [0, 1)\n");
+          return 1;
+        }
+        break;
+      default:
+        printf("Index %d is out of options\n", option_index);
+      }
+    } break;
+
+    case '?':
+      printf("Arguments error\n");
+      break;
+    default:
+      fprintf(stderr, "getopt returned character code 0%o?\n", c);
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr,
+            "Using: %s [--port %d] [--bufsize %d] [--threads 1] "
+            "[--batch %d] [--sockbuf BYTES] [--log] [--no-pin]\n"
+            "       %s --reliable [--window %d] [--drop-rate 0.01] "
+            "[--bufsize %d] ... > output\n",
+            argv[0], SERV_PORT, BUFSIZE, BATCH, argv[0], RELIABLE_WINDOW,
+            RELIABLE_BUFSIZE);
+    return 1;
+  }
+  if (reliable && !bufsize_set)
+    bufsize = RELIABLE_BUFSIZE;
+  // В stdout при --reliable идут данные
+  FILE *report = reliable ? stderr : stdout;
+
+  // Все сокеты открываем до старта потоков: bind второго сокета
+  // без SO_REUSEPORT на первом не пройдёт
+  static struct Worker workers[MAX_THREADS];
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  for (size_t i = 0; i < threads; i++) {
+    workers[i].fd = OpenSocket(port, sockbuf);
+    workers[i].cpu = pin && ncpu > 0 ? (int)(i % (size_t)ncpu) : -1;
+  }
+  fprintf(report, "SERVER starts...\n");
+  fflush(report);
+  for (size_t i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i].thread, NULL,
+                       reliable ? ServeReliable : Serve, &workers[i])) {
+      perror("pthread_create");
       exit(1);
     }
   }
+
+  unsigned long long last = 0;
+  while (1) {
+    sleep(1);
+    unsigned long long packets = 0, bytes = 0, batches = 0;
+    for (size_t i = 0; i < threads; i++) {
+      packets += __atomic_load_n(&workers[i].packets, __ATOMIC_RELAXED);
+      bytes += __atomic_load_n(&workers[i].bytes, __ATOMIC_RELAXED);
+      batches += __atomic_load_n(&workers[i].batches, __ATOMIC_RELAXED);
+    }
+    if (packets == last)
+      continue;
+    fprintf(report, "%s %llu packets (%llu/s), %llu bytes, %.1f per batch\n",
+            reliable ? "received" : "echoed", packets, packets - last, bytes,
+            batches ? (double)packets / (double)batches : 0.0);
+    fflush(report);
+    last = packets;
+  }
 }